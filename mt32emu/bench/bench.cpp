@@ -0,0 +1,324 @@
+/* Copyright (C) 2003, 2004, 2005, 2006, 2008, 2009 Dean Beeler, Jerome Fisher
+ * Copyright (C) 2011 Dean Beeler, Jerome Fisher, Sergey V. Mikayev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Renders scripted workloads with synthetic ROMs and reports how fast the synth got through them, as JSON on stdout.
+// Meant for comparing builds against each other on the same machine, not for absolute numbers.
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <new>
+
+#include "../src/mt32emu.h"
+
+#include "romFixtures.h"
+#include "workloads.h"
+
+using namespace MT32Emu;
+using namespace MT32EmuBench;
+
+#if __cplusplus >= 201103L
+#define BENCH_THROWS_BAD_ALLOC
+#define BENCH_THROWS_NOTHING noexcept
+#else
+#define BENCH_THROWS_BAD_ALLOC throw(std::bad_alloc)
+#define BENCH_THROWS_NOTHING throw()
+#endif
+
+// Heap allocations made while a workload is being measured. Rendering shouldn't allocate at all.
+static bool countingAllocations = false;
+static unsigned long allocationCount = 0;
+static unsigned long allocatedBytes = 0;
+
+static void *countedAlloc(std::size_t size) {
+	if (countingAllocations) {
+		allocationCount++;
+		allocatedBytes += size;
+	}
+	void *ptr = malloc(size == 0 ? 1 : size);
+	if (ptr == NULL) {
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void *operator new(std::size_t size) BENCH_THROWS_BAD_ALLOC {
+	return countedAlloc(size);
+}
+
+void *operator new[](std::size_t size) BENCH_THROWS_BAD_ALLOC {
+	return countedAlloc(size);
+}
+
+void operator delete(void *ptr) BENCH_THROWS_NOTHING {
+	free(ptr);
+}
+
+void operator delete[](void *ptr) BENCH_THROWS_NOTHING {
+	free(ptr);
+}
+
+#if __cplusplus >= 201402L
+// C++14 compilers call these for objects of known size, bypassing the replacements above otherwise
+void operator delete(void *ptr, std::size_t /*size*/) BENCH_THROWS_NOTHING {
+	operator delete(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t /*size*/) BENCH_THROWS_NOTHING {
+	operator delete[](ptr);
+}
+#endif
+
+static const unsigned int BLOCK_FRAMES = 256;
+
+struct Result {
+	Bit32u frames;
+	double seconds;
+	// Sum over all blocks of the partials active at the start of the block times the block length
+	unsigned long long partialSamples;
+	unsigned long allocations;
+	unsigned long allocatedBytes;
+	Bit32u peakPartials;
+	Bit32u abortedPolys;
+	Bit32u droppedNotes;
+	RenderStats stats;
+};
+
+static void printDebug(void * /*userData*/, const char *fmt, va_list list) {
+	// Keep stdout clean for the results
+	vfprintf(stderr, fmt, list);
+	fprintf(stderr, "\n");
+}
+
+static bool runWorkload(const Workload &workload, ROMFixtures &fixtures, unsigned int sampleRate, Bit32u frames, Result &result) {
+	Synth *synth = new Synth();
+	synth->setLogLevel(LogLevel_WARNING);
+	SynthProperties props;
+	memset(&props, 0, sizeof(props));
+	props.sampleRate = sampleRate;
+	props.printDebug = printDebug;
+	fixtures.install(props);
+	if (!synth->open(props)) {
+		delete synth;
+		return false;
+	}
+	workload.setup(synth);
+
+	static Bit16s buffer[BLOCK_FRAMES * 2];
+	unsigned long long partialSamples = 0;
+	allocationCount = 0;
+	allocatedBytes = 0;
+	countingAllocations = true;
+	clock_t start = clock();
+	for (Bit32u frame = 0; frame < frames; frame += BLOCK_FRAMES) {
+		Bit32u blockFrames = frames - frame < BLOCK_FRAMES ? frames - frame : BLOCK_FRAMES;
+		workload.play(synth, frame, blockFrames, sampleRate);
+		unsigned int activePartials = 0;
+		for (unsigned int i = 0; i < MT32EMU_MAX_PARTIALS; i++) {
+			if (synth->getPartial(i)->isActive()) {
+				activePartials++;
+			}
+		}
+		partialSamples += activePartials * blockFrames;
+		synth->render(buffer, blockFrames);
+	}
+	clock_t end = clock();
+	countingAllocations = false;
+	synth->getRenderStats(result.stats);
+	PolyphonyStats polyphony;
+	synth->getPolyphonyStats(polyphony);
+	result.peakPartials = polyphony.peakPartials;
+	result.abortedPolys = 0;
+	result.droppedNotes = 0;
+	for (unsigned int part = 0; part < 9; part++) {
+		for (unsigned int state = 0; state < POLY_Inactive; state++) {
+			result.abortedPolys += polyphony.parts[part].abortedPolys[state];
+		}
+		result.droppedNotes += polyphony.parts[part].notesDroppedNoPartials + polyphony.parts[part].notesDroppedNoPoly;
+	}
+
+	result.frames = frames;
+	result.seconds = (double)(end - start) / CLOCKS_PER_SEC;
+	result.partialSamples = partialSamples;
+	result.allocations = allocationCount;
+	result.allocatedBytes = allocatedBytes;
+
+	synth->close();
+	delete synth;
+	return true;
+}
+
+#if MT32EMU_PROFILE_RENDER
+static void printPartialCounters(const char *name, const RenderStats::PartialCounters &counters, bool last) {
+	printf("\t\t\t\t\"%s\": {\"ticks\": %llu, \"envelopeTicks\": %llu, \"samples\": %llu}%s\n", name, counters.ticks, counters.envelopeTicks, counters.samples, last ? "" : ",");
+}
+
+// Where the time went, in time-stamp counter ticks, for a build with MT32EMU_PROFILE_RENDER set
+static void printProfile(const RenderStats &stats) {
+	static const char *const partNames[9] = {"part1", "part2", "part3", "part4", "part5", "part6", "part7", "part8", "rhythm"};
+	printf("\t\t\t\"profile\": {\n");
+	printf("\t\t\t\t\"renderTicks\": %llu,\n", stats.renderTicks);
+	printf("\t\t\t\t\"mixTicks\": %llu,\n", stats.mixTicks);
+	printf("\t\t\t\t\"reverbTicks\": %llu,\n", stats.reverbTicks);
+	printf("\t\t\t\t\"sysexTicks\": %llu,\n", stats.sysexTicks);
+	printf("\t\t\t\t\"sysexMessages\": %u,\n", stats.sysexMessages);
+	printPartialCounters("synthPartials", stats.partialTypes[RenderStats::PartialType_SYNTH], false);
+	printPartialCounters("pcmPartials", stats.partialTypes[RenderStats::PartialType_PCM], false);
+	for (unsigned int part = 0; part < 9; part++) {
+		printPartialCounters(partNames[part], stats.parts[part], part == 8);
+	}
+	printf("\t\t\t}\n");
+}
+#endif
+
+static void printResult(const Workload &workload, unsigned int sampleRate, const Result &result, bool last) {
+	double seconds = result.seconds > 0 ? result.seconds : 1.0 / CLOCKS_PER_SEC;
+	double framesPerSecond = result.frames / seconds;
+	printf("\t\t{\n");
+	printf("\t\t\t\"name\": \"%s\",\n", workload.name);
+	printf("\t\t\t\"frames\": %u,\n", (unsigned int)result.frames);
+	printf("\t\t\t\"seconds\": %.6f,\n", result.seconds);
+	printf("\t\t\t\"framesPerSecond\": %.1f,\n", framesPerSecond);
+	printf("\t\t\t\"realtimeFactor\": %.2f,\n", framesPerSecond / sampleRate);
+	printf("\t\t\t\"averagePartials\": %.2f,\n", (double)result.partialSamples / result.frames);
+	printf("\t\t\t\"peakPartials\": %u,\n", (unsigned int)result.peakPartials);
+	printf("\t\t\t\"abortedPolys\": %u,\n", (unsigned int)result.abortedPolys);
+	printf("\t\t\t\"droppedNotes\": %u,\n", (unsigned int)result.droppedNotes);
+	printf("\t\t\t\"partialSamples\": %llu,\n", result.partialSamples);
+	if (result.partialSamples > 0) {
+		printf("\t\t\t\"nsPerPartialSample\": %.3f,\n", result.seconds * 1e9 / result.partialSamples);
+	} else {
+		printf("\t\t\t\"nsPerPartialSample\": null,\n");
+	}
+	printf("\t\t\t\"allocations\": %lu,\n", result.allocations);
+#if MT32EMU_PROFILE_RENDER
+	printf("\t\t\t\"allocatedBytes\": %lu,\n", result.allocatedBytes);
+	printProfile(result.stats);
+#else
+	printf("\t\t\t\"allocatedBytes\": %lu\n", result.allocatedBytes);
+#endif
+	printf("\t\t}%s\n", last ? "" : ",");
+}
+
+static void usage(const char *cmd) {
+	fprintf(stderr, "Usage: %s [options]\n", cmd);
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  -s seconds   Length of each workload in emulated time (default 10)\n");
+	fprintf(stderr, "  -r rate      Sample rate (default 32000)\n");
+	fprintf(stderr, "  -n runs      Runs per workload, the fastest of which is reported (default 3)\n");
+	fprintf(stderr, "  -w name      Only run the named workload (may be given more than once)\n");
+	fprintf(stderr, "  -l           List the workloads and exit\n");
+	fprintf(stderr, "Results are written to stdout as JSON.\n");
+}
+
+int main(int argc, char *argv[]) {
+	unsigned int seconds = 10;
+	unsigned int sampleRate = 32000;
+	unsigned int runs = 3;
+	bool selected[64];
+	bool anySelected = false;
+	memset(selected, 0, sizeof(selected));
+
+	for (int i = 1; i < argc; i++) {
+		if (argv[i][0] != '-' || argv[i][1] == 0 || argv[i][2] != 0) {
+			usage(argv[0]);
+			return 1;
+		}
+		if (argv[i][1] == 'l') {
+			for (unsigned int w = 0; w < WORKLOAD_COUNT; w++) {
+				printf("%-18s %s\n", WORKLOADS[w].name, WORKLOADS[w].description);
+			}
+			return 0;
+		}
+		if (i + 1 >= argc) {
+			usage(argv[0]);
+			return 1;
+		}
+		const char *arg = argv[++i];
+		switch (argv[i - 1][1]) {
+		case 's':
+			seconds = atoi(arg);
+			break;
+		case 'r':
+			sampleRate = atoi(arg);
+			break;
+		case 'n':
+			runs = atoi(arg);
+			break;
+		case 'w': {
+			unsigned int w;
+			for (w = 0; w < WORKLOAD_COUNT; w++) {
+				if (strcmp(WORKLOADS[w].name, arg) == 0) {
+					break;
+				}
+			}
+			if (w == WORKLOAD_COUNT) {
+				fprintf(stderr, "Unknown workload '%s' - use -l to list them\n", arg);
+				return 1;
+			}
+			selected[w] = true;
+			anySelected = true;
+			break;
+		}
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (seconds == 0 || sampleRate == 0 || runs == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	ROMFixtures fixtures;
+	Bit32u frames = seconds * sampleRate;
+	unsigned int lastWorkload = 0;
+	for (unsigned int w = 0; w < WORKLOAD_COUNT; w++) {
+		if (!anySelected || selected[w]) {
+			lastWorkload = w;
+		}
+	}
+
+	printf("{\n");
+	printf("\t\"sampleRate\": %u,\n", sampleRate);
+	printf("\t\"blockFrames\": %u,\n", BLOCK_FRAMES);
+	printf("\t\"runs\": %u,\n", runs);
+	printf("\t\"workloads\": [\n");
+	for (unsigned int w = 0; w < WORKLOAD_COUNT; w++) {
+		if (anySelected && !selected[w]) {
+			continue;
+		}
+		Result best = Result();
+		for (unsigned int run = 0; run < runs; run++) {
+			Result result;
+			if (!runWorkload(WORKLOADS[w], fixtures, sampleRate, frames, result)) {
+				fprintf(stderr, "Failed to open the synth with the generated ROMs\n");
+				return 1;
+			}
+			if (run == 0 || result.seconds < best.seconds) {
+				best = result;
+			}
+		}
+		printResult(WORKLOADS[w], sampleRate, best, w == lastWorkload);
+		fflush(stdout);
+	}
+	printf("\t]\n");
+	printf("}\n");
+	return 0;
+}
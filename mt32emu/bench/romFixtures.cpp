@@ -0,0 +1,305 @@
+/* Copyright (C) 2003, 2004, 2005, 2006, 2008, 2009 Dean Beeler, Jerome Fisher
+ * Copyright (C) 2011 Dean Beeler, Jerome Fisher, Sergey V. Mikayev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "romFixtures.h"
+
+using namespace MT32Emu;
+
+namespace MT32EmuBench {
+
+// Where things are in a ver1.07 control ROM - this is the "MT-32 revision 1" entry of ControlROMMaps
+static const Bit16u ID_POS = 0x4010;
+static const char ID_BYTES[] = "\000 ver1.07 10 Oct, 87 ";
+static const Bit16u PCM_TABLE = 0x3000;
+static const Bit16u PCM_COUNT = 128;
+static const Bit16u TIMBRE_A_MAP = 0x8000;
+static const Bit16u TIMBRE_A_OFFSET = 0x0000;
+static const Bit16u TIMBRE_B_MAP = 0xC000;
+static const Bit16u TIMBRE_B_OFFSET = 0x4000;
+static const Bit16u TIMBRE_R_MAP = 0x3200;
+static const Bit16u TIMBRE_R_COUNT = 30;
+static const Bit16u RHYTHM_SETTINGS = 0x73FE;
+static const Bit16u RHYTHM_SETTINGS_COUNT = 85;
+static const Bit16u RESERVE_SETTINGS = 0x57B1;
+static const Bit16u PAN_SETTINGS = 0x57CC;
+static const Bit16u PROGRAM_SETTINGS = 0x57BA;
+static const Bit16u RHYTHM_MAX_TABLE = 0x523C;
+static const Bit16u PATCH_MAX_TABLE = 0x5248;
+static const Bit16u SYSTEM_MAX_TABLE = 0x5258;
+static const Bit16u TIMBRE_MAX_TABLE = 0x51F4;
+
+// Each PCM wave is 2048 samples long
+static const unsigned int PCM_WAVE_LENGTH = 2048;
+
+static void put16(Bit8u *rom, unsigned int addr, unsigned int value) {
+	rom[addr] = value & 0xFF;
+	rom[addr + 1] = (value >> 8) & 0xFF;
+}
+
+void makeTimbre(TimbreParam *timbre, const char *name, Bit8u structure12, Bit8u structure34, Bit8u partialMute, Bit8u waveform, Bit8u pcmWave, bool noSustain, Bit8u decayTime) {
+	memset(timbre, 0, sizeof(TimbreParam));
+	size_t nameLen = strlen(name);
+	memset(timbre->common.name, ' ', sizeof(timbre->common.name));
+	memcpy(timbre->common.name, name, nameLen < sizeof(timbre->common.name) ? nameLen : sizeof(timbre->common.name));
+	timbre->common.partialStructure12 = structure12;
+	timbre->common.partialStructure34 = structure34;
+	timbre->common.partialMute = partialMute;
+	timbre->common.noSustain = noSustain ? 1 : 0;
+
+	for (int i = 0; i < 4; i++) {
+		TimbreParam::PartialParam &p = timbre->partial[i];
+		p.wg.pitchCoarse = 36 + i * 12 % 24;
+		p.wg.pitchFine = 50 + i * 3;
+		p.wg.pitchKeyfollow = 11; // 1
+		p.wg.pitchBenderEnabled = 1;
+		p.wg.waveform = waveform;
+		p.wg.pcmWave = (pcmWave + i * 2) & 0x7F;
+		p.wg.pulseWidth = 30 + i * 10;
+		p.wg.pulseWidthVeloSensitivity = 7;
+
+		for (int j = 0; j < 4; j++) {
+			p.pitchEnv.time[j] = 10 + j * 10;
+		}
+		for (int j = 0; j < 5; j++) {
+			p.pitchEnv.level[j] = 50;
+		}
+		p.pitchEnv.depth = 2;
+		p.pitchLFO.rate = 60;
+		p.pitchLFO.depth = 5;
+
+		p.tvf.cutoff = 60 + i * 10;
+		p.tvf.resonance = 10;
+		p.tvf.keyfollow = 11;
+		p.tvf.biasPoint = 64;
+		p.tvf.biasLevel = 7;
+		p.tvf.envDepth = 40;
+		p.tvf.envVeloSensitivity = 20;
+		for (int j = 0; j < 5; j++) {
+			p.tvf.envTime[j] = 10 + j * 15;
+		}
+		for (int j = 0; j < 4; j++) {
+			p.tvf.envLevel[j] = 100 - j * 10;
+		}
+
+		p.tva.level = 90;
+		p.tva.veloSensitivity = 50;
+		p.tva.biasPoint1 = 64;
+		p.tva.biasLevel1 = 12;
+		p.tva.biasPoint2 = 64;
+		p.tva.biasLevel2 = 12;
+		p.tva.envTime[0] = 1;
+		p.tva.envTime[1] = 20;
+		p.tva.envTime[2] = 30;
+		p.tva.envTime[3] = decayTime;
+		p.tva.envTime[4] = 30;
+		p.tva.envLevel[0] = 100;
+		p.tva.envLevel[1] = 90;
+		p.tva.envLevel[2] = noSustain ? 40 : 85;
+		p.tva.envLevel[3] = noSustain ? 0 : 80;
+	}
+}
+
+static void writeTimbre(Bit8u *rom, unsigned int addr, unsigned int num, bool rhythm) {
+	char name[11];
+	sprintf(name, "%s%03u", rhythm ? "RHYTHM" : "TIMBRE", num);
+	TimbreParam timbre;
+	if (rhythm) {
+		// Single PCM partials, half of them on non-looped noise bursts
+		makeTimbre(&timbre, name, 5, 5, 0x1, 0, 64 + num, true, 40);
+	} else {
+		makeTimbre(&timbre, name, num % 13, (num / 13) % 13, num % 5 == 0 ? 0x3 : 0xF, num & 1, num, false, 50);
+	}
+	memcpy(&rom[addr], &timbre, sizeof(TimbreParam));
+}
+
+void generateControlROM(Bit8u *rom) {
+	memset(rom, 0, CONTROL_ROM_SIZE);
+	memcpy(&rom[ID_POS], ID_BYTES, sizeof(ID_BYTES) - 1);
+
+	// Wave i starts at i * 2048 samples; odd waves loop. The pitch is relative to 32000Hz playback.
+	for (unsigned int i = 0; i < PCM_COUNT; i++) {
+		Bit8u *entry = &rom[PCM_TABLE + i * 4];
+		entry[0] = i;
+		entry[1] = (i & 1) ? 0x81 : 0x01;
+		put16(entry, 2, 36864 + (i % 12) * 341);
+	}
+
+	// Timbres are stored one after another behind each map
+	unsigned int timbreSize = sizeof(TimbreParam);
+	for (unsigned int i = 0; i < 64; i++) {
+		unsigned int addrA = TIMBRE_A_MAP + 0x80 + i * timbreSize;
+		put16(rom, TIMBRE_A_MAP + i * 2, addrA - TIMBRE_A_OFFSET);
+		writeTimbre(rom, addrA, i, false);
+		unsigned int addrB = TIMBRE_B_MAP + 0x80 + i * timbreSize;
+		put16(rom, TIMBRE_B_MAP + i * 2, addrB - TIMBRE_B_OFFSET);
+		writeTimbre(rom, addrB, 64 + i, false);
+	}
+	for (unsigned int i = 0; i < TIMBRE_R_COUNT; i++) {
+		unsigned int addr = i * timbreSize;
+		put16(rom, TIMBRE_R_MAP + i * 2, addr);
+		writeTimbre(rom, addr, i, true);
+	}
+
+	// Keys map onto rhythm timbres 64-93, skipping the two that are special-cased
+	for (unsigned int i = 0; i < RHYTHM_SETTINGS_COUNT; i++) {
+		Bit8u *setting = &rom[RHYTHM_SETTINGS + i * 4];
+		Bit8u timbre = 64 + i % TIMBRE_R_COUNT;
+		setting[0] = (timbre == 64 + 6 || timbre == 64 + 7) ? 64 : timbre;
+		setting[1] = 80 + i % 21;
+		setting[2] = i % 15;
+		setting[3] = 1;
+	}
+
+	static const Bit8u reserve[9] = {3, 10, 6, 4, 3, 0, 0, 0, 6};
+	memcpy(&rom[RESERVE_SETTINGS], reserve, sizeof(reserve));
+	static const Bit8u pan[8] = {7, 3, 11, 5, 9, 1, 13, 7};
+	memcpy(&rom[PAN_SETTINGS], pan, sizeof(pan));
+	static const Bit8u program[8] = {68, 48, 95, 78, 41, 3, 110, 122};
+	memcpy(&rom[PROGRAM_SETTINGS], program, sizeof(program));
+
+	// Maximum values, as documented for the MT-32
+	static const Bit8u rhythmMax[4] = {94, 100, 14, 1};
+	memcpy(&rom[RHYTHM_MAX_TABLE], rhythmMax, sizeof(rhythmMax));
+	static const Bit8u patchMax[16] = {3, 63, 48, 100, 24, 3, 1, 0, 100, 14, 0, 0, 0, 0, 0, 0};
+	memcpy(&rom[PATCH_MAX_TABLE], patchMax, sizeof(patchMax));
+	Bit8u *systemMax = &rom[SYSTEM_MAX_TABLE];
+	systemMax[0] = 127;
+	systemMax[1] = 3;
+	systemMax[2] = 7;
+	systemMax[3] = 7;
+	memset(systemMax + 4, 32, 9);
+	memset(systemMax + 13, 16, 9);
+	systemMax[22] = 100;
+	static const Bit8u timbreMax[sizeof(TimbreParam::CommonParam) + sizeof(TimbreParam::PartialParam)] = {
+		127, 127, 127, 127, 127, 127, 127, 127, 127, 127, 12, 12, 15, 1,
+		96, 100, 16, 1, 1, 127, 100, 14,
+		10, 100, 4, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+		100, 100, 100,
+		100, 30, 14, 127, 14, 100, 100, 4, 4, 100, 100, 100, 100, 100, 100, 100, 100, 100,
+		100, 100, 127, 12, 127, 12, 4, 4, 100, 100, 100, 100, 100, 100, 100, 100, 100
+	};
+	memcpy(&rom[TIMBRE_MAX_TABLE], timbreMax, sizeof(timbreMax));
+}
+
+// The inverse of the decoding in Synth::loadPCMROM(): samples are stored as a sign bit and a 15-bit
+// logarithm of the magnitude, with the bits of each 16-bit word scrambled
+static void encodeSample(Bit8u *dst, float linear) {
+	static const int order[16] = {0, 9, 1, 2, 3, 4, 5, 6, 7, 10, 11, 12, 13, 14, 15, 8};
+	float magnitude = fabs(linear);
+	int value = magnitude < 1.0f / 65536.0f ? 32767 : (int)(-2048.0 * log(magnitude) / log(2.0) + 0.5);
+	if (value < 1) {
+		value = 1;
+	} else if (value > 32767) {
+		value = 32767;
+	}
+	int log = (~value) & 0x7FFF;
+	if (linear < 0.0f) {
+		log |= 0x8000;
+	}
+	unsigned int scrambled = 0;
+	for (int u = 0; u < 15; u++) {
+		int bit = (log >> (15 - u)) & 1;
+		scrambled |= bit << (15 - order[u]);
+	}
+	dst[0] = scrambled >> 8;
+	dst[1] = scrambled & 0xFF;
+}
+
+void generatePCMROM(Bit8u *rom) {
+	unsigned int noise = 12345;
+	for (unsigned int i = 0; i < PCM_ROM_SIZE / 2; i++) {
+		unsigned int wave = i / PCM_WAVE_LENGTH;
+		unsigned int pos = i % PCM_WAVE_LENGTH;
+		float sample;
+		if (wave < 64) {
+			double period = (double)PCM_WAVE_LENGTH / (1 + wave % 16);
+			sample = 0.8f * (float)sin(2.0 * 3.14159265358979 * pos / period);
+		} else {
+			noise = noise * 1103515245 + 12345;
+			float white = ((noise >> 16) & 0x7FFF) / 16384.0f - 1.0f;
+			sample = white * (float)exp(-(double)pos / (100.0 + (wave % 16) * 60.0));
+		}
+		encodeSample(&rom[i * 2], sample);
+	}
+}
+
+class MemoryFile: public File {
+private:
+	const Bit8u *data;
+	size_t size;
+	size_t pos;
+public:
+	MemoryFile(const Bit8u *useData, size_t useSize) : data(useData), size(useSize), pos(0) {}
+
+	void close() {}
+
+	size_t read(void *in, size_t len) {
+		if (len > size - pos) {
+			len = size - pos;
+		}
+		memcpy(in, data + pos, len);
+		pos += len;
+		return len;
+	}
+
+	bool readBit8u(Bit8u *in) {
+		return read(in, 1) == 1;
+	}
+
+	bool isEOF() {
+		return pos == size;
+	}
+};
+
+ROMFixtures::ROMFixtures() {
+	controlROM = new Bit8u[CONTROL_ROM_SIZE];
+	pcmROM = new Bit8u[PCM_ROM_SIZE];
+	generateControlROM(controlROM);
+	generatePCMROM(pcmROM);
+}
+
+ROMFixtures::~ROMFixtures() {
+	delete[] controlROM;
+	delete[] pcmROM;
+}
+
+void ROMFixtures::install(SynthProperties &props) {
+	props.userData = this;
+	props.openFile = openFile;
+	props.closeFile = closeFile;
+}
+
+File *ROMFixtures::openFile(void *userData, const char *filename, File::OpenMode /*mode*/) {
+	ROMFixtures *fixtures = (ROMFixtures *)userData;
+	if (strcmp(filename, "MT32_CONTROL.ROM") == 0) {
+		return new MemoryFile(fixtures->controlROM, CONTROL_ROM_SIZE);
+	}
+	if (strcmp(filename, "MT32_PCM.ROM") == 0) {
+		return new MemoryFile(fixtures->pcmROM, PCM_ROM_SIZE);
+	}
+	return NULL;
+}
+
+void ROMFixtures::closeFile(void * /*userData*/, File *file) {
+	delete file;
+}
+
+}
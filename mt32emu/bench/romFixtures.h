@@ -0,0 +1,58 @@
+/* Copyright (C) 2003, 2004, 2005, 2006, 2008, 2009 Dean Beeler, Jerome Fisher
+ * Copyright (C) 2011 Dean Beeler, Jerome Fisher, Sergey V. Mikayev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MT32EMU_BENCH_ROM_FIXTURES_H
+#define MT32EMU_BENCH_ROM_FIXTURES_H
+
+#include "../src/mt32emu.h"
+
+namespace MT32EmuBench {
+
+// Synthetic stand-ins for the MT-32 ROMs, which can't be distributed. They are laid out like a real ver1.07 control
+// ROM (so the synth identifies them through ControlROMMaps and takes every code path real ROMs do) but the contents
+// are made up: sines and decaying noise bursts for PCM waves, and simple generated timbres. Good for measuring, not
+// for listening.
+const unsigned int PCM_ROM_SIZE = 512 * 1024;
+
+void generateControlROM(MT32Emu::Bit8u *rom);
+void generatePCMROM(MT32Emu::Bit8u *rom);
+
+// Fills in a timbre whose parameters are all within the limits of the generated control ROM.
+// The partials are unmuted according to partialMute; PCM partials use pcmWave, synth partials use waveform (0 or 1).
+// With noSustain set the notes decay over roughly decayTime (0-100) whether or not the key is held.
+void makeTimbre(MT32Emu::TimbreParam *timbre, const char *name, MT32Emu::Bit8u structure12, MT32Emu::Bit8u structure34, MT32Emu::Bit8u partialMute, MT32Emu::Bit8u waveform, MT32Emu::Bit8u pcmWave, bool noSustain, MT32Emu::Bit8u decayTime);
+
+// Serves the generated ROMs to a synth in place of files, through SynthProperties::openFile and closeFile
+class ROMFixtures {
+public:
+	ROMFixtures();
+	~ROMFixtures();
+
+	// Sets the callbacks (and userData) in the properties so that the synth loads the fixtures
+	void install(MT32Emu::SynthProperties &props);
+
+private:
+	MT32Emu::Bit8u *controlROM;
+	MT32Emu::Bit8u *pcmROM;
+
+	static MT32Emu::File *openFile(void *userData, const char *filename, MT32Emu::File::OpenMode mode);
+	static void closeFile(void *userData, MT32Emu::File *file);
+};
+
+}
+
+#endif
@@ -0,0 +1,300 @@
+/* Copyright (C) 2003, 2004, 2005, 2006, 2008, 2009 Dean Beeler, Jerome Fisher
+ * Copyright (C) 2011 Dean Beeler, Jerome Fisher, Sergey V. Mikayev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+
+#include "romFixtures.h"
+#include "workloads.h"
+
+using namespace MT32Emu;
+
+namespace MT32EmuBench {
+
+// Start addresses of the memory areas, in the 7-bit form used in sysex
+static const Bit32u ADDR_PATCH_TEMP = 0x030000;
+static const Bit32u ADDR_RHYTHM_TEMP = 0x030110;
+static const Bit32u ADDR_TIMBRE_TEMP = 0x040000;
+static const Bit32u ADDR_PATCHES = 0x050000;
+static const Bit32u ADDR_TIMBRES = 0x080000;
+static const Bit32u ADDR_SYSTEM = 0x100000;
+
+static const Bit32u PADDED_TIMBRE_SIZE = 256;
+static const unsigned int RHYTHM_CHANNEL = 9;
+
+// Adds a byte offset to a 7-bit address
+static Bit32u offsetAddress(Bit32u addr, Bit32u offset) {
+	Bit32u linear = ((addr >> 16) << 14) | (((addr >> 8) & 0x7F) << 7) | (addr & 0x7F);
+	linear += offset;
+	return ((linear >> 14) << 16) | (((linear >> 7) & 0x7F) << 8) | (linear & 0x7F);
+}
+
+// Sends a Roland DT1 message writing len bytes at addr
+static void writeMemory(Synth *synth, Bit32u addr, const void *data, Bit32u len) {
+	Bit8u sysex[MAX_SYSEX_SIZE];
+	sysex[0] = 0xF0;
+	sysex[1] = SYSEX_MANUFACTURER_ROLAND;
+	sysex[2] = 0x10;
+	sysex[3] = SYSEX_MDL_MT32;
+	sysex[4] = SYSEX_CMD_DT1;
+	sysex[5] = (addr >> 16) & 0x7F;
+	sysex[6] = (addr >> 8) & 0x7F;
+	sysex[7] = addr & 0x7F;
+	memcpy(&sysex[8], data, len);
+	sysex[8 + len] = Synth::calcSysexChecksum(&sysex[5], 3 + len, 0);
+	sysex[9 + len] = 0xF7;
+	synth->playSysex(sysex, 10 + len);
+}
+
+static void noteOn(Synth *synth, unsigned int channel, unsigned int key, unsigned int velocity) {
+	synth->playMsg(0x90 | channel | (key << 8) | (velocity << 16));
+}
+
+static void noteOff(Synth *synth, unsigned int channel, unsigned int key) {
+	synth->playMsg(0x80 | channel | (key << 8));
+}
+
+// True for the block which contains a multiple of interval
+static bool crosses(Bit32u frame, Bit32u blockFrames, Bit32u interval) {
+	return frame % interval < blockFrames;
+}
+
+// Partial reserve for parts 1-8 and the rhythm part
+static void setPartialReserve(Synth *synth, const Bit8u *reserve) {
+	writeMemory(synth, offsetAddress(ADDR_SYSTEM, 4), reserve, 9);
+}
+
+static void setPartTimbres(Synth *synth, const TimbreParam *timbre) {
+	for (unsigned int part = 0; part < 8; part++) {
+		writeMemory(synth, offsetAddress(ADDR_TIMBRE_TEMP, part * sizeof(TimbreParam)), timbre, sizeof(TimbreParam));
+	}
+}
+
+// Part n listens on MIDI channel n + 1 by default (the rhythm part on channel 10)
+static void retriggerParts(Synth *synth, Bit32u frame, Bit32u blockFrames, unsigned int sampleRate, Bit32u interval, unsigned int parts) {
+	if (!crosses(frame, blockFrames, interval)) {
+		return;
+	}
+	Bit32u beat = frame / interval;
+	for (unsigned int part = 0; part < parts; part++) {
+		if (beat > 0) {
+			noteOff(synth, part + 1, 36 + part * 5 + (beat - 1) % 12);
+		}
+		noteOn(synth, part + 1, 36 + part * 5 + beat % 12, 100);
+	}
+	(void)sampleRate;
+}
+
+
+// All 32 partials busy with synthesised square waves
+static void setupSynthSquare(Synth *synth) {
+	static const Bit8u reserve[9] = {4, 4, 4, 4, 4, 4, 4, 4, 0};
+	setPartialReserve(synth, reserve);
+	TimbreParam timbre;
+	makeTimbre(&timbre, "SQUARE", 0, 0, 0xF, 0, 0, false, 50);
+	setPartTimbres(synth, &timbre);
+}
+
+static void playSynthSquare(Synth *synth, Bit32u frame, Bit32u blockFrames, unsigned int sampleRate) {
+	retriggerParts(synth, frame, blockFrames, sampleRate, sampleRate, 8);
+}
+
+
+// Rapid drum hits through the rhythm part, each using four PCM partials playing decaying looped noise
+static const unsigned int DRUM_FIRST_KEY = 35;
+static const unsigned int DRUM_KEYS = 16;
+
+static void setupPCMDrums(Synth *synth) {
+	static const Bit8u reserve[9] = {2, 2, 2, 2, 2, 2, 2, 2, 16};
+	setPartialReserve(synth, reserve);
+	// Rhythm keys refer to timbres 0-63 in the memory area
+	for (unsigned int i = 0; i < 4; i++) {
+		TimbreParam timbre;
+		makeTimbre(&timbre, "DRUM", 5, 5, 0xF, 0, 65 + i * 8, true, 30 + i * 5);
+		writeMemory(synth, offsetAddress(ADDR_TIMBRES, i * PADDED_TIMBRE_SIZE), &timbre, sizeof(TimbreParam));
+	}
+	for (unsigned int i = 0; i < DRUM_KEYS; i++) {
+		Bit8u setting[4] = {(Bit8u)(i % 4), 100, (Bit8u)(i % 15), 1};
+		writeMemory(synth, offsetAddress(ADDR_RHYTHM_TEMP, (DRUM_FIRST_KEY - 24 + i) * 4), setting, 4);
+	}
+}
+
+static void playPCMDrums(Synth *synth, Bit32u frame, Bit32u blockFrames, unsigned int sampleRate) {
+	Bit32u interval = sampleRate / 16;
+	if (!crosses(frame, blockFrames, interval)) {
+		return;
+	}
+	Bit32u step = frame / interval;
+	noteOn(synth, RHYTHM_CHANNEL, DRUM_FIRST_KEY + step % DRUM_KEYS, 100);
+	noteOn(synth, RHYTHM_CHANNEL, DRUM_FIRST_KEY + (step * 7 + 3) % DRUM_KEYS, 90);
+	if (step % 2 == 0) {
+		noteOn(synth, RHYTHM_CHANNEL, DRUM_FIRST_KEY + (step * 5 + 1) % DRUM_KEYS, 110);
+	}
+}
+
+
+// Both ring modulation structures: synth x synth on partials 1 and 2, PCM x synth on 3 and 4
+static void setupRingMod(Synth *synth) {
+	static const Bit8u reserve[9] = {4, 4, 4, 4, 4, 4, 4, 4, 0};
+	setPartialReserve(synth, reserve);
+	TimbreParam timbre;
+	makeTimbre(&timbre, "RINGMOD", 1, 3, 0xF, 1, 1, false, 50);
+	setPartTimbres(synth, &timbre);
+}
+
+static void playRingMod(Synth *synth, Bit32u frame, Bit32u blockFrames, unsigned int sampleRate) {
+	retriggerParts(synth, frame, blockFrames, sampleRate, sampleRate, 8);
+}
+
+
+// Sparse short notes, so that most of the time goes into the reverb
+static void setupReverb(Synth *synth, Bit8u mode) {
+	Bit8u reverb[3] = {mode, 7, 7};
+	writeMemory(synth, offsetAddress(ADDR_SYSTEM, 1), reverb, 3);
+	TimbreParam timbre;
+	makeTimbre(&timbre, "PLUCK", 0, 0, 0x3, 1, 0, true, 20);
+	setPartTimbres(synth, &timbre);
+}
+
+static void setupReverbRoom(Synth *synth) {
+	setupReverb(synth, 0);
+}
+
+static void setupReverbHall(Synth *synth) {
+	setupReverb(synth, 1);
+}
+
+static void setupReverbPlate(Synth *synth) {
+	setupReverb(synth, 2);
+}
+
+static void setupReverbTapDelay(Synth *synth) {
+	setupReverb(synth, 3);
+}
+
+static void playReverb(Synth *synth, Bit32u frame, Bit32u blockFrames, unsigned int sampleRate) {
+	retriggerParts(synth, frame, blockFrames, sampleRate, sampleRate / 2, 2);
+}
+
+
+// Twice a second, what a game uploads at startup: all memory timbres, all patches, the rhythm setup and
+// the system area, while a chord plays
+static void setupSysexBulk(Synth *synth) {
+	TimbreParam timbre;
+	makeTimbre(&timbre, "PAD", 0, 0, 0x3, 0, 0, false, 50);
+	setPartTimbres(synth, &timbre);
+}
+
+static void playSysexBulk(Synth *synth, Bit32u frame, Bit32u blockFrames, unsigned int sampleRate) {
+	retriggerParts(synth, frame, blockFrames, sampleRate, sampleRate, 4);
+	if (!crosses(frame, blockFrames, sampleRate / 2)) {
+		return;
+	}
+	Bit32u upload = frame / (sampleRate / 2);
+	for (unsigned int i = 0; i < 64; i++) {
+		TimbreParam timbre;
+		makeTimbre(&timbre, "BULK", (i + upload) % 13, i % 13, 0xF, i & 1, i, i % 3 == 0, 40);
+		writeMemory(synth, offsetAddress(ADDR_TIMBRES, i * PADDED_TIMBRE_SIZE), &timbre, sizeof(TimbreParam));
+	}
+	for (unsigned int block = 0; block < 8; block++) {
+		PatchParam patches[16];
+		for (unsigned int i = 0; i < 16; i++) {
+			PatchParam &patch = patches[i];
+			patch.timbreGroup = (block * 16 + i + upload) % 3;
+			patch.timbreNum = (block * 16 + i) % 64;
+			patch.keyShift = 24;
+			patch.fineTune = 50;
+			patch.benderRange = 12;
+			patch.assignMode = 0;
+			patch.reverbSwitch = 1;
+			patch.dummy = 0;
+		}
+		writeMemory(synth, offsetAddress(ADDR_PATCHES, block * sizeof(patches)), patches, sizeof(patches));
+	}
+	Bit8u rhythm[85 * 4];
+	for (unsigned int i = 0; i < 85; i++) {
+		rhythm[i * 4] = (i + upload) % 64;
+		rhythm[i * 4 + 1] = 100;
+		rhythm[i * 4 + 2] = 7;
+		rhythm[i * 4 + 3] = 1;
+	}
+	writeMemory(synth, ADDR_RHYTHM_TEMP, rhythm, sizeof(rhythm));
+	static const Bit8u system[23] = {64, 0, 5, 3, 4, 4, 4, 4, 4, 4, 4, 4, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 100};
+	writeMemory(synth, ADDR_SYSTEM, system, sizeof(system));
+}
+
+
+// Dense streams of notes, controllers, pitch bends and program changes on every channel
+static Bit32u floodRandom;
+
+static Bit32u nextRandom() {
+	floodRandom = floodRandom * 1103515245 + 12345;
+	return (floodRandom >> 16) & 0x7FFF;
+}
+
+static void setupMIDIFlood(Synth * /*synth*/) {
+	floodRandom = 1;
+}
+
+static void playMIDIFlood(Synth *synth, Bit32u frame, Bit32u blockFrames, unsigned int sampleRate) {
+	// About 6000 messages per second, the most a MIDI cable could carry being around 1000
+	unsigned int messages = 6000 * blockFrames / sampleRate;
+	for (unsigned int i = 0; i < messages; i++) {
+		unsigned int channel = 1 + i % 9;
+		Bit32u r = nextRandom();
+		switch (r % 8) {
+		case 0:
+		case 1:
+		case 2:
+			noteOn(synth, channel, 36 + r % 48, 40 + r % 80);
+			break;
+		case 3:
+		case 4:
+			noteOff(synth, channel, 36 + (r >> 3) % 48);
+			break;
+		case 5:
+			synth->playMsg(0xB0 | channel | (((r >> 3) & 1 ? 7 : 10) << 8) | ((r >> 4) % 128 << 16));
+			break;
+		case 6:
+			synth->playMsg(0xE0 | channel | (((r >> 3) & 0x7F) << 8) | (((r >> 10) & 0x7F) << 16));
+			break;
+		default:
+			if (frame % (sampleRate / 4) < blockFrames) {
+				synth->playMsg(0xC0 | channel | (((r >> 3) % 128) << 8));
+			} else {
+				synth->playMsg(0xB0 | channel | (1 << 8) | ((r >> 3) % 128 << 16));
+			}
+			break;
+		}
+	}
+}
+
+
+const Workload WORKLOADS[] = {
+	{"synth-square", "32 synth partials playing square waves", setupSynthSquare, playSynthSquare},
+	{"pcm-drums", "16 drum hits per second, four PCM partials each", setupPCMDrums, playPCMDrums},
+	{"ring-mod", "32 partials in ring modulation structures", setupRingMod, playRingMod},
+	{"reverb-room", "Sparse notes through the room reverb", setupReverbRoom, playReverb},
+	{"reverb-hall", "Sparse notes through the hall reverb", setupReverbHall, playReverb},
+	{"reverb-plate", "Sparse notes through the plate reverb", setupReverbPlate, playReverb},
+	{"reverb-tap-delay", "Sparse notes through the tap delay", setupReverbTapDelay, playReverb},
+	{"sysex-bulk", "Full timbre, patch, rhythm and system uploads twice a second", setupSysexBulk, playSysexBulk},
+	{"midi-flood", "About 6000 MIDI messages per second across all parts", setupMIDIFlood, playMIDIFlood}
+};
+
+const unsigned int WORKLOAD_COUNT = sizeof(WORKLOADS) / sizeof(WORKLOADS[0]);
+
+}
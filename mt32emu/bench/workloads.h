@@ -0,0 +1,41 @@
+/* Copyright (C) 2003, 2004, 2005, 2006, 2008, 2009 Dean Beeler, Jerome Fisher
+ * Copyright (C) 2011 Dean Beeler, Jerome Fisher, Sergey V. Mikayev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MT32EMU_BENCH_WORKLOADS_H
+#define MT32EMU_BENCH_WORKLOADS_H
+
+#include "../src/mt32emu.h"
+
+namespace MT32EmuBench {
+
+// A scripted piece of MIDI input. Events are sent as real MIDI messages and sysex, so they take the same path
+// through the synth as they would coming from a sequencer.
+struct Workload {
+	const char *name;
+	const char *description;
+	// Called once the synth is open, outside of the measurement
+	void (*setup)(MT32Emu::Synth *synth);
+	// Called before each block of blockFrames is rendered, starting at frame
+	void (*play)(MT32Emu::Synth *synth, MT32Emu::Bit32u frame, MT32Emu::Bit32u blockFrames, unsigned int sampleRate);
+};
+
+extern const Workload WORKLOADS[];
+extern const unsigned int WORKLOAD_COUNT;
+
+}
+
+#endif
@@ -72,7 +72,7 @@ void ExternalInterface::doControlPanelComm(Synth *synth, int sndBufLength) {
 							*bufptr++ = 0;
 							*bufptr++ = 0;
 						} else {
-							int tvaPhase = synth->getPartial(i)->tva->getPhase();
+							int tvaPhase = synth->getPartial(i)->tva.getPhase();
 							if (tvaPhase == TVA_PHASE_SUSTAIN) {
 								*bufptr++ = 2;
 							} else if (tvaPhase == TVA_PHASE_RELEASE) {
@@ -0,0 +1,274 @@
+/* Copyright (C) 2003, 2004, 2005, 2006, 2008, 2009 Dean Beeler, Jerome Fisher
+ * Copyright (C) 2011 Dean Beeler, Jerome Fisher, Sergey V. Mikayev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+
+#include "mt32emu.h"
+
+using namespace MT32Emu;
+
+// Partials which haven't made a sound this long after their event took effect are given up on
+static const unsigned int SOUND_TIMEOUT_SECONDS = 1;
+
+LatencyTrace::LatencyTrace(unsigned int useCapacity, Bit64u (*useClock)(void *clockData), void *useClockData) {
+	capacity = useCapacity > 0 ? useCapacity : 1;
+	events = new Event[capacity];
+	// Touch every page now rather than while rendering
+	memset(events, 0, capacity * sizeof(Event));
+	clock = useClock;
+	clockData = useClockData;
+	sampleRate = 0;
+	nextSeq = 0;
+	unrenderedSeq = 0;
+	unresolvedSeq = 0;
+	uncollectedSeq = 0;
+	arrivalTimeSet = false;
+	arrivalTime = 0;
+	eventInProgress = false;
+	currentSeq = 0;
+	renderCall = 0;
+	framePosition = 0;
+	outputTime = 0;
+	outputFrame = 0;
+	pendingPartials = 0;
+	memset(partialSeqs, 0, sizeof(partialSeqs));
+}
+
+LatencyTrace::~LatencyTrace() {
+	delete[] events;
+}
+
+LatencyTrace::Event *LatencyTrace::findEvent(Bit32u seq) {
+	Bit32u age = nextSeq - seq;
+	if (age == 0 || age > capacity) {
+		return NULL;
+	}
+	return &events[seq % capacity];
+}
+
+const LatencyTrace::Event *LatencyTrace::findEvent(Bit32u seq) const {
+	Bit32u age = nextSeq - seq;
+	if (age == 0 || age > capacity) {
+		return NULL;
+	}
+	return &events[seq % capacity];
+}
+
+// Skips a position forward past events which have been overwritten
+static void skipOverwritten(Bit32u &seq, Bit32u nextSeq, unsigned int capacity) {
+	if (nextSeq - seq > capacity) {
+		seq = nextSeq - capacity;
+	}
+}
+
+Bit64u LatencyTrace::frameToOutputTime(Bit64u frame) const {
+	if (sampleRate == 0) {
+		return outputTime;
+	}
+	if (frame >= outputFrame) {
+		return outputTime + (frame - outputFrame) * 1000000000 / sampleRate;
+	}
+	return outputTime - (outputFrame - frame) * 1000000000 / sampleRate;
+}
+
+void LatencyTrace::setArrivalTime(Bit64u time) {
+	arrivalTime = time;
+	arrivalTimeSet = true;
+}
+
+void LatencyTrace::setOutputTime(Bit64u time) {
+	outputTime = time;
+	outputFrame = framePosition;
+
+	// Events get their output times in order, so one still waiting for its partials holds up those after it
+	skipOverwritten(unresolvedSeq, nextSeq, capacity);
+	while (unresolvedSeq != nextSeq) {
+		Event &event = events[unresolvedSeq % capacity];
+		if ((event.flags & EventFlag_RENDERED) == 0) {
+			break;
+		}
+		if ((event.flags & EventFlag_SOUNDED) != 0) {
+			event.outputTime = frameToOutputTime(event.firstSoundFrame);
+		} else if (event.partialsStarted == 0 || framePosition - event.effectFrame >= (Bit64u)sampleRate * SOUND_TIMEOUT_SECONDS) {
+			event.outputTime = frameToOutputTime(event.effectFrame);
+		} else {
+			break;
+		}
+		event.flags |= EventFlag_OUTPUT;
+		unresolvedSeq++;
+	}
+}
+
+unsigned int LatencyTrace::collectLatencies(Bit64u *latencies, unsigned int maxCount) {
+	unsigned int count = 0;
+	skipOverwritten(uncollectedSeq, nextSeq, capacity);
+	while (uncollectedSeq != unresolvedSeq && count < maxCount) {
+		const Event &event = events[uncollectedSeq % capacity];
+		const Bit32u wanted = EventFlag_ARRIVED | EventFlag_SOUNDED | EventFlag_OUTPUT;
+		if ((event.flags & wanted) == wanted && event.outputTime >= event.arrivalTime) {
+			latencies[count++] = event.outputTime - event.arrivalTime;
+		}
+		uncollectedSeq++;
+	}
+	return count;
+}
+
+unsigned int LatencyTrace::getEventCount() const {
+	return nextSeq < capacity ? nextSeq : capacity;
+}
+
+void LatencyTrace::getEvent(unsigned int index, Event &event) const {
+	event = events[(nextSeq - getEventCount() + index) % capacity];
+}
+
+static const char *getMessageName(Bit32u message) {
+	switch (message & 0xF0) {
+	case 0x80:
+		return "Note Off";
+	case 0x90:
+		return (message & 0xFF0000) == 0 ? "Note Off" : "Note On";
+	case 0xA0:
+		return "Key Pressure";
+	case 0xB0:
+		return "Control Change";
+	case 0xC0:
+		return "Program Change";
+	case 0xD0:
+		return "Channel Pressure";
+	case 0xE0:
+		return "Pitch Bend";
+	default:
+		return "Sysex";
+	}
+}
+
+bool LatencyTrace::writeChromeTrace(FILE *file) const {
+	const Bit32u complete = EventFlag_ARRIVED | EventFlag_OUTPUT;
+	unsigned int count = getEventCount();
+	Bit64u baseTime = 0;
+	bool haveBaseTime = false;
+	for (unsigned int i = 0; i < count; i++) {
+		const Event &event = events[(nextSeq - count + i) % capacity];
+		if ((event.flags & complete) == complete && (!haveBaseTime || event.arrivalTime < baseTime)) {
+			baseTime = event.arrivalTime;
+			haveBaseTime = true;
+		}
+	}
+
+	fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+	bool first = true;
+	for (unsigned int i = 0; i < count; i++) {
+		const Event &event = events[(nextSeq - count + i) % capacity];
+		if ((event.flags & complete) != complete || event.outputTime < event.arrivalTime) {
+			continue;
+		}
+		// One row per MIDI channel, with sysex on row 0
+		bool isSysex = event.sysexLength != 0;
+		unsigned int tid = isSysex ? 0 : (event.message & 0x0F) + 1;
+		double start = (event.arrivalTime - baseTime) / 1000.0;
+		if (!first) {
+			fprintf(file, ",\n");
+		}
+		first = false;
+		if (isSysex) {
+			fprintf(file, "{\"name\": \"Sysex (%u bytes)\"", (unsigned int)event.sysexLength);
+		} else {
+			fprintf(file, "{\"name\": \"%s %u\"", getMessageName(event.message), (unsigned int)((event.message >> 8) & 0x7F));
+		}
+		fprintf(file, ", \"cat\": \"midi\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f", tid, start, (event.outputTime - event.arrivalTime) / 1000.0);
+		fprintf(file, ", \"args\": {\"message\": \"0x%06X\", \"renderCall\": %u, \"effectFrame\": %llu, \"partials\": \"0x%08X\"", (unsigned int)event.message, (unsigned int)event.renderCall, event.effectFrame, (unsigned int)event.partialsStarted);
+		if ((event.flags & EventFlag_SOUNDED) != 0) {
+			fprintf(file, ", \"firstSoundFrame\": %llu", event.firstSoundFrame);
+		}
+		fprintf(file, "}}");
+		// Nested inside: the wait for the render call in which the event took effect
+		if (event.renderTime >= event.arrivalTime && event.renderTime <= event.outputTime && clock != NULL) {
+			fprintf(file, ",\n{\"name\": \"queued\", \"cat\": \"midi\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}", tid, start, (event.renderTime - event.arrivalTime) / 1000.0);
+		}
+	}
+	fprintf(file, "\n]}\n");
+	return ferror(file) == 0;
+}
+
+void LatencyTrace::attach(unsigned int newSampleRate) {
+	sampleRate = newSampleRate;
+	// Partials of a previous synth will never make a sound
+	pendingPartials = 0;
+	eventInProgress = false;
+}
+
+void LatencyTrace::eventStarted(Bit32u message, Bit32u sysexLength) {
+	currentSeq = nextSeq++;
+	Event &event = events[currentSeq % capacity];
+	memset(&event, 0, sizeof(event));
+	if (arrivalTimeSet) {
+		event.flags = EventFlag_ARRIVED;
+		event.arrivalTime = arrivalTime;
+		arrivalTimeSet = false;
+	}
+	event.message = message;
+	event.sysexLength = sysexLength;
+	event.effectFrame = framePosition;
+	eventInProgress = true;
+}
+
+void LatencyTrace::eventFinished() {
+	eventInProgress = false;
+}
+
+void LatencyTrace::partialStarted(unsigned int partialNum) {
+	Bit32u bit = 1u << partialNum;
+	Event *event = eventInProgress ? findEvent(currentSeq) : NULL;
+	if (event == NULL) {
+		pendingPartials &= ~bit;
+		return;
+	}
+	event->partialsStarted |= bit;
+	partialSeqs[partialNum] = currentSeq;
+	pendingPartials |= bit;
+}
+
+void LatencyTrace::partialRendered(unsigned int partialNum, const float *leftBuf, const float *rightBuf, Bit32u len) {
+	for (Bit32u i = 0; i < len; i++) {
+		if (leftBuf[i] != 0.0f || rightBuf[i] != 0.0f) {
+			pendingPartials &= ~(1u << partialNum);
+			Event *event = findEvent(partialSeqs[partialNum]);
+			if (event != NULL && (event->flags & EventFlag_SOUNDED) == 0) {
+				event->firstSoundFrame = framePosition + i;
+				event->flags |= EventFlag_SOUNDED;
+			}
+			return;
+		}
+	}
+}
+
+void LatencyTrace::renderStarted() {
+	renderCall++;
+	Bit64u renderTime = clock != NULL ? clock(clockData) : 0;
+	skipOverwritten(unrenderedSeq, nextSeq, capacity);
+	while (unrenderedSeq != nextSeq) {
+		Event &event = events[unrenderedSeq % capacity];
+		event.renderCall = renderCall;
+		event.renderTime = renderTime;
+		event.flags |= EventFlag_RENDERED;
+		unrenderedSeq++;
+	}
+}
+
+void LatencyTrace::framesRendered(Bit32u len) {
+	framePosition += len;
+}
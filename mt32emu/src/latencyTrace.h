@@ -0,0 +1,147 @@
+/* Copyright (C) 2003, 2004, 2005, 2006, 2008, 2009 Dean Beeler, Jerome Fisher
+ * Copyright (C) 2011 Dean Beeler, Jerome Fisher, Sergey V. Mikayev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MT32EMU_LATENCY_TRACE_H
+#define MT32EMU_LATENCY_TRACE_H
+
+#include <cstdio>
+
+namespace MT32Emu {
+
+class Synth;
+class PartialManager;
+
+// Follows MIDI messages and sysex through the synth, to measure how long each took from arriving at the host to
+// being heard. For every event played, it records when the host received it, the render call and frame at which it
+// took effect, the partials it started and the first frame in which one of them produced a non-zero sample. Once the
+// host says when rendered frames reach the output, that frame is turned into an output time.
+//
+// Events are kept in a ring allocated up front, so the oldest are overwritten once it's full. Nothing is
+// synchronised: all calls, including those made by the synth, must come from the thread using the synth.
+//
+// Times are in whatever unit the host uses for arrival and output times, which is assumed to be nanoseconds when
+// converting frames and writing the Chrome trace.
+class LatencyTrace {
+	friend class Synth;
+	friend class PartialManager;
+public:
+	enum EventFlags {
+		// arrivalTime is set
+		EventFlag_ARRIVED = 1,
+		// renderCall, renderTime and effectFrame are set
+		EventFlag_RENDERED = 2,
+		// firstSoundFrame is set
+		EventFlag_SOUNDED = 4,
+		// outputTime is set. If the event started partials but EventFlag_SOUNDED isn't set, they never produced
+		// any sound and outputTime is when the event took effect.
+		EventFlag_OUTPUT = 8
+	};
+
+	struct Event {
+		Bit32u flags;
+		// Packed short message as passed to Synth::playMsg(), or 0xF0 for sysex
+		Bit32u message;
+		Bit32u sysexLength;
+		// Bit n set for partial n
+		Bit32u partialsStarted;
+		Bit64u arrivalTime;
+		// Counted from 1 from when the trace was created
+		Bit32u renderCall;
+		// When the render call started, according to the clock passed to the constructor
+		Bit64u renderTime;
+		// Frames are counted from when the trace was created
+		Bit64u effectFrame;
+		Bit64u firstSoundFrame;
+		Bit64u outputTime;
+	};
+
+	// capacity events are allocated straight away. clock, if not NULL, is called to time render calls.
+	LatencyTrace(unsigned int capacity, Bit64u (*clock)(void *clockData), void *clockData);
+	~LatencyTrace();
+
+	// Sets the time at which the next event the synth plays arrived at the host
+	void setArrivalTime(Bit64u time);
+	// Sets the time at which the next frame to be rendered will reach the output (e.g. the DAC). Output times are
+	// worked out from the most recent such call, assuming the output runs without gaps at the synth's sample rate.
+	void setOutputTime(Bit64u time);
+
+	// Copies the latencies (output time minus arrival time) of events which made a sound, and got their output
+	// time since the previous call, to latencies. Returns how many were copied, at most maxCount.
+	unsigned int collectLatencies(Bit64u *latencies, unsigned int maxCount);
+
+	// Returns the number of events held, and copies one of them. Index 0 is the oldest.
+	unsigned int getEventCount() const;
+	void getEvent(unsigned int index, Event &event) const;
+
+	// Writes the events which have an arrival and output time in the Chrome trace event format (JSON), as understood
+	// by chrome://tracing and Perfetto. Returns false if writing failed.
+	bool writeChromeTrace(FILE *file) const;
+
+private:
+	Event *events;
+	unsigned int capacity;
+	Bit64u (*clock)(void *clockData);
+	void *clockData;
+	unsigned int sampleRate;
+
+	// Sequence numbers, each counting events from the start. Event n is at events[n % capacity] while n + capacity >= nextSeq.
+	Bit32u nextSeq;
+	// Events from here on haven't reached a render call yet
+	Bit32u unrenderedSeq;
+	// Events from here on may not have an output time yet
+	Bit32u unresolvedSeq;
+	// Events from here on haven't been passed to collectLatencies()
+	Bit32u uncollectedSeq;
+
+	bool arrivalTimeSet;
+	Bit64u arrivalTime;
+	// Whether partials being started now belong to the event at currentSeq
+	bool eventInProgress;
+	Bit32u currentSeq;
+
+	Bit32u renderCall;
+	Bit64u framePosition;
+	Bit64u outputTime;
+	Bit64u outputFrame;
+
+	// Bit n set when partial n was started by the event partialSeqs[n] and hasn't made a sound yet
+	Bit32u pendingPartials;
+	Bit32u partialSeqs[MT32EMU_MAX_PARTIALS];
+
+	LatencyTrace(const LatencyTrace &);
+	LatencyTrace &operator=(const LatencyTrace &);
+
+	Event *findEvent(Bit32u seq);
+	const Event *findEvent(Bit32u seq) const;
+	Bit64u frameToOutputTime(Bit64u frame) const;
+
+	// Called by the synth
+	void attach(unsigned int sampleRate);
+	void eventStarted(Bit32u message, Bit32u sysexLength);
+	void eventFinished();
+	void partialStarted(unsigned int partialNum);
+	bool isPartialPending(unsigned int partialNum) const {
+		return (pendingPartials & (1u << partialNum)) != 0;
+	}
+	void partialRendered(unsigned int partialNum, const float *leftBuf, const float *rightBuf, Bit32u len);
+	void renderStarted();
+	void framesRendered(Bit32u len);
+};
+
+}
+
+#endif
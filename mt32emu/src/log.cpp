@@ -0,0 +1,71 @@
+/* Copyright (C) 2003, 2004, 2005, 2006, 2008, 2009 Dean Beeler, Jerome Fisher
+ * Copyright (C) 2011 Dean Beeler, Jerome Fisher, Sergey V. Mikayev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+
+#include "mt32emu.h"
+
+#ifdef _MSC_VER
+#define vsnprintf _vsnprintf
+#endif
+
+namespace MT32Emu {
+
+LogRing::LogRing() : writeIx(0), readIx(0), droppedCount(0), reportedDroppedCount(0) {
+}
+
+void LogRing::push(LogLevel level, LogCategory category, const char *fmt, va_list ap) {
+	Bit32u ix = writeIx;
+	if (ix - readIx >= CAPACITY) {
+		droppedCount = droppedCount + 1;
+		return;
+	}
+	Entry &entry = entries[ix % CAPACITY];
+	entry.level = level;
+	entry.category = category;
+	vsnprintf(entry.text, sizeof(entry.text), fmt, ap);
+	// Truncated messages aren't necessarily terminated by _vsnprintf()
+	entry.text[MAX_MESSAGE_LENGTH] = 0;
+	// The entry must be complete before the consumer can see it
+	MT32EMU_MEMORY_BARRIER();
+	writeIx = ix + 1;
+}
+
+const LogRing::Entry *LogRing::peek() const {
+	Bit32u ix = readIx;
+	if (ix == writeIx) {
+		return NULL;
+	}
+	// Don't read the entry before having seen the index that published it
+	MT32EMU_MEMORY_BARRIER();
+	return &entries[ix % CAPACITY];
+}
+
+void LogRing::pop() {
+	// Finish reading the entry before handing the slot back to the producer
+	MT32EMU_MEMORY_BARRIER();
+	readIx = readIx + 1;
+}
+
+Bit32u LogRing::takeDroppedCount() {
+	Bit32u total = droppedCount;
+	Bit32u dropped = total - reportedDroppedCount;
+	reportedDroppedCount = total;
+	return dropped;
+}
+
+}
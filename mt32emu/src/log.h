@@ -0,0 +1,107 @@
+/* Copyright (C) 2003, 2004, 2005, 2006, 2008, 2009 Dean Beeler, Jerome Fisher
+ * Copyright (C) 2011 Dean Beeler, Jerome Fisher, Sergey V. Mikayev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MT32EMU_LOG_H
+#define MT32EMU_LOG_H
+
+#include <cstdarg>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#pragma intrinsic(_ReadWriteBarrier)
+// x86 doesn't reorder stores with stores or loads with loads, so stopping the compiler from doing it is enough
+#define MT32EMU_MEMORY_BARRIER() _ReadWriteBarrier()
+#else
+#define MT32EMU_MEMORY_BARRIER() __sync_synchronize()
+#endif
+
+// Logs a message in printf() format if both MT32EMU_LOG_LEVEL and the synth's runtime settings allow it.
+// Arguments aren't evaluated and nothing is formatted otherwise, and messages above MT32EMU_LOG_LEVEL
+// aren't compiled in at all.
+#define MT32EMU_LOG(synth, level, category, ...) \
+	do { \
+		if ((level) <= MT32EMU_LOG_LEVEL && (synth)->isLogEnabled((level), (category))) { \
+			(synth)->log((level), (category), __VA_ARGS__); \
+		} \
+	} while (false)
+
+namespace MT32Emu {
+
+enum LogLevel {
+	// Only meaningful as a threshold - nothing is logged
+	LogLevel_NONE = 0,
+	// Something is broken (bad ROMs, internal inconsistencies)
+	LogLevel_ERROR = 1,
+	// Bad input which is being ignored or worked around
+	LogLevel_WARNING = 2,
+	// Occasional progress information (ROM loading, initialisation)
+	LogLevel_INFO = 3,
+	// Detailed tracing, including messages produced for individual notes and sysex writes
+	LogLevel_DEBUG = 4
+};
+
+enum LogCategory {
+	// ROM loading and synth initialisation
+	LogCategory_INIT = 1 << 0,
+	// Short MIDI messages and how parts react to them
+	LogCategory_MIDI = 1 << 1,
+	// Sysex parsing and writes to the emulated memory
+	LogCategory_SYSEX = 1 << 2,
+	// Partial allocation and playback
+	LogCategory_PARTIAL = 1 << 3
+};
+
+const Bit32u LOG_CATEGORIES_ALL = 0xFFFFFFFF;
+
+// Fixed-size queue of formatted log messages, for one producer thread and one consumer thread.
+// Neither side ever blocks or allocates; messages pushed while the queue is full are dropped and counted.
+class LogRing {
+public:
+	static const unsigned int CAPACITY = 256;
+	static const unsigned int MAX_MESSAGE_LENGTH = 255;
+
+	struct Entry {
+		LogLevel level;
+		LogCategory category;
+		char text[MAX_MESSAGE_LENGTH + 1];
+	};
+
+	LogRing();
+
+	// Producer side
+	void push(LogLevel level, LogCategory category, const char *fmt, va_list ap);
+
+	// Consumer side. Returns the oldest entry, or NULL if there is none. It remains valid until pop().
+	const Entry *peek() const;
+	void pop();
+	// Returns the number of messages dropped since the last call.
+	Bit32u takeDroppedCount();
+
+private:
+	Entry entries[CAPACITY];
+	// Free-running indices, each written by one side only
+	volatile Bit32u writeIx;
+	volatile Bit32u readIx;
+	// Written by the producer only
+	volatile Bit32u droppedCount;
+	// Consumer-only
+	Bit32u reportedDroppedCount;
+};
+
+}
+
+#endif
@@ -26,6 +26,30 @@
 
 #define MT32EMU_USE_EXTINT 0
 
+// Log messages less important than this are compiled out: 0 = none, 1 = errors, 2 = warnings, 3 = info, 4 = debug.
+// See also Synth::setLogLevel().
+#ifndef MT32EMU_LOG_LEVEL
+#define MT32EMU_LOG_LEVEL 4
+#endif
+
+// Set to 1 to have the synth time its own rendering and sysex handling. See Synth::getRenderStats().
+// Costs a few percent of rendering speed when enabled.
+#ifndef MT32EMU_PROFILE_RENDER
+#define MT32EMU_PROFILE_RENDER 0
+#endif
+
+// Set to 1 to compile in static tracepoints for SystemTap, perf and bpftrace. Needs <sys/sdt.h>; see probes.h.
+#ifndef MT32EMU_USE_SDT
+#define MT32EMU_USE_SDT 0
+#endif
+
+// Set to 1 to keep the PCM ROM samples in their logarithmic form (2 bytes each), converting them when they're played.
+// This halves the memory taken by the ROM, but the conversion differs very slightly from the default one.
+// Programs using the library don't need to match this setting.
+#ifndef MT32EMU_COMPACT_PCM_ROM
+#define MT32EMU_COMPACT_PCM_ROM 0
+#endif
+
 // Configuration
 // The maximum number of partials playing simultaneously
 #define MT32EMU_MAX_PARTIALS 32
@@ -34,14 +58,19 @@
 #define MT32EMU_MAX_POLY 32
 
 #include "structures.h"
+#include "log.h"
+#include "renderStats.h"
 #include "file.h"
 #include "tables.h"
 #include "poly.h"
+#include "polyphonyStats.h"
+#include "latencyTrace.h"
 #include "tva.h"
 #include "tvp.h"
 #include "tvf.h"
 #include "partial.h"
 #include "part.h"
 #include "synth.h"
+#include "synthBatch.h"
 
 #endif
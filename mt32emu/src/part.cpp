@@ -204,7 +204,7 @@ void Part::setPatch(const PatchParam *patch) {
 }
 
 void RhythmPart::setTimbre(TimbreParam * /*timbre*/) {
-	synth->printDebug("%s: Attempted to call setTimbre() - doesn't make sense for rhythm", name);
+	MT32EMU_LOG(synth, LogLevel_WARNING, LogCategory_MIDI, "%s: Attempted to call setTimbre() - doesn't make sense for rhythm", name);
 }
 
 void Part::setTimbre(TimbreParam *timbre) {
@@ -212,7 +212,7 @@ void Part::setTimbre(TimbreParam *timbre) {
 }
 
 unsigned int RhythmPart::getAbsTimbreNum() const {
-	synth->printDebug("%s: Attempted to call getAbsTimbreNum() - doesn't make sense for rhythm", name);
+	MT32EMU_LOG(synth, LogLevel_WARNING, LogCategory_MIDI, "%s: Attempted to call getAbsTimbreNum() - doesn't make sense for rhythm", name);
 	return 0;
 }
 
@@ -221,7 +221,7 @@ unsigned int Part::getAbsTimbreNum() const {
 }
 
 void RhythmPart::setProgram(unsigned int patchNum) {
-	synth->printDebug("%s: Attempt to set program (%d) on rhythm is invalid", name, patchNum);
+	MT32EMU_LOG(synth, LogLevel_DEBUG, LogCategory_MIDI, "%s: Attempt to set program (%d) on rhythm is invalid", name, patchNum);
 }
 
 void Part::setProgram(unsigned int patchNum) {
@@ -304,9 +304,9 @@ void Part::cacheTimbre(PatchCache cache[4], const TimbreParam *timbre) {
 	//synth->printDebug("Res 1: %d 2: %d 3: %d 4: %d", cache[0].waveform, cache[1].waveform, cache[2].waveform, cache[3].waveform);
 
 #if MT32EMU_MONITOR_INSTRUMENTS == 1
-	synth->printDebug("%s (%s): Recached timbre", name, currentInstr);
+	MT32EMU_LOG(synth, LogLevel_DEBUG, LogCategory_MIDI, "%s (%s): Recached timbre", name, currentInstr);
 	for (int i = 0; i < 4; i++) {
-		synth->printDebug(" %d: play=%s, pcm=%s (%d), wave=%d", i, cache[i].playPartial ? "YES" : "NO", cache[i].PCMPartial ? "YES" : "NO", timbre->partial[i].wg.pcmWave, timbre->partial[i].wg.waveform);
+		MT32EMU_LOG(synth, LogLevel_DEBUG, LogCategory_MIDI, " %d: play=%s, pcm=%s (%d), wave=%d", i, cache[i].playPartial ? "YES" : "NO", cache[i].PCMPartial ? "YES" : "NO", timbre->partial[i].wg.pcmWave, timbre->partial[i].wg.waveform);
 	}
 #endif
 }
@@ -336,7 +336,7 @@ void Part::setExpression(unsigned int midiExpression) {
 
 void RhythmPart::setPan(unsigned int midiPan) {
 	// CONFIRMED: This does change patchTemp, but has no actual effect on playback.
-	synth->printDebug("%s: Pointlessly setting pan (%d) on rhythm part", name, midiPan);
+	MT32EMU_LOG(synth, LogLevel_DEBUG, LogCategory_MIDI, "%s: Pointlessly setting pan (%d) on rhythm part", name, midiPan);
 	Part::setPan(midiPan);
 }
 
@@ -354,12 +354,12 @@ void Part::setPan(unsigned int midiPan) {
 unsigned int Part::midiKeyToKey(unsigned int midiKey, const char *debugAction) {
 	int key = midiKey + patchTemp->patch.keyShift;
 	if (key < 36) {
-		synth->printDebug("%s (%s): Attempted to perform \"%s\" on invalid key %d (%d after keyshift) < 36; moving up by octaves", name, currentInstr, debugAction, midiKey, key);
+		MT32EMU_LOG(synth, LogLevel_DEBUG, LogCategory_MIDI, "%s (%s): Attempted to perform \"%s\" on invalid key %d (%d after keyshift) < 36; moving up by octaves", name, currentInstr, debugAction, midiKey, key);
 		while (key < 36) {
 			key += 12;
 		}
 	} else if (key > 132) {
-		synth->printDebug("%s (%s): Attempted to perform \"%s\" on invalid key %d (%d after keyshift) > 132; moving down by octaves", name, currentInstr, debugAction, midiKey, key);
+		MT32EMU_LOG(synth, LogLevel_DEBUG, LogCategory_MIDI, "%s (%s): Attempted to perform \"%s\" on invalid key %d (%d after keyshift) > 132; moving down by octaves", name, currentInstr, debugAction, midiKey, key);
 		while (key > 132) {
 			key -= 12;
 		}
@@ -370,14 +370,14 @@ unsigned int Part::midiKeyToKey(unsigned int midiKey, const char *debugAction) {
 
 void RhythmPart::noteOn(unsigned int midiKey, unsigned int velocity) {
 	if (midiKey < 24 || midiKey > 108) { /*> 87 on MT-32)*/
-		synth->printDebug("%s: Attempted to play invalid key %d (velocity %d)", name, midiKey, velocity);
+		MT32EMU_LOG(synth, LogLevel_DEBUG, LogCategory_MIDI, "%s: Attempted to play invalid key %d (velocity %d)", name, midiKey, velocity);
 		return;
 	}
 	unsigned int key = midiKey;
 	unsigned int drumNum = key - 24;
 	int drumTimbreNum = rhythmTemp[drumNum].timbre;
 	if (drumTimbreNum >= 127) { // 94 on MT-32
-		synth->printDebug("%s: Attempted to play unmapped key %d (velocity %d)", name, midiKey, velocity);
+		MT32EMU_LOG(synth, LogLevel_DEBUG, LogCategory_MIDI, "%s: Attempted to play unmapped key %d (velocity %d)", name, midiKey, velocity);
 		return;
 	}
 	// CONFIRMED: Two special cases described by Mok
@@ -393,7 +393,7 @@ void RhythmPart::noteOn(unsigned int midiKey, unsigned int velocity) {
 	TimbreParam *timbre = &synth->mt32ram.timbres[absTimbreNum].timbre;
 	memcpy(currentInstr, timbre->common.name, 10);
 #if MT32EMU_MONITOR_INSTRUMENTS == 1
-	synth->printDebug("%s (%s): starting poly (drum %d, timbre %d) - key %d (velocity %d)", name, currentInstr, drumNum, absTimbreNum, midiKey, velocity);
+	MT32EMU_LOG(synth, LogLevel_DEBUG, LogCategory_MIDI, "%s (%s): starting poly (drum %d, timbre %d) - key %d (velocity %d)", name, currentInstr, drumNum, absTimbreNum, midiKey, velocity);
 #endif
 	if (drumCache[drumNum][0].dirty) {
 		cacheTimbre(drumCache[drumNum], timbre);
@@ -404,7 +404,7 @@ void RhythmPart::noteOn(unsigned int midiKey, unsigned int velocity) {
 void Part::noteOn(unsigned int midiKey, unsigned int velocity) {
 	unsigned int key = midiKeyToKey(midiKey, "Note On");
 #if MT32EMU_MONITOR_INSTRUMENTS == 1
-	synth->printDebug("%s (%s): starting poly - key %d (velocity %d)", name, currentInstr, midiKey, velocity);
+	MT32EMU_LOG(synth, LogLevel_DEBUG, LogCategory_MIDI, "%s (%s): starting poly - key %d (velocity %d)", name, currentInstr, midiKey, velocity);
 #endif
 	if (patchCache[0].dirty) {
 		cacheTimbre(patchCache, timbreTemp);
@@ -427,6 +427,7 @@ bool Part::abortFirstPoly(PolyState polyState) {
 	for (std::list<Poly *>::iterator polyIt = activePolys.begin(); polyIt != activePolys.end(); polyIt++) {
 		Poly *poly = *polyIt;
 		if (poly->getState() == polyState) {
+			synth->polyAborted(partNum, poly->getKey(), polyState);
 			poly->abort();
 			return true;
 		}
@@ -438,7 +439,9 @@ bool Part::abortFirstPoly() {
 	if (activePolys.empty()) {
 		return false;
 	}
-	activePolys.front()->abort();
+	Poly *poly = activePolys.front();
+	synth->polyAborted(partNum, poly->getKey(), poly->getState());
+	poly->abort();
 	return true;
 }
 
@@ -450,19 +453,22 @@ void Part::playPoly(const PatchCache cache[4], const MemParams::RhythmTemp *rhyt
 
 	unsigned int needPartials = cache[0].partialCount;
 	if (needPartials == 0) {
-		synth->printDebug("%s (%s): Completely muted instrument", name, currentInstr);
+		MT32EMU_LOG(synth, LogLevel_DEBUG, LogCategory_PARTIAL, "%s (%s): Completely muted instrument", name, currentInstr);
 		return;
 	}
 
 	if (!synth->partialManager->freePartials(needPartials, partNum)) {
-		synth->printDebug("%s (%s): Insufficient free partials to play key %d (velocity %d); needed=%d, free=%d", name, currentInstr, midiKey, velocity, needPartials, synth->partialManager->getFreePartialCount());
+		MT32EMU_LOG(synth, LogLevel_DEBUG, LogCategory_PARTIAL, "%s (%s): Insufficient free partials to play key %d (velocity %d); needed=%d, free=%d", name, currentInstr, midiKey, velocity, needPartials, synth->partialManager->getFreePartialCount());
+		synth->noteDropped(partNum, midiKey, velocity, needPartials, true);
 		return;
 	}
 
 	if (freePolys.empty()) {
-		synth->printDebug("%s (%s): No free poly to play key %d (velocity %d)", name, currentInstr, midiKey, velocity);
+		MT32EMU_LOG(synth, LogLevel_DEBUG, LogCategory_PARTIAL, "%s (%s): No free poly to play key %d (velocity %d)", name, currentInstr, midiKey, velocity);
+		synth->noteDropped(partNum, midiKey, velocity, needPartials, false);
 		return;
 	}
+	synth->polyphonyStats.parts[partNum].notesPlayed++;
 	Poly *poly = freePolys.front();
 	freePolys.pop_front();
 	if (patchTemp->patch.assignMode & 1) {
@@ -528,7 +534,7 @@ void Part::noteOff(unsigned int midiKey) {
 
 void Part::stopNote(unsigned int key) {
 #if MT32EMU_MONITOR_INSTRUMENTS == 1
-	synth->printDebug("%s (%s): stopping key %d", name, currentInstr, key);
+	MT32EMU_LOG(synth, LogLevel_DEBUG, LogCategory_MIDI, "%s (%s): stopping key %d", name, currentInstr, key);
 #endif
 
 	for (std::list<Poly *>::iterator polyIt = activePolys.begin(); polyIt != activePolys.end(); polyIt++) {
@@ -24,19 +24,16 @@
 
 using namespace MT32Emu;
 
+// Number of samples for which the envelopes are stepped before the corresponding waveform gets generated
+static const unsigned long ENVELOPE_CHUNK_LENGTH = 64;
+
 Partial::Partial(Synth *useSynth, int useDebugPartialNum) :
-	synth(useSynth), debugPartialNum(useDebugPartialNum), tva(new TVA(this)), tvp(new TVP(this)), tvf(new TVF(this)) {
+	synth(useSynth), debugPartialNum(useDebugPartialNum), tva(this), tvp(this), tvf(this) {
 	ownerPart = -1;
 	poly = NULL;
 	pair = NULL;
 }
 
-Partial::~Partial() {
-	delete tva;
-	delete tvp;
-	delete tvf;
-}
-
 int Partial::getOwnerPart() const {
 	return ownerPart;
 }
@@ -82,7 +79,7 @@ int Partial::getKey() const {
 
 void Partial::startPartial(const Part *part, Poly *usePoly, const PatchCache *usePatchCache, const MemParams::RhythmTemp *rhythmTemp, Partial *pairPartial) {
 	if (usePoly == NULL || usePatchCache == NULL) {
-		synth->printDebug("*** Error: Starting partial for owner %d, usePoly=%s, usePatchCache=%s", ownerPart, usePoly == NULL ? "*** NULL ***" : "OK", usePatchCache == NULL ? "*** NULL ***" : "OK");
+		MT32EMU_LOG(synth, LogLevel_ERROR, LogCategory_PARTIAL, "*** Error: Starting partial for owner %d, usePoly=%s, usePatchCache=%s", ownerPart, usePoly == NULL ? "*** NULL ***" : "OK", usePatchCache == NULL ? "*** NULL ***" : "OK");
 		return;
 	}
 	patchCache = usePatchCache;
@@ -125,9 +122,12 @@ void Partial::startPartial(const Part *part, Poly *usePoly, const PatchCache *us
 			}
 		}
 		pcmWave = &synth->pcmWaves[pcmNum];
+		generateFunction = pcmWave->loop ? &Partial::generatePCMSamples<true> : &Partial::generatePCMSamples<false>;
 	} else {
 		pcmWave = NULL;
 		wavePos = 0.0f;
+		// The waveform can't change while the partial plays: on timbre changes the partial keeps a copy of its old cache
+		generateFunction = (patchCache->waveform & 1) != 0 ? &Partial::generateSynthSamples<true> : &Partial::generateSynthSamples<false>;
 	}
 
 	// CONFIRMED: pulseWidthVal calculation is based on information from Mok
@@ -142,10 +142,9 @@ void Partial::startPartial(const Part *part, Poly *usePoly, const PatchCache *us
 	intPCMPosition = 0;
 	pair = pairPartial;
 	alreadyOutputed = false;
-	tva->reset(part, patchCache->partialParam, rhythmTemp);
-	tvp->reset(part, patchCache->partialParam);
-	tvf->reset(patchCache->partialParam, tvp->getBasePitch());
-	memset(history, 0, sizeof(history));
+	tva.reset(part, patchCache->partialParam, rhythmTemp);
+	tvp.reset(part, patchCache->partialParam);
+	tvf.reset(patchCache->partialParam, tvp.getBasePitch());
 }
 
 float Partial::getPCMSample(unsigned int position) {
@@ -155,7 +154,7 @@ float Partial::getPCMSample(unsigned int position) {
 		}
 		position = position % pcmWave->len;
 	}
-	return synth->pcmROMData[pcmWave->addr + position];
+	return synth->tables.decodePCMSample(synth->pcmROMData[pcmWave->addr + position]);
 }
 
 unsigned long Partial::generateSamples(float *partialBuf, unsigned long length) {
@@ -163,202 +162,298 @@ unsigned long Partial::generateSamples(float *partialBuf, unsigned long length)
 		return 0;
 	}
 	if (poly == NULL) {
-		synth->printDebug("*** ERROR: poly is NULL at Partial::generateSamples()!");
+		MT32EMU_LOG(synth, LogLevel_ERROR, LogCategory_PARTIAL, "*** ERROR: poly is NULL at Partial::generateSamples()!");
 		return 0;
 	}
 
 	alreadyOutputed = true;
 
-	// Generate samples
-
-	unsigned long sampleNum;
-	for (sampleNum = 0; sampleNum < length; sampleNum++) {
-		float sample = 0;
-		float amp = tva->nextAmp();
-		if (!tva->isPlaying()) {
+#if MT32EMU_PROFILE_RENDER
+	// The partial may be deactivated below, so take note of what it is first
+	int statsPart = ownerPart;
+	RenderStats::PartialType statsType = patchCache->PCMPartial ? RenderStats::PartialType_PCM : RenderStats::PartialType_SYNTH;
+	Bit64u envelopeTicks = 0;
+	Bit64u generateStart = readTimeStampCounter();
+#endif
+
+	// Envelopes are stepped a chunk at a time, then the waveform for that chunk is generated in one go
+	float amps[ENVELOPE_CHUNK_LENGTH];
+	Bit16u pitches[ENVELOPE_CHUNK_LENGTH];
+	float cutoffModifiers[ENVELOPE_CHUNK_LENGTH];
+	unsigned long sampleNum = 0;
+	while (sampleNum < length) {
+		unsigned long chunkLength = length - sampleNum;
+		if (chunkLength > ENVELOPE_CHUNK_LENGTH) {
+			chunkLength = ENVELOPE_CHUNK_LENGTH;
+		}
+#if MT32EMU_PROFILE_RENDER
+		Bit64u envelopeStart = readTimeStampCounter();
+#endif
+		unsigned long envelopeLength = stepEnvelopes(amps, pitches, cutoffModifiers, chunkLength);
+#if MT32EMU_PROFILE_RENDER
+		Bit64u ticks = readTimeStampCounter() - envelopeStart;
+		if (ticks > synth->timeStampOverhead) {
+			envelopeTicks += ticks - synth->timeStampOverhead;
+		}
+#endif
+		unsigned long generated = (this->*generateFunction)(partialBuf + sampleNum, amps, pitches, cutoffModifiers, envelopeLength);
+		sampleNum += generated;
+		if (generated < chunkLength) {
+			// Either the TVA has finished or a non-looping PCM waveform has run out
 			deactivate();
 			break;
 		}
+	}
+#if MT32EMU_PROFILE_RENDER
+	synth->addPartialStats(statsPart, statsType, readTimeStampCounter() - generateStart, envelopeTicks, sampleNum);
+#endif
+	// At this point, sampleNum represents the number of samples rendered
+	return sampleNum;
+}
 
-		Bit16u pitch = tvp->nextPitch();
+unsigned long Partial::stepEnvelopes(float *amps, Bit16u *pitches, float *cutoffModifiers, unsigned long length) {
+	bool pcmPartial = patchCache->PCMPartial;
+	for (unsigned long sampleNum = 0; sampleNum < length; sampleNum++) {
+		amps[sampleNum] = tva.nextAmp();
+		if (!tva.isPlaying()) {
+			return sampleNum;
+		}
+		pitches[sampleNum] = tvp.nextPitch();
+		if (!pcmPartial) {
+			// The modifier may not be supposed to be added to the cutoff at all -
+			// it may for example need to be multiplied in some way.
+			cutoffModifiers[sampleNum] = tvf.nextCutoffModifier();
+		}
+	}
+	return length;
+}
 
-		float freq = synth->tables.pitchToFreq[pitch];
+template <bool LOOP>
+unsigned long Partial::generatePCMSamples(float *partialBuf, const float *amps, const Bit16u *pitches, const float * /*cutoffModifiers*/, unsigned long length) {
+	const PCMSample *pcmROMData = synth->pcmROMData;
+	const Tables &tables = synth->tables;
+	const float *pitchToFreq = synth->tables.pitchToFreq;
+	unsigned int sampleRate = synth->myProp.sampleRate;
+	Bit32u pcmAddr = pcmWave->addr;
+	int len = pcmWave->len;
+	// Kept in locals so that they can stay in registers while the buffer is written
+	float position = pcmPosition;
+	int intPosition = intPCMPosition;
+	// Only recalculated when the pitch changes
+	Bit32u lastPitch = 0x10000;
+	float positionDelta = 0.0f;
 
-		if (patchCache->PCMPartial) {
-			// Render PCM waveform
-			int len = pcmWave->len;
-			if (intPCMPosition >= len && !pcmWave->loop) {
-				// We're now past the end of a non-looping PCM waveform so it's time to die.
-				play = false;
-				deactivate();
-				break;
-			}
-			Bit32u pcmAddr = pcmWave->addr;
-			float positionDelta = freq * 2048.0f / synth->myProp.sampleRate;
-			float newPCMPosition = pcmPosition + positionDelta;
-			int newIntPCMPosition = (int)newPCMPosition;
-
-			// Linear interpolation
-			float firstSample = synth->pcmROMData[pcmAddr + intPCMPosition];
-			float nextSample = getPCMSample(intPCMPosition + 1);
-			sample = firstSample + (nextSample - firstSample) * (pcmPosition - intPCMPosition);
-			if (pcmWave->loop) {
-				newPCMPosition = fmod(newPCMPosition, (float)pcmWave->len);
-				newIntPCMPosition = newIntPCMPosition % pcmWave->len;
-			}
-			pcmPosition = newPCMPosition;
-			intPCMPosition = newIntPCMPosition;
-		} else {
-			// Render synthesised waveform
-			float resAmp = EXP2F(-9.0f *(1.0f - patchCache->srcPartial.tvf.resonance / 30.0f));
+	unsigned long sampleNum;
+	for (sampleNum = 0; sampleNum < length; sampleNum++) {
+		if (!LOOP && intPosition >= len) {
+			// We're now past the end of a non-looping PCM waveform so it's time to die.
+			play = false;
+			break;
+		}
+		if (pitches[sampleNum] != lastPitch) {
+			lastPitch = pitches[sampleNum];
+			float freq = pitchToFreq[lastPitch];
+			positionDelta = freq * 2048.0f / sampleRate;
+		}
+		float newPCMPosition = position + positionDelta;
+		int newIntPCMPosition = (int)newPCMPosition;
+
+		// Linear interpolation
+		float firstSample = tables.decodePCMSample(pcmROMData[pcmAddr + intPosition]);
+		float nextSample = getPCMSample(intPosition + 1);
+		float sample = firstSample + (nextSample - firstSample) * (position - intPosition);
+		// Positions still within the waveform are left alone by the modulo, so it only needs doing on wraparound
+		if (LOOP && newIntPCMPosition >= len) {
+			newPCMPosition = fmod(newPCMPosition, (float)pcmWave->len);
+			newIntPCMPosition = newIntPCMPosition % pcmWave->len;
+		}
+		position = newPCMPosition;
+		intPosition = newIntPCMPosition;
 
-			float cutoffVal = tvf->getBaseCutoff();
-			// The modifier may not be supposed to be added to the cutoff at all -
-			// it may for example need to be multiplied in some way.
-			cutoffVal += tvf->nextCutoffModifier();
+		// Multiply sample with current TVA value
+		*partialBuf++ = sample * amps[sampleNum];
+	}
+	pcmPosition = position;
+	intPCMPosition = intPosition;
+	return sampleNum;
+}
 
-			// Wave lenght in samples
-			float waveLen = synth->myProp.sampleRate / freq;
+template <bool SAWTOOTH>
+unsigned long Partial::generateSynthSamples(float *partialBuf, const float *amps, const Bit16u *pitches, const float *cutoffModifiers, unsigned long length) {
+	// Everything that doesn't change over the life of the partial
+	const float *pitchToFreq = synth->tables.pitchToFreq;
+	unsigned int sampleRate = synth->myProp.sampleRate;
+	float baseResAmp = EXP2F(-9.0f *(1.0f - patchCache->srcPartial.tvf.resonance / 30.0f));
+	float baseCutoff = tvf.getBaseCutoff();
+	// Ratio of negative segment to waveLen
+	float pulseLenRatio = 0.5f;
+	if (pulseWidthVal > 128) {
+		// Formula determined from sample analysis.
+		float pt = 0.5f / 127.0f * (pulseWidthVal - 128);
+		pulseLenRatio += (1.239f - pt) * pt;
+	}
 
+	// Values derived from the pitch and cutoff, which only get recalculated when those change
+	Bit32u lastPitch = 0x10000;
+	float freq = 0.0f;
+	float waveLen = 0.0f;
+	bool haveCutoff = false;
+	float lastCutoffVal = 0.0f;
+	float cutoffFactor = 0.0f;
+
+	float pos = wavePos;
+	for (unsigned long sampleNum = 0; sampleNum < length; sampleNum++) {
+		float sample;
+		if (pitches[sampleNum] != lastPitch) {
+			lastPitch = pitches[sampleNum];
+			freq = pitchToFreq[lastPitch];
+			// Wave lenght in samples
+			waveLen = sampleRate / freq;
 			// Anti-aliasing feature
 			if (waveLen < 4.0f) {
 				waveLen = 4.0f;
 			}
+		}
 
-			// Init cosineLen
-			float cosineLen = 0.5f * waveLen;
+		float resAmp = baseResAmp;
+
+		float cutoffVal = baseCutoff;
+		cutoffVal += cutoffModifiers[sampleNum];
+		if (!haveCutoff || cutoffVal != lastCutoffVal) {
+			haveCutoff = true;
+			lastCutoffVal = cutoffVal;
 			if (cutoffVal > 128) {
 				float ft = (cutoffVal - 128) / 128.0f;
-				cosineLen *= EXP2F(-8.0f * ft); // found from sample analysis
-			}
-
-			// Anti-aliasing feature
-			if (cosineLen < 2.0f) {
-				cosineLen = 2.0f;
-				resAmp = 0.0f;
+				cutoffFactor = EXP2F(-8.0f * ft); // found from sample analysis
+			} else if (cutoffVal < 128) {
+				// Attenuate samples below cutoff 50 another way
+				// Found by sample analysis
+				cutoffFactor = EXP2F(-0.125f * (128 - cutoffVal));
 			}
+		}
 
-			// Start playing in center of first cosine segment
-			// relWavePos is shifted by a half of cosineLen
-			float relWavePos = wavePos + 0.5f * cosineLen;
-			if (relWavePos > waveLen) {
-				relWavePos -= waveLen;
-			}
+		// Init cosineLen
+		float cosineLen = 0.5f * waveLen;
+		if (cutoffVal > 128) {
+			cosineLen *= cutoffFactor;
+		}
 
-			// Ratio of negative segment to waveLen
-			float pulseLen = 0.5f;
-			if (pulseWidthVal > 128) {
-				// Formula determined from sample analysis.
-				float pt = 0.5f / 127.0f * (pulseWidthVal - 128);
-				pulseLen += (1.239f - pt) * pt;
-			}
-			pulseLen *= waveLen;
+		// Anti-aliasing feature
+		if (cosineLen < 2.0f) {
+			cosineLen = 2.0f;
+			resAmp = 0.0f;
+		}
 
-			float lLen = pulseLen - cosineLen;
+		// Start playing in center of first cosine segment
+		// relWavePos is shifted by a half of cosineLen
+		float relWavePos = pos + 0.5f * cosineLen;
+		if (relWavePos > waveLen) {
+			relWavePos -= waveLen;
+		}
 
-			// Ignore pulsewidths too high for given freq
-			if (lLen < 0.0f) {
-				lLen = 0.0f;
-			}
+		float pulseLen = pulseLenRatio * waveLen;
+		float lLen = pulseLen - cosineLen;
 
-			// Ignore pulsewidths too high for given freq and cutoff
-			float hLen = waveLen - lLen - 2 * cosineLen;
-			if (hLen < 0.0f) {
-				hLen = 0.0f;
-			}
+		// Ignore pulsewidths too high for given freq
+		if (lLen < 0.0f) {
+			lLen = 0.0f;
+		}
 
-			// Correct resAmp for cutoff in range 50..60
-			if (cutoffVal < 138) {
-				resAmp *= (1.0f - (138 - cutoffVal) / 10.0f);
-			}
+		// Ignore pulsewidths too high for given freq and cutoff
+		float hLen = waveLen - lLen - 2 * cosineLen;
+		if (hLen < 0.0f) {
+			hLen = 0.0f;
+		}
 
-			// Produce filtered square wave with 2 cosine waves on slopes
+		// Correct resAmp for cutoff in range 50..60
+		if (cutoffVal < 138) {
+			resAmp *= (1.0f - (138 - cutoffVal) / 10.0f);
+		}
 
-			// 1st cosine segment
-			if (relWavePos < cosineLen) {
-				sample = -cosf(FLOAT_PI * relWavePos / cosineLen);
-			} else
+		// Produce filtered square wave with 2 cosine waves on slopes
 
-			// high linear segment
-			if (relWavePos < (cosineLen + hLen)) {
-				sample = 1.f;
-			} else
+		// 1st cosine segment
+		if (relWavePos < cosineLen) {
+			sample = -cosf(FLOAT_PI * relWavePos / cosineLen);
+		} else
 
-			// 2nd cosine segment
-			if (relWavePos < (2 * cosineLen + hLen)) {
-				sample = cosf(FLOAT_PI * (relWavePos - (cosineLen + hLen)) / cosineLen);
-			} else {
+		// high linear segment
+		if (relWavePos < (cosineLen + hLen)) {
+			sample = 1.f;
+		} else
 
-			// low linear segment
-				sample = -1.f;
-			}
+		// 2nd cosine segment
+		if (relWavePos < (2 * cosineLen + hLen)) {
+			sample = cosf(FLOAT_PI * (relWavePos - (cosineLen + hLen)) / cosineLen);
+		} else {
 
-			if (cutoffVal < 128) {
+		// low linear segment
+			sample = -1.f;
+		}
 
-				// Attenuate samples below cutoff 50 another way
-				// Found by sample analysis
-				sample *= EXP2F(-0.125f * (128 - cutoffVal));
-			} else {
+		if (cutoffVal < 128) {
 
-				// Add resonance sine. Effective for cutoff > 50 only
-				float resSample = 1.0f;
-				float resAmpFade = 0.0f;
+			// Attenuate samples below cutoff 50 another way
+			sample *= cutoffFactor;
+		} else {
 
-				// Now relWavePos counts from the middle of first cosine
-				relWavePos = wavePos;
+			// Add resonance sine. Effective for cutoff > 50 only
+			float resSample = 1.0f;
+			float resAmpFade = 0.0f;
 
-				// negative segments
-				if (!(relWavePos < (cosineLen + hLen))) {
-					resSample = -resSample;
-					relWavePos -= cosineLen + hLen;
-				}
+			// Now relWavePos counts from the middle of first cosine
+			relWavePos = pos;
 
-				// Resonance sine WG
-				resSample *= sinf(FLOAT_PI * relWavePos / cosineLen);
+			// negative segments
+			if (!(relWavePos < (cosineLen + hLen))) {
+				resSample = -resSample;
+				relWavePos -= cosineLen + hLen;
+			}
 
-				// Resonance sine amp
-				resAmpFade = RESAMPMAX - RESAMPFADE * (relWavePos / cosineLen);
+			// Resonance sine WG
+			resSample *= sinf(FLOAT_PI * relWavePos / cosineLen);
 
-				// Now relWavePos set negative to the left from center of any cosine
-				relWavePos = wavePos;
+			// Resonance sine amp
+			resAmpFade = RESAMPMAX - RESAMPFADE * (relWavePos / cosineLen);
 
-				// negative segment
-				if (!(wavePos < (waveLen - 0.5f * cosineLen))) {
-					relWavePos -= waveLen;
-				} else
+			// Now relWavePos set negative to the left from center of any cosine
+			relWavePos = pos;
 
-				// positive segment
-				if (!(wavePos < (hLen + 0.5f * cosineLen))) {
-					relWavePos -= cosineLen + hLen;
-				}
-
-				// Fading to zero while in first half of cosine segment to avoid jumps in the wave
-				// FIXME: sample analysis suggests that this window isn't linear
-				if (relWavePos < 0.0f) {
-//					resAmpFade *= -relWavePos / (0.5f * cosineLen);                                  // linear
-					resAmpFade *= 0.5f * (1.0f - cosf(FLOAT_PI * relWavePos / (0.5f * cosineLen)));  // full cosine
-//					resAmpFade *= (1.0f - cosf(0.5f * FLOAT_PI * relWavePos / (0.5f * cosineLen)));  // half cosine
-				}
+			// negative segment
+			if (!(pos < (waveLen - 0.5f * cosineLen))) {
+				relWavePos -= waveLen;
+			} else
 
-				sample += resSample * resAmp * resAmpFade;
+			// positive segment
+			if (!(pos < (hLen + 0.5f * cosineLen))) {
+				relWavePos -= cosineLen + hLen;
 			}
 
-			// sawtooth waves
-			if ((patchCache->waveform & 1) != 0) {
-				sample *= cosf(FLOAT_2PI * wavePos / waveLen);
+			// Fading to zero while in first half of cosine segment to avoid jumps in the wave
+			// FIXME: sample analysis suggests that this window isn't linear
+			if (relWavePos < 0.0f) {
+//				resAmpFade *= -relWavePos / (0.5f * cosineLen);                                  // linear
+				resAmpFade *= 0.5f * (1.0f - cosf(FLOAT_PI * relWavePos / (0.5f * cosineLen)));  // full cosine
+//				resAmpFade *= (1.0f - cosf(0.5f * FLOAT_PI * relWavePos / (0.5f * cosineLen)));  // half cosine
 			}
 
-			wavePos++;
-			if (wavePos > waveLen)
-				wavePos -= waveLen;
+			sample += resSample * resAmp * resAmpFade;
 		}
 
+		// sawtooth waves
+		if (SAWTOOTH) {
+			sample *= cosf(FLOAT_2PI * pos / waveLen);
+		}
+
+		pos++;
+		if (pos > waveLen)
+			pos -= waveLen;
+
 		// Multiply sample with current TVA value
-		sample *= amp;
-		*partialBuf++ = sample;
+		*partialBuf++ = sample * amps[sampleNum];
 	}
-	// At this point, sampleNum represents the number of samples rendered
-	return sampleNum;
+	wavePos = pos;
+	return length;
 }
 
 float *Partial::mixBuffersRingMix(float *buf1, float *buf2, unsigned long len) {
@@ -418,25 +513,21 @@ Synth *Partial::getSynth() const {
 	return synth;
 }
 
-bool Partial::produceOutput(float *leftBuf, float *rightBuf, unsigned long length) {
+bool Partial::produceOutput(float *leftBuf, float *rightBuf, unsigned long length, float *partialBuf, float *pairBuf) {
 	if (!isActive() || alreadyOutputed || isRingModulatingSlave()) {
 		return false;
 	}
 	if (poly == NULL) {
-		synth->printDebug("*** ERROR: poly is NULL at Partial::produceOutput()!");
+		MT32EMU_LOG(synth, LogLevel_ERROR, LogCategory_PARTIAL, "*** ERROR: poly is NULL at Partial::produceOutput()!");
 		return false;
 	}
 
-	float *partialBuf = &myBuffer[0];
 	unsigned long numGenerated = generateSamples(partialBuf, length);
 	if (mixType == 1 || mixType == 2) {
-		float *pairBuf;
 		unsigned long pairNumGenerated;
 		if (pair == NULL) {
-			pairBuf = NULL;
 			pairNumGenerated = 0;
 		} else {
-			pairBuf = &pair->myBuffer[0];
 			pairNumGenerated = pair->generateSamples(pairBuf, numGenerated);
 			// pair will have been set to NULL if it deactivated within generateSamples()
 			if (pair != NULL) {
@@ -486,7 +577,7 @@ bool Partial::shouldReverb() {
 }
 
 void Partial::startDecayAll() {
-	tva->startDecay();
-	tvp->startDecay();
-	tvf->startDecay();
+	tva.startDecay();
+	tvp.startDecay();
+	tvf.startDecay();
 }
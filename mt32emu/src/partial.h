@@ -22,7 +22,6 @@ namespace MT32Emu {
 
 class Synth;
 class Part;
-class TVA;
 struct ControlROMPCMStruct;
 
 struct StereoVolume {
@@ -31,23 +30,18 @@ struct StereoVolume {
 };
 
 // A partial represents one of up to four waveform generators currently playing within a poly.
+// Everything a partial needs while rendering is kept inline (the envelope generators included), and all partials are
+// constructed next to each other in the PartialManager's pool, so the whole lot fits in a few KB of contiguous memory.
 class Partial {
 private:
 	Synth *synth;
-	const int debugPartialNum; // Only used for debugging
-
-	int ownerPart; // -1 if unassigned
-	int mixType;
-	int structurePosition; // 0 or 1 of a structure pair
-	StereoVolume stereoVolume;
 
 	// Distance in (possibly fractional) samples from the start of the current pulse
 	float wavePos;
 
-	float myBuffer[MAX_SAMPLE_OUTPUT];
-
 	// Only used for PCM partials
-	int pcmNum;
+	float pcmPosition;
+	int intPCMPosition;
 	// FIXME: Give this a better name (e.g. pcmWaveInfo)
 	PCMWaveEntry *pcmWave;
 
@@ -55,32 +49,46 @@ private:
 	// Range: 0-255
 	int pulseWidthVal;
 
-	float pcmPosition;
-	int intPCMPosition;
-
-	float history[32];
+	int ownerPart; // -1 if unassigned
+	int mixType;
+	int structurePosition; // 0 or 1 of a structure pair
+	StereoVolume stereoVolume;
 
 	Poly *poly;
 
+	int pcmNum;
+	const int debugPartialNum; // Only used for debugging
+
 	float *mixBuffersRingMix(float *buf1, float *buf2, unsigned long len);
 	float *mixBuffersRing(float *buf1, float *buf2, unsigned long len);
 
 	float getPCMSample(unsigned int position);
 
+	// Steps the TVA, TVP and TVF (the latter only for synth partials), stopping early if the TVA finishes.
+	// Returns the number of samples stepped.
+	unsigned long stepEnvelopes(float *amps, Bit16u *pitches, float *cutoffModifiers, unsigned long length);
+	// These generate samples for envelope values produced by stepEnvelopes() and return the number of samples written.
+	// There is a version for each kind of waveform, so that the choice doesn't have to be made again for every sample.
+	template <bool LOOP> unsigned long generatePCMSamples(float *partialBuf, const float *amps, const Bit16u *pitches, const float *cutoffModifiers, unsigned long length);
+	template <bool SAWTOOTH> unsigned long generateSynthSamples(float *partialBuf, const float *amps, const Bit16u *pitches, const float *cutoffModifiers, unsigned long length);
+	typedef unsigned long (Partial::*GenerateFunction)(float *partialBuf, const float *amps, const Bit16u *pitches, const float *cutoffModifiers, unsigned long length);
+	// The one of the above that suits this partial, picked by startPartial()
+	GenerateFunction generateFunction;
+
 public:
 	const PatchCache *patchCache;
-	TVA *tva;
-	TVP *tvp;
-	TVF *tvf;
+	TVA tva;
+	TVP tvp;
+	TVF tvf;
 	bool play;
-
-	PatchCache cachebackup;
+	bool alreadyOutputed;
 
 	Partial *pair;
-	bool alreadyOutputed;
+
+	// Copy of the patch cache, taken when the timbre changes under a playing poly (see Poly::backupCacheToPartials())
+	PatchCache cachebackup;
 
 	Partial(Synth *synth, int debugPartialNum);
-	~Partial();
 
 	int getOwnerPart() const;
 	int getKey() const;
@@ -100,7 +108,8 @@ public:
 	// Returns true only if data written to buffer
 	// This function (unlike the one below it) returns processed stereo samples
 	// made from combining this single partial with its pair, if it has one.
-	bool produceOutput(float *leftBuf, float *rightBuf, unsigned long length);
+	// partialBuf and pairBuf are scratch space of at least length samples each.
+	bool produceOutput(float *leftBuf, float *rightBuf, unsigned long length, float *partialBuf, float *pairBuf);
 
 	// This function writes mono sample output to the provided buffer, and returns the number of samples written
 	unsigned long generateSamples(float *partialBuf, unsigned long length);
@@ -16,24 +16,28 @@
  */
 
 #include <cstring>
+#include <new>
 
 #include "mt32emu.h"
 #include "partialManager.h"
+#include "probes.h"
 
 using namespace MT32Emu;
 
 PartialManager::PartialManager(Synth *useSynth, Part **useParts) {
 	synth = useSynth;
 	parts = useParts;
+	partialPool = ::operator new(MT32EMU_MAX_PARTIALS * sizeof(Partial));
 	for (int i = 0; i < MT32EMU_MAX_PARTIALS; i++) {
-		partialTable[i] = new Partial(synth, i);
+		partialTable[i] = new((Partial *)partialPool + i) Partial(synth, i);
 	}
 }
 
 PartialManager::~PartialManager(void) {
 	for (int i = 0; i < MT32EMU_MAX_PARTIALS; i++) {
-		delete partialTable[i];
+		partialTable[i]->~Partial();
 	}
+	::operator delete(partialPool);
 }
 
 void PartialManager::clearAlreadyOutputed() {
@@ -47,7 +51,7 @@ bool PartialManager::shouldReverb(int i) {
 }
 
 bool PartialManager::produceOutput(int i, float *leftBuf, float *rightBuf, Bit32u bufferLength) {
-	return partialTable[i]->produceOutput(leftBuf, rightBuf, bufferLength);
+	return partialTable[i]->produceOutput(leftBuf, rightBuf, bufferLength, partialBuf, pairBuf);
 }
 
 void PartialManager::deactivateAll() {
@@ -66,19 +70,20 @@ unsigned int PartialManager::setReserve(Bit8u *rset) {
 }
 
 Partial *PartialManager::allocPartial(int partNum) {
-	Partial *outPartial = NULL;
-
 	// Get the first inactive partial
 	for (int partialNum = 0; partialNum < MT32EMU_MAX_PARTIALS; partialNum++) {
-		if (!partialTable[partialNum]->isActive()) {
-			outPartial = partialTable[partialNum];
-			break;
+		Partial *outPartial = partialTable[partialNum];
+		if (!outPartial->isActive()) {
+			outPartial->activate(partNum);
+			MT32EMU_PROBE2(partial_alloc, partialNum, partNum);
+			LatencyTrace *latencyTrace = synth->getLatencyTrace();
+			if (latencyTrace != NULL) {
+				latencyTrace->partialStarted(partialNum);
+			}
+			return outPartial;
 		}
 	}
-	if (outPartial != NULL) {
-		outPartial->activate(partNum);
-	}
-	return outPartial;
+	return NULL;
 }
 
 unsigned int PartialManager::getFreePartialCount(void) {
@@ -190,6 +195,19 @@ bool PartialManager::freePartials(unsigned int needed, int partNum) {
 	return false;
 }
 
+unsigned int PartialManager::getPerPartPartialUsage(unsigned int perPartPartialUsage[9]) const {
+	memset(perPartPartialUsage, 0, 9 * sizeof(unsigned int));
+	unsigned int total = 0;
+	for (unsigned int i = 0; i < MT32EMU_MAX_PARTIALS; i++) {
+		int ownerPart = partialTable[i]->getOwnerPart();
+		if (ownerPart >= 0 && ownerPart < 9) {
+			perPartPartialUsage[ownerPart]++;
+			total++;
+		}
+	}
+	return total;
+}
+
 const Partial *PartialManager::getPartial(unsigned int partialNum) const {
 	if (partialNum > MT32EMU_MAX_PARTIALS - 1) {
 		return NULL;
@@ -24,10 +24,15 @@ class Synth;
 
 class PartialManager {
 private:
-	Synth *synth; // Only used for sending debug output
+	Synth *synth; // Only used for sending debug output and tracing
 	Part **parts;
 
+	// All partials are constructed in one block of memory, partialTable just points into it
+	void *partialPool;
 	Partial *partialTable[MT32EMU_MAX_PARTIALS];
+	// Scratch space for Partial::produceOutput(), shared since partials are rendered one (pair) at a time
+	float partialBuf[MAX_SAMPLE_OUTPUT];
+	float pairBuf[MAX_SAMPLE_OUTPUT];
 	Bit8u numReservedPartialsForPart[9];
 
 	bool abortWhereReserveExceeded(PolyState polyState, int minPart);
@@ -45,6 +50,8 @@ public:
 	bool shouldReverb(int i);
 	void clearAlreadyOutputed();
 	const Partial *getPartial(unsigned int partialNum) const;
+	// Fills in the number of active partials owned by each part (8 being the rhythm part) and returns the total
+	unsigned int getPerPartPartialUsage(unsigned int perPartPartialUsage[9]) const;
 };
 
 }
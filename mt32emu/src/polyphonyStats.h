@@ -0,0 +1,69 @@
+/* Copyright (C) 2003, 2004, 2005, 2006, 2008, 2009 Dean Beeler, Jerome Fisher
+ * Copyright (C) 2011 Dean Beeler, Jerome Fisher, Sergey V. Mikayev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MT32EMU_POLYPHONY_STATS_H
+#define MT32EMU_POLYPHONY_STATS_H
+
+namespace MT32Emu {
+
+// How busy the partials have been and what happened when they ran out, as filled in by Synth::getPolyphonyStats().
+// Useful for choosing partial reserve settings. Part numbers are 0-7 for parts 1-8 and 8 for the rhythm part.
+struct PolyphonyStats {
+	struct PartCounters {
+		// Active partials owned by the part, summed over the frames rendered
+		Bit64u partialFrames;
+		// Most partials the part has had active at once
+		Bit32u peakPartials;
+		Bit32u notesPlayed;
+		// Polys of the part cut short to free partials for new notes (of this part or another), indexed by the
+		// PolyState they were in at the time
+		Bit32u abortedPolys[POLY_Inactive];
+		// Notes not played because not enough partials could be freed
+		Bit32u notesDroppedNoPartials;
+		// Notes not played because the part had no free polys
+		Bit32u notesDroppedNoPoly;
+	};
+
+	// occupancy[n] is the number of frames rendered with n partials active
+	Bit64u occupancy[MT32EMU_MAX_PARTIALS + 1];
+	Bit64u renderedFrames;
+	Bit32u peakPartials;
+	PartCounters parts[9];
+};
+
+// reportData for ReportType_polyAborted
+struct PolyAbortedInfo {
+	unsigned int partNum;
+	// Key in the part's own range, after transposition
+	unsigned int key;
+	PolyState state;
+};
+
+// reportData for ReportType_noteDropped
+struct NoteDroppedInfo {
+	unsigned int partNum;
+	unsigned int midiKey;
+	unsigned int velocity;
+	unsigned int partialsNeeded;
+	unsigned int partialsFree;
+	// False if there were enough partials, but the part had no free polys
+	bool noPartials;
+};
+
+}
+
+#endif
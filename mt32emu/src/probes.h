@@ -0,0 +1,48 @@
+/* Copyright (C) 2003, 2004, 2005, 2006, 2008, 2009 Dean Beeler, Jerome Fisher
+ * Copyright (C) 2011 Dean Beeler, Jerome Fisher, Sergey V. Mikayev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MT32EMU_PROBES_H
+#define MT32EMU_PROBES_H
+
+// Static tracepoints for SystemTap, perf and bpftrace (provider "mt32emu"), compiled in when the library is built with
+// MT32EMU_USE_SDT set (the CMake option of the same name). An unattached probe is a single no-op instruction, and
+// its arguments are only ever values the code has at hand anyway. For example:
+//   bpftrace -e 'usdt:./mt32emu-smf2wav:mt32emu:partial_alloc { @[arg1] = count(); }'
+//
+// Probes and their arguments:
+//   render_start(frames)                  Entry to Synth::render() or renderStreams()
+//   render_done(frames)                   Exit from the same
+//   block_partials(frames, partials)      Active partials at the start of each block of up to MAX_SAMPLE_OUTPUT frames
+//   midi_message(message, part)           Synth::playMsg(); part is -1 for channels not assigned to any part
+//   sysex(device, command, length)        Synth::playSysexWithoutHeader(), before the checksum is verified
+//   partial_alloc(partial, part)          A partial was started for a part (0-7, or 8 for rhythm)
+//   poly_abort(part, key, state)          A poly was aborted to free partials; state is a PolyState
+//   note_drop(part, key, partialsNeeded)  A note wasn't played
+//   reverb_params(mode, time, level)      New reverb parameters were applied
+
+#if MT32EMU_USE_SDT
+#include <sys/sdt.h>
+#define MT32EMU_PROBE1(name, a) DTRACE_PROBE1(mt32emu, name, a)
+#define MT32EMU_PROBE2(name, a, b) DTRACE_PROBE2(mt32emu, name, a, b)
+#define MT32EMU_PROBE3(name, a, b, c) DTRACE_PROBE3(mt32emu, name, a, b, c)
+#else
+#define MT32EMU_PROBE1(name, a)
+#define MT32EMU_PROBE2(name, a, b)
+#define MT32EMU_PROBE3(name, a, b, c)
+#endif
+
+#endif
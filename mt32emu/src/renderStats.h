@@ -0,0 +1,94 @@
+/* Copyright (C) 2003, 2004, 2005, 2006, 2008, 2009 Dean Beeler, Jerome Fisher
+ * Copyright (C) 2011 Dean Beeler, Jerome Fisher, Sergey V. Mikayev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MT32EMU_RENDER_STATS_H
+#define MT32EMU_RENDER_STATS_H
+
+#if MT32EMU_PROFILE_RENDER
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#elif !defined(__GNUC__) || !(defined(__i386__) || defined(__x86_64__))
+#include <ctime>
+#endif
+#endif
+
+namespace MT32Emu {
+
+// Where the synth spent its time, as filled in by Synth::getRenderStats().
+// All times are in ticks of the CPU's time-stamp counter (or of clock() on CPUs without one), so only their ratios
+// and comparisons between runs on the same machine are meaningful. Everything is zero unless the library was built
+// with MT32EMU_PROFILE_RENDER set to 1.
+struct RenderStats {
+	enum PartialType {
+		PartialType_SYNTH = 0,
+		PartialType_PCM = 1
+	};
+
+	struct PartialCounters {
+		// Time spent generating samples, including envelopes
+		Bit64u ticks;
+		// Part of the above spent stepping the TVA, TVP and TVF
+		Bit64u envelopeTicks;
+		// Samples generated, summed over all partials
+		Bit64u samples;
+	};
+
+	// Indexed by part number: 0-7 for parts 1-8, 8 for the rhythm part
+	PartialCounters parts[9];
+	// Indexed by PartialType
+	PartialCounters partialTypes[2];
+
+	// Everything done by render() and renderStreams(), including the items below except for sysexTicks
+	Bit64u renderTicks;
+	// Panning partials and mixing them into the output buffers
+	Bit64u mixTicks;
+	// Reverb and delay processing
+	Bit64u reverbTicks;
+	Bit64u renderedFrames;
+
+	// Sysex writes and applying them to the synth's state
+	Bit64u sysexTicks;
+	Bit32u sysexMessages;
+};
+
+#if MT32EMU_PROFILE_RENDER
+
+static inline Bit64u readTimeStampCounter() {
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+	return __rdtsc();
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+	Bit32u lo, hi;
+	__asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((Bit64u)hi << 32) | lo;
+#else
+	return (Bit64u)clock();
+#endif
+}
+
+#define MT32EMU_PROFILE_START(start) Bit64u start = readTimeStampCounter()
+#define MT32EMU_PROFILE_ADD(counter, start) ((counter) += readTimeStampCounter() - (start))
+
+#else
+
+#define MT32EMU_PROFILE_START(start)
+#define MT32EMU_PROFILE_ADD(counter, start)
+
+#endif
+
+}
+
+#endif
@@ -33,6 +33,7 @@ const unsigned int MAX_SAMPLE_OUTPUT = 4096;
 #define MT32EMU_ALIGN_PACKED __attribute__((packed))
 #endif
 
+typedef unsigned long long Bit64u;
 typedef unsigned int       Bit32u;
 typedef   signed int       Bit32s;
 typedef unsigned short int Bit16u;
@@ -172,6 +173,13 @@ struct MemParams {
 
 struct ControlROMPCMStruct;
 
+#if MT32EMU_COMPACT_PCM_ROM
+// Sign in the top bit, then the magnitude as the negated base 2 logarithm in 4.11 fixed point. See Tables::decodePCMSample().
+typedef Bit16u PCMSample;
+#else
+typedef float PCMSample;
+#endif
+
 struct PCMWaveEntry {
 	Bit32u addr;
 	Bit32u len;
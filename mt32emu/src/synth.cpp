@@ -24,6 +24,7 @@
 #include "mmath.h"
 #include "ansiFile.h"
 #include "partialManager.h"
+#include "probes.h"
 
 #include "delayReverb.h"
 #include "freeverb/revmodel.h"
@@ -61,8 +62,29 @@ Bit8u Synth::calcSysexChecksum(const Bit8u *data, Bit32u len, Bit8u checksum) {
 	return checksum;
 }
 
+ROMImage::ROMImage() {
+	loaded = false;
+	controlROMMap = NULL;
+	pcmROMData = NULL;
+	pcmROMSize = 0;
+}
+
+ROMImage::~ROMImage() {
+	delete[] pcmROMData;
+}
+
+bool ROMImage::isLoaded() const {
+	return loaded;
+}
+
 Synth::Synth() {
 	isOpen = false;
+	romImage = NULL;
+	privateROMImage = NULL;
+	controlROMMap = NULL;
+	controlROMData = NULL;
+	pcmROMData = NULL;
+	pcmROMSize = 0;
 	reverbModel = NULL;
 	delayReverbModel = NULL;
 	reverbEnabled = true;
@@ -71,12 +93,32 @@ Synth::Synth() {
 	setDelayReverbModel(NULL); // Creates a default DelayReverb.
 	partialManager = NULL;
 	memset(parts, 0, sizeof(parts));
+	clearPendingRefreshes();
+	resetPolyphonyStats();
+	resetRenderStats();
+	timeStampOverhead = 0;
+#if MT32EMU_PROFILE_RENDER
+	for (int i = 0; i < 16; i++) {
+		Bit64u start = readTimeStampCounter();
+		Bit64u ticks = readTimeStampCounter() - start;
+		if (i == 0 || ticks < timeStampOverhead) {
+			timeStampOverhead = ticks;
+		}
+	}
+#endif
+	memset(&myProp, 0, sizeof(myProp));
+	logLevel = LogLevel_INFO;
+	logCategories = LOG_CATEGORIES_ALL;
+	logRing = NULL;
+	latencyTrace = NULL;
 }
 
 Synth::~Synth() {
 	close(); // Make sure we're closed and everything is freed
+	delete privateROMImage;
 	delete reverbModel;
 	delete delayReverbModel;
+	setLogDeferred(false);
 }
 
 int Synth::report(ReportType type, const void *data) {
@@ -90,7 +132,7 @@ unsigned int Synth::getSampleRate() const {
 	return myProp.sampleRate;
 }
 
-void Synth::printDebug(const char *fmt, ...) {
+void Synth::printDebug(const char *fmt, ...) const {
 	va_list ap;
 	va_start(ap, fmt);
 	if (myProp.printDebug != NULL) {
@@ -102,6 +144,60 @@ void Synth::printDebug(const char *fmt, ...) {
 	va_end(ap);
 }
 
+void Synth::log(LogLevel level, LogCategory category, const char *fmt, ...) const {
+	va_list ap;
+	va_start(ap, fmt);
+	if (logRing != NULL) {
+		logRing->push(level, category, fmt, ap);
+	} else if (myProp.printDebug != NULL) {
+		myProp.printDebug(myProp.userData, fmt, ap);
+	} else {
+		vprintf(fmt, ap);
+		printf("\n");
+	}
+	va_end(ap);
+}
+
+void Synth::setLogLevel(LogLevel level) {
+	logLevel = level;
+}
+
+LogLevel Synth::getLogLevel() const {
+	return logLevel;
+}
+
+void Synth::setLogCategories(Bit32u categories) {
+	logCategories = categories;
+}
+
+void Synth::setLogDeferred(bool deferred) {
+	if (deferred) {
+		if (logRing == NULL) {
+			logRing = new LogRing;
+		}
+	} else if (logRing != NULL) {
+		drainLog();
+		delete logRing;
+		logRing = NULL;
+	}
+}
+
+void Synth::drainLog() {
+	if (logRing == NULL) {
+		return;
+	}
+	// Taken first, so that the drops are reported after the messages that made it into the queue before them
+	Bit32u droppedCount = logRing->takeDroppedCount();
+	const LogRing::Entry *entry;
+	while ((entry = logRing->peek()) != NULL) {
+		printDebug("%s", entry->text);
+		logRing->pop();
+	}
+	if (droppedCount > 0) {
+		printDebug("%u log messages dropped because the log queue was full", droppedCount);
+	}
+}
+
 void Synth::setReverbModel(ReverbModel *newReverbModel) {
 	delete reverbModel;
 	if (newReverbModel == NULL) {
@@ -149,6 +245,7 @@ void Synth::setReverbParameters(Bit8u mode, Bit8u time, Bit8u level) {
 	} else {
 		reverbModel->setParameters(mode, time, level);
 	}
+	MT32EMU_PROBE3(reverb_params, mode, time, level);
 }
 
 File *Synth::openFile(const char *filename, File::OpenMode mode) {
@@ -199,7 +296,7 @@ bool Synth::loadPreset(File *file) {
 				inSys = false;
 				syslen = 0;
 			} else if (syslen == MAX_SYSEX_SIZE) {
-				printDebug("MAX_SYSEX_SIZE (%d) exceeded while processing preset, ignoring message", MAX_SYSEX_SIZE);
+				MT32EMU_LOG(this, LogLevel_WARNING, LogCategory_INIT, "MAX_SYSEX_SIZE (%d) exceeded while processing preset, ignoring message", MAX_SYSEX_SIZE);
 				inSys = false;
 				syslen = 0;
 			}
@@ -231,7 +328,7 @@ LoadResult Synth::loadControlROM(const char *filename) {
 			return LoadResult_OK;
 		}
 	}
-	printDebug("%s does not match a known control ROM type", filename);
+	MT32EMU_LOG(this, LogLevel_ERROR, LogCategory_INIT, "%s does not match a known control ROM type", filename);
 	return LoadResult_Invalid;
 }
 
@@ -255,7 +352,7 @@ LoadResult Synth::loadPCMROM(const char *filename) {
 			if (!file->isEOF()) {
 				rc = LoadResult_Unreadable;
 			} else {
-				printDebug("PCM ROM file has an odd number of bytes! Ignoring last");
+				MT32EMU_LOG(this, LogLevel_WARNING, LogCategory_INIT, "PCM ROM file has an odd number of bytes! Ignoring last");
 			}
 			break;
 		}
@@ -275,6 +372,10 @@ LoadResult Synth::loadPCMROM(const char *filename) {
 		bool negative = log < 0;
 		log = (~log) & 0x7FFF;
 
+#if MT32EMU_COMPACT_PCM_ROM
+		// Kept as it is, with the sign moved to the top bit; Tables::decodePCMSample() does the rest
+		pcmROMData[i] = (negative ? 0x8000 : 0) | log;
+#else
 		// CONFIRMED from sample analysis to be 99.99%+ accurate
 		float lin = EXP2F(log / -2048.0f);
 
@@ -283,9 +384,10 @@ LoadResult Synth::loadPCMROM(const char *filename) {
 		}
 
 		pcmROMData[i] = lin;
+#endif
 	}
 	if (i != pcmROMSize) {
-		printDebug("PCM ROM file is too short (expected %d, got %d)", pcmROMSize, i);
+		MT32EMU_LOG(this, LogLevel_WARNING, LogCategory_INIT, "PCM ROM file is too short (expected %d, got %d)", pcmROMSize, i);
 		rc = LoadResult_Invalid;
 	}
 	closeFile(file);
@@ -299,7 +401,7 @@ bool Synth::initPCMList(Bit16u mapAddress, Bit16u count) {
 		int rLenExp = (tps[i].len & 0x70) >> 4;
 		int rLen = 0x800 << rLenExp;
 		if (rAddr + rLen > pcmROMSize) {
-			printDebug("Control ROM error: Wave map entry %d points to invalid PCM address 0x%04X, length 0x%04X", i, rAddr, rLen);
+			MT32EMU_LOG(this, LogLevel_ERROR, LogCategory_INIT, "Control ROM error: Wave map entry %d points to invalid PCM address 0x%04X, length 0x%04X", i, rAddr, rLen);
 			return false;
 		}
 		pcmWaves[i].addr = rAddr;
@@ -342,13 +444,13 @@ bool Synth::initTimbres(Bit16u mapAddress, Bit16u offset, int count, int startTi
 	for (Bit16u i = 0; i < count * 2; i += 2) {
 		Bit16u address = (timbreMap[i + 1] << 8) | timbreMap[i];
 		if (!compressed && (address + offset + sizeof(TimbreParam) > CONTROL_ROM_SIZE)) {
-			printDebug("Control ROM error: Timbre map entry 0x%04x for timbre %d points to invalid timbre address 0x%04x", i, startTimbre, address);
+			MT32EMU_LOG(this, LogLevel_ERROR, LogCategory_INIT, "Control ROM error: Timbre map entry 0x%04x for timbre %d points to invalid timbre address 0x%04x", i, startTimbre, address);
 			return false;
 		}
 		address += offset;
 		if (compressed) {
 			if (!initCompressedTimbre(startTimbre, &controlROMData[address], CONTROL_ROM_SIZE - address)) {
-				printDebug("Control ROM error: Timbre map entry 0x%04x for timbre %d points to invalid timbre at 0x%04x", i, startTimbre, address);
+				MT32EMU_LOG(this, LogLevel_ERROR, LogCategory_INIT, "Control ROM error: Timbre map entry 0x%04x for timbre %d points to invalid timbre at 0x%04x", i, startTimbre, address);
 				return false;
 			}
 		} else {
@@ -364,6 +466,14 @@ bool Synth::open(SynthProperties &useProp) {
 		return false;
 	}
 	myProp = useProp;
+	if (latencyTrace != NULL) {
+		latencyTrace->attach(myProp.sampleRate);
+	}
+	resetPolyphonyStats();
+	resetRenderStats();
+#if MT32EMU_MONITOR_PARTIALS == 1
+	partialMonitorSamplePos = 0;
+#endif
 	tables.init(this);
 	reverbModel->reset();
 	reverbModel->setSampleRate(useProp.sampleRate);
@@ -377,48 +487,71 @@ bool Synth::open(SynthProperties &useProp) {
 	// This is to help detect bugs
 	memset(&mt32ram, '?', sizeof(mt32ram));
 
-	printDebug("Loading Control ROM");
-	if (loadControlROM("CM32L_CONTROL.ROM") != LoadResult_OK) {
-		if (loadControlROM("MT32_CONTROL.ROM") != LoadResult_OK) {
-			printDebug("Init Error - Missing or invalid MT32_CONTROL.ROM");
-			report(ReportType_errorControlROM, &errno);
-			return false;
+	romImage = useProp.romImage;
+	if (romImage == NULL) {
+		if (privateROMImage == NULL) {
+			privateROMImage = new ROMImage();
 		}
+		romImage = privateROMImage;
 	}
+	controlROMData = romImage->controlROMData;
 
-	initMemoryRegions();
+	if (romImage->loaded) {
+		MT32EMU_LOG(this, LogLevel_INFO, LogCategory_INIT, "Using shared ROMs");
+		controlROMMap = romImage->controlROMMap;
+		pcmROMData = romImage->pcmROMData;
+		pcmROMSize = romImage->pcmROMSize;
+	} else {
+		MT32EMU_LOG(this, LogLevel_INFO, LogCategory_INIT, "Loading Control ROM");
+		if (loadControlROM("CM32L_CONTROL.ROM") != LoadResult_OK) {
+			if (loadControlROM("MT32_CONTROL.ROM") != LoadResult_OK) {
+				MT32EMU_LOG(this, LogLevel_ERROR, LogCategory_INIT, "Init Error - Missing or invalid MT32_CONTROL.ROM");
+				report(ReportType_errorControlROM, &errno);
+				return false;
+			}
+		}
 
-	// 512KB PCM ROM for MT-32, etc.
-	// 1MB PCM ROM for CM-32L, LAPC-I, CM-64, CM-500
-	// Note that the size below is given in samples (16-bit), not bytes
-	pcmROMSize = controlROMMap->pcmCount == 256 ? 512 * 1024 : 256 * 1024;
-	pcmROMData = new float[pcmROMSize];
-
-	printDebug("Loading PCM ROM");
-	if (loadPCMROM("CM32L_PCM.ROM") != LoadResult_OK) {
-		if (loadPCMROM("MT32_PCM.ROM") != LoadResult_OK) {
-			printDebug("Init Error - Missing MT32_PCM.ROM");
-			report(ReportType_errorPCMROM, &errno);
-			return false;
+		// 512KB PCM ROM for MT-32, etc.
+		// 1MB PCM ROM for CM-32L, LAPC-I, CM-64, CM-500
+		// Note that the size below is given in samples (16-bit), not bytes
+		pcmROMSize = controlROMMap->pcmCount == 256 ? 512 * 1024 : 256 * 1024;
+		// A previous failed attempt may have left a buffer of the other size behind
+		delete[] romImage->pcmROMData;
+		pcmROMData = new PCMSample[pcmROMSize];
+		romImage->pcmROMData = pcmROMData;
+
+		MT32EMU_LOG(this, LogLevel_INFO, LogCategory_INIT, "Loading PCM ROM");
+		if (loadPCMROM("CM32L_PCM.ROM") != LoadResult_OK) {
+			if (loadPCMROM("MT32_PCM.ROM") != LoadResult_OK) {
+				MT32EMU_LOG(this, LogLevel_ERROR, LogCategory_INIT, "Init Error - Missing MT32_PCM.ROM");
+				report(ReportType_errorPCMROM, &errno);
+				return false;
+			}
 		}
+
+		romImage->controlROMMap = controlROMMap;
+		romImage->pcmROMSize = pcmROMSize;
+		romImage->loaded = true;
 	}
 
-	printDebug("Initialising Timbre Bank A");
+	initMemoryRegions();
+
+	MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_INIT, "Initialising Timbre Bank A");
 	if (!initTimbres(controlROMMap->timbreAMap, controlROMMap->timbreAOffset, 0x40, 0, controlROMMap->timbreACompressed)) {
 		return false;
 	}
 
-	printDebug("Initialising Timbre Bank B");
+	MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_INIT, "Initialising Timbre Bank B");
 	if (!initTimbres(controlROMMap->timbreBMap, controlROMMap->timbreBOffset, 0x40, 64, controlROMMap->timbreBCompressed)) {
 		return false;
 	}
 
-	printDebug("Initialising Timbre Bank R");
+	MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_INIT, "Initialising Timbre Bank R");
 	if (!initTimbres(controlROMMap->timbreRMap, 0, controlROMMap->timbreRCount, 192, true)) {
 		return false;
 	}
 
-	printDebug("Initialising Timbre Bank M");
+	MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_INIT, "Initialising Timbre Bank M");
 	// CM-64 seems to initialise all bytes in this bank to 0.
 	memset(&mt32ram.timbres[128], 0, sizeof(mt32ram.timbres[128]) * 64);
 
@@ -426,13 +559,13 @@ bool Synth::open(SynthProperties &useProp) {
 
 	pcmWaves = new PCMWaveEntry[controlROMMap->pcmCount];
 
-	printDebug("Initialising PCM List");
+	MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_INIT, "Initialising PCM List");
 	initPCMList(controlROMMap->pcmTable, controlROMMap->pcmCount);
 
-	printDebug("Initialising Rhythm Temp");
+	MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_INIT, "Initialising Rhythm Temp");
 	memcpy(mt32ram.rhythmTemp, &controlROMData[controlROMMap->rhythmSettings], controlROMMap->rhythmSettingsCount * 4);
 
-	printDebug("Initialising Patches");
+	MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_INIT, "Initialising Patches");
 	for (Bit8u i = 0; i < 128; i++) {
 		PatchParam *patch = &mt32ram.patches[i];
 		patch->timbreGroup = i / 64;
@@ -445,7 +578,7 @@ bool Synth::open(SynthProperties &useProp) {
 		patch->dummy = 0;
 	}
 
-	printDebug("Initialising System");
+	MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_INIT, "Initialising System");
 	// The MT-32 manual claims that "Standard pitch" is 442Hz.
 	mt32ram.system.masterTune = 0x4A; // Confirmed on CM-64
 	mt32ram.system.reverbMode = 0; // Confirmed
@@ -496,7 +629,7 @@ bool Synth::open(SynthProperties &useProp) {
 	isOpen = true;
 	isEnabled = false;
 
-	printDebug("*** Initialisation complete ***");
+	MT32EMU_LOG(this, LogLevel_INFO, LogCategory_INIT, "*** Initialisation complete ***");
 	return true;
 }
 
@@ -517,7 +650,11 @@ void Synth::close(void) {
 	myProp.baseDir = NULL;
 
 	delete[] pcmWaves;
-	delete[] pcmROMData;
+	// The ROM data itself stays in romImage, ready for the next open()
+	romImage = NULL;
+	controlROMMap = NULL;
+	controlROMData = NULL;
+	pcmROMData = NULL;
 
 	deleteMemoryRegions();
 
@@ -525,6 +662,9 @@ void Synth::close(void) {
 }
 
 void Synth::playMsg(Bit32u msg) {
+	if (latencyTrace != NULL) {
+		latencyTrace->eventStarted(msg, 0);
+	}
 	// FIXME: Implement active sensing
 	unsigned char code     = (unsigned char)((msg & 0x0000F0) >> 4);
 	unsigned char chan     = (unsigned char)(msg & 0x00000F);
@@ -532,19 +672,31 @@ void Synth::playMsg(Bit32u msg) {
 	unsigned char velocity = (unsigned char)((msg & 0xFF0000) >> 16);
 	isEnabled = true;
 
+	if (refreshesPending) {
+		flushPendingRefreshes();
+	}
+
 	//printDebug("Playing chan %d, code 0x%01x note: 0x%02x", chan, code, note);
 
 	char part = chantable[chan];
+	MT32EMU_PROBE2(midi_message, msg, (int)part);
 	if (part < 0 || part > 8) {
-		printDebug("Play msg on unreg chan %d (%d): code=0x%01x, vel=%d", chan, part, code, velocity);
-		return;
+		MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_MIDI, "Play msg on unreg chan %d (%d): code=0x%01x, vel=%d", chan, part, code, velocity);
+	} else {
+		playMsgOnPart(part, code, note, velocity);
+	}
+	if (latencyTrace != NULL) {
+		latencyTrace->eventFinished();
 	}
-	playMsgOnPart(part, code, note, velocity);
 }
 
 void Synth::playMsgOnPart(unsigned char part, unsigned char code, unsigned char note, unsigned char velocity) {
 	Bit32u bend;
 
+	if (refreshesPending) {
+		flushPendingRefreshes();
+	}
+
 	//printDebug("Synth::playMsg(0x%02x)",msg);
 	switch (code) {
 	case 0x8:
@@ -618,7 +770,7 @@ void Synth::playMsgOnPart(unsigned char part, unsigned char code, unsigned char
 			break;
 
 		default:
-			printDebug("Unknown MIDI Control code: 0x%02x - vel 0x%02x", note, velocity);
+			MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_MIDI, "Unknown MIDI Control code: 0x%02x - vel 0x%02x", note, velocity);
 			break;
 		}
 
@@ -633,7 +785,7 @@ void Synth::playMsgOnPart(unsigned char part, unsigned char code, unsigned char
 		parts[part]->setBend(bend);
 		break;
 	default:
-		printDebug("Unknown Midi code: 0x%01x - %02x - %02x", code, note, velocity);
+		MT32EMU_LOG(this, LogLevel_WARNING, LogCategory_MIDI, "Unknown Midi code: 0x%01x - %02x - %02x", code, note, velocity);
 		break;
 	}
 
@@ -642,10 +794,10 @@ void Synth::playMsgOnPart(unsigned char part, unsigned char code, unsigned char
 
 void Synth::playSysex(const Bit8u *sysex, Bit32u len) {
 	if (len < 2) {
-		printDebug("playSysex: Message is too short for sysex (%d bytes)", len);
+		MT32EMU_LOG(this, LogLevel_WARNING, LogCategory_SYSEX, "playSysex: Message is too short for sysex (%d bytes)", len);
 	}
 	if (sysex[0] != 0xF0) {
-		printDebug("playSysex: Message lacks start-of-sysex (0xF0)");
+		MT32EMU_LOG(this, LogLevel_WARNING, LogCategory_SYSEX, "playSysex: Message lacks start-of-sysex (0xF0)");
 		return;
 	}
 	// Due to some programs (e.g. Java) sending buffers with junk at the end, we have to go through and find the end marker rather than relying on len.
@@ -656,7 +808,7 @@ void Synth::playSysex(const Bit8u *sysex, Bit32u len) {
 		}
 	}
 	if (endPos == len) {
-		printDebug("playSysex: Message lacks end-of-sysex (0xf7)");
+		MT32EMU_LOG(this, LogLevel_WARNING, LogCategory_SYSEX, "playSysex: Message lacks end-of-sysex (0xf7)");
 		return;
 	}
 	playSysexWithoutFraming(sysex + 1, endPos - 1);
@@ -664,27 +816,33 @@ void Synth::playSysex(const Bit8u *sysex, Bit32u len) {
 
 void Synth::playSysexWithoutFraming(const Bit8u *sysex, Bit32u len) {
 	if (len < 4) {
-		printDebug("playSysexWithoutFraming: Message is too short (%d bytes)!", len);
+		MT32EMU_LOG(this, LogLevel_WARNING, LogCategory_SYSEX, "playSysexWithoutFraming: Message is too short (%d bytes)!", len);
 		return;
 	}
 	if (sysex[0] != SYSEX_MANUFACTURER_ROLAND) {
-		printDebug("playSysexWithoutFraming: Header not intended for this device manufacturer: %02x %02x %02x %02x", (int)sysex[0], (int)sysex[1], (int)sysex[2], (int)sysex[3]);
+		MT32EMU_LOG(this, LogLevel_WARNING, LogCategory_SYSEX, "playSysexWithoutFraming: Header not intended for this device manufacturer: %02x %02x %02x %02x", (int)sysex[0], (int)sysex[1], (int)sysex[2], (int)sysex[3]);
 		return;
 	}
 	if (sysex[2] == SYSEX_MDL_D50) {
-		printDebug("playSysexWithoutFraming: Header is intended for model D-50 (not yet supported): %02x %02x %02x %02x", (int)sysex[0], (int)sysex[1], (int)sysex[2], (int)sysex[3]);
+		MT32EMU_LOG(this, LogLevel_WARNING, LogCategory_SYSEX, "playSysexWithoutFraming: Header is intended for model D-50 (not yet supported): %02x %02x %02x %02x", (int)sysex[0], (int)sysex[1], (int)sysex[2], (int)sysex[3]);
 		return;
 	} else if (sysex[2] != SYSEX_MDL_MT32) {
-		printDebug("playSysexWithoutFraming: Header not intended for model MT-32: %02x %02x %02x %02x", (int)sysex[0], (int)sysex[1], (int)sysex[2], (int)sysex[3]);
+		MT32EMU_LOG(this, LogLevel_WARNING, LogCategory_SYSEX, "playSysexWithoutFraming: Header not intended for model MT-32: %02x %02x %02x %02x", (int)sysex[0], (int)sysex[1], (int)sysex[2], (int)sysex[3]);
 		return;
 	}
 	playSysexWithoutHeader(sysex[1], sysex[3], sysex + 4, len - 4);
 }
 
 void Synth::playSysexWithoutHeader(unsigned char device, unsigned char command, const Bit8u *sysex, Bit32u len) {
+	if (latencyTrace != NULL) {
+		// Sysex never starts partials, so there's nothing to follow beyond when it takes effect
+		latencyTrace->eventStarted(0xF0, len);
+		latencyTrace->eventFinished();
+	}
+	MT32EMU_PROBE3(sysex, device, command, len);
 	if (device > 0x10) {
 		// We have device ID 0x10 (default, but changeable, on real MT-32), < 0x10 is for channels
-		printDebug("playSysexWithoutHeader: Message is not intended for this device ID (provided: %02x, expected: 0x10 or channel)", (int)device);
+		MT32EMU_LOG(this, LogLevel_WARNING, LogCategory_SYSEX, "playSysexWithoutHeader: Message is not intended for this device ID (provided: %02x, expected: 0x10 or channel)", (int)device);
 		return;
 	}
 	// This is checked early in the real devices (before any sysex length checks or further processing)
@@ -693,24 +851,30 @@ void Synth::playSysexWithoutHeader(unsigned char device, unsigned char command,
 		return;
 	}
 	if (len < 4) {
-		printDebug("playSysexWithoutHeader: Message is too short (%d bytes)!", len);
+		MT32EMU_LOG(this, LogLevel_WARNING, LogCategory_SYSEX, "playSysexWithoutHeader: Message is too short (%d bytes)!", len);
 		return;
 	}
 	unsigned char checksum = calcSysexChecksum(sysex, len - 1, 0);
 	if (checksum != sysex[len - 1]) {
-		printDebug("playSysexWithoutHeader: Message checksum is incorrect (provided: %02x, expected: %02x)!", sysex[len - 1], checksum);
+		MT32EMU_LOG(this, LogLevel_WARNING, LogCategory_SYSEX, "playSysexWithoutHeader: Message checksum is incorrect (provided: %02x, expected: %02x)!", sysex[len - 1], checksum);
 		return;
 	}
 	len -= 1; // Exclude checksum
 	switch (command) {
-	case SYSEX_CMD_DT1:
+	case SYSEX_CMD_DT1: {
+		MT32EMU_PROFILE_START(sysexStart);
 		writeSysex(device, sysex, len);
+		MT32EMU_PROFILE_ADD(renderStats.sysexTicks, sysexStart);
+#if MT32EMU_PROFILE_RENDER
+		renderStats.sysexMessages++;
+#endif
 		break;
+	}
 	case SYSEX_CMD_RQ1:
 		readSysex(device, sysex, len);
 		break;
 	default:
-		printDebug("playSysexWithoutHeader: Unsupported command %02x", command);
+		MT32EMU_LOG(this, LogLevel_WARNING, LogCategory_SYSEX, "playSysexWithoutHeader: Unsupported command %02x", command);
 		return;
 	}
 }
@@ -729,18 +893,22 @@ void Synth::writeSysex(unsigned char device, const Bit8u *sysex, Bit32u len) {
 
 	// Process channel-specific sysex by converting it to device-global
 	if (device < 0x10) {
-		printDebug("WRITE-CHANNEL: Channel %d temp area 0x%06x", device, MT32EMU_SYSEXMEMADDR(addr));
+		MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_SYSEX, "WRITE-CHANNEL: Channel %d temp area 0x%06x", device, MT32EMU_SYSEXMEMADDR(addr));
+		// An earlier write may have reassigned the channels, and chantable is only rebuilt by the refresh
+		if (refreshesPending) {
+			flushPendingRefreshes();
+		}
 		if (/*addr >= MT32EMU_MEMADDR(0x000000) && */addr < MT32EMU_MEMADDR(0x010000)) {
 			int offset;
 			if (chantable[device] == -1) {
-				printDebug(" (Channel not mapped to a partial... 0 offset)");
+				MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_SYSEX, " (Channel not mapped to a partial... 0 offset)");
 				offset = 0;
 			} else if (chantable[device] == 8) {
-				printDebug(" (Channel mapped to rhythm... 0 offset)");
+				MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_SYSEX, " (Channel mapped to rhythm... 0 offset)");
 				offset = 0;
 			} else {
 				offset = chantable[device] * sizeof(MemParams::PatchTemp);
-				printDebug(" (Setting extra offset to %d)", offset);
+				MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_SYSEX, " (Setting extra offset to %d)", offset);
 			}
 			addr += MT32EMU_MEMADDR(0x030000) + offset;
 		} else if (/*addr >= 0x010000 && */ addr < MT32EMU_MEMADDR(0x020000)) {
@@ -748,18 +916,18 @@ void Synth::writeSysex(unsigned char device, const Bit8u *sysex, Bit32u len) {
 		} else if (/*addr >= 0x020000 && */ addr < MT32EMU_MEMADDR(0x030000)) {
 			int offset;
 			if (chantable[device] == -1) {
-				printDebug(" (Channel not mapped to a partial... 0 offset)");
+				MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_SYSEX, " (Channel not mapped to a partial... 0 offset)");
 				offset = 0;
 			} else if (chantable[device] == 8) {
-				printDebug(" (Channel mapped to rhythm... 0 offset)");
+				MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_SYSEX, " (Channel mapped to rhythm... 0 offset)");
 				offset = 0;
 			} else {
 				offset = chantable[device] * sizeof(TimbreParam);
-				printDebug(" (Setting extra offset to %d)", offset);
+				MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_SYSEX, " (Setting extra offset to %d)", offset);
 			}
 			addr += MT32EMU_MEMADDR(0x040000) - MT32EMU_MEMADDR(0x020000) + offset;
 		} else {
-			printDebug("writeSysex: Invalid channel %d address 0x%06x", device, MT32EMU_SYSEXMEMADDR(addr));
+			MT32EMU_LOG(this, LogLevel_WARNING, LogCategory_SYSEX, "writeSysex: Invalid channel %d address 0x%06x", device, MT32EMU_SYSEXMEMADDR(addr));
 			return;
 		}
 	}
@@ -770,7 +938,7 @@ void Synth::writeSysex(unsigned char device, const Bit8u *sysex, Bit32u len) {
 		const MemoryRegion *region = findMemoryRegion(addr);
 
 		if (region == NULL) {
-			printDebug("Sysex write to unrecognised address %06x, len %d", MT32EMU_SYSEXMEMADDR(addr), len);
+			MT32EMU_LOG(this, LogLevel_WARNING, LogCategory_SYSEX, "Sysex write to unrecognised address %06x, len %d", MT32EMU_SYSEXMEMADDR(addr), len);
 			break;
 		}
 		writeMemoryRegion(region, addr, region->getClampedLen(addr, len), sysex);
@@ -891,18 +1059,19 @@ void Synth::writeMemoryRegion(const MemoryRegion *region, Bit32u addr, Bit32u le
 			char timbreName[11];
 			memcpy(timbreName, mt32ram.timbres[absTimbreNum].timbre.common.name, 10);
 			timbreName[10] = 0;
-			printDebug("WRITE-PARTPATCH (%d-%d@%d..%d): %d; timbre=%d (%s), outlevel=%d", first, last, off, off + len, i, absTimbreNum, timbreName, mt32ram.patchTemp[i].outputLevel);
+			MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_SYSEX, "WRITE-PARTPATCH (%d-%d@%d..%d): %d; timbre=%d (%s), outlevel=%d", first, last, off, off + len, i, absTimbreNum, timbreName, mt32ram.patchTemp[i].outputLevel);
 			if (parts[i] != NULL) {
 				if (i != 8) {
 					// Note: Confirmed on CM-64 that we definitely *should* update the timbre here,
 					// but only in the case that the sysex actually writes to those values
 					if (i == first && off > 2) {
-						printDebug(" (Not updating timbre, since those values weren't touched)");
+						MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_SYSEX, " (Not updating timbre, since those values weren't touched)");
 					} else {
 						parts[i]->setTimbre(&mt32ram.timbres[parts[i]->getAbsTimbreNum()].timbre);
 					}
 				}
-				parts[i]->refresh();
+				pendingPartRefreshes |= 1 << i;
+				refreshesPending = true;
 			}
 		}
 		break;
@@ -917,11 +1086,10 @@ void Synth::writeMemoryRegion(const MemoryRegion *region, Bit32u addr, Bit32u le
 			} else {
 				strcpy(timbreName, "[None]");
 			}
-			printDebug("WRITE-RHYTHM (%d-%d@%d..%d): %d; level=%02x, panpot=%02x, reverb=%02x, timbre=%d (%s)", first, last, off, off + len, i, mt32ram.rhythmTemp[i].outputLevel, mt32ram.rhythmTemp[i].panpot, mt32ram.rhythmTemp[i].reverbSwitch, mt32ram.rhythmTemp[i].timbre, timbreName);
-		}
-		if (parts[8] != NULL) {
-			parts[8]->refresh();
+			MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_SYSEX, "WRITE-RHYTHM (%d-%d@%d..%d): %d; level=%02x, panpot=%02x, reverb=%02x, timbre=%d (%s)", first, last, off, off + len, i, mt32ram.rhythmTemp[i].outputLevel, mt32ram.rhythmTemp[i].panpot, mt32ram.rhythmTemp[i].reverbSwitch, mt32ram.rhythmTemp[i].timbre, timbreName);
 		}
+		pendingPartRefreshes |= 1 << 8;
+		refreshesPending = true;
 		break;
 	case MR_TimbreTemp:
 		region->write(first, off, data, len);
@@ -929,10 +1097,9 @@ void Synth::writeMemoryRegion(const MemoryRegion *region, Bit32u addr, Bit32u le
 			char instrumentName[11];
 			memcpy(instrumentName, mt32ram.timbreTemp[i].common.name, 10);
 			instrumentName[10] = 0;
-			printDebug("WRITE-PARTTIMBRE (%d-%d@%d..%d): timbre=%d (%s)", first, last, off, off + len, i, instrumentName);
-			if (parts[i] != NULL) {
-				parts[i]->refresh();
-			}
+			MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_SYSEX, "WRITE-PARTTIMBRE (%d-%d@%d..%d): timbre=%d (%s)", first, last, off, off + len, i, instrumentName);
+			pendingPartRefreshes |= 1 << i;
+			refreshesPending = true;
 		}
 		break;
 	case MR_Patches:
@@ -944,7 +1111,7 @@ void Synth::writeMemoryRegion(const MemoryRegion *region, Bit32u addr, Bit32u le
 			memcpy(instrumentName, mt32ram.timbres[patchAbsTimbreNum].timbre.common.name, 10);
 			instrumentName[10] = 0;
 			Bit8u *n = (Bit8u *)patch;
-			printDebug("WRITE-PATCH (%d-%d@%d..%d): %d; timbre=%d (%s) %02X%02X%02X%02X%02X%02X%02X%02X", first, last, off, off + len, i, patchAbsTimbreNum, instrumentName, n[0], n[1], n[2], n[3], n[4], n[5], n[6], n[7]);
+			MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_SYSEX, "WRITE-PATCH (%d-%d@%d..%d): %d; timbre=%d (%s) %02X%02X%02X%02X%02X%02X%02X%02X", first, last, off, off + len, i, patchAbsTimbreNum, instrumentName, n[0], n[1], n[2], n[3], n[4], n[5], n[6], n[7]);
 			// FIXME:KG: The below is definitely dodgy. We just guess that this is the patch that the part was using
 			// based on a timbre match (but many patches could have the same timbre!)
 			// If this refresh is really correct, we should store the patch number in use by each part.
@@ -970,14 +1137,11 @@ void Synth::writeMemoryRegion(const MemoryRegion *region, Bit32u addr, Bit32u le
 			char instrumentName[11];
 			memcpy(instrumentName, mt32ram.timbres[i].timbre.common.name, 10);
 			instrumentName[10] = 0;
-			printDebug("WRITE-TIMBRE (%d-%d@%d..%d): %d; name=\"%s\"", first, last, off, off + len, i, instrumentName);
-			// FIXME:KG: Not sure if the stuff below should be done (for rhythm and/or parts)...
+			MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_SYSEX, "WRITE-TIMBRE (%d-%d@%d..%d): %d; name=\"%s\"", first, last, off, off + len, i, instrumentName);
+			// FIXME:KG: Not sure if refreshing the parts using the timbre should be done (for rhythm and/or parts)...
 			// Does the real MT-32 automatically do this?
-			for (unsigned int part = 0; part < 9; part++) {
-				if (parts[part] != NULL) {
-					parts[part]->refreshTimbre(i);
-				}
-			}
+			pendingTimbreRefreshes[i >> 5] |= 1 << (i & 31);
+			refreshesPending = true;
 		}
 		break;
 	case MR_System:
@@ -985,14 +1149,15 @@ void Synth::writeMemoryRegion(const MemoryRegion *region, Bit32u addr, Bit32u le
 
 		report(ReportType_devReconfig, NULL);
 
-		printDebug("WRITE-SYSTEM:");
-		refreshSystem();
+		MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_SYSEX, "WRITE-SYSTEM:");
+		pendingSystemRefresh = true;
+		refreshesPending = true;
 		break;
 	case MR_Display:
 		char buf[MAX_SYSEX_SIZE];
 		memcpy(&buf, &data[0], len);
 		buf[len] = 0;
-		printDebug("WRITE-LCD: %s", buf);
+		MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_SYSEX, "WRITE-LCD: %s", buf);
 		report(ReportType_lcdMessage, buf);
 		break;
 	case MR_Reset:
@@ -1016,8 +1181,8 @@ bool Synth::refreshSystem() {
 	// The LAPC-I documentation claims a range of 427.5Hz-452.6Hz (similar to what we have here)
 	// The MT-32 documentation claims a range of 432.1Hz-457.6Hz
 	masterTune = 440.0f * EXP2F((mt32ram.system.masterTune - 64.0f) / (128.0f * 12.0f));
-	printDebug(" Master Tune: %f", masterTune);
-	printDebug(" Reverb: mode=%d, time=%d, level=%d", mt32ram.system.reverbMode, mt32ram.system.reverbTime, mt32ram.system.reverbLevel);
+	MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_SYSEX, " Master Tune: %f", masterTune);
+	MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_SYSEX, " Reverb: mode=%d, time=%d, level=%d", mt32ram.system.reverbMode, mt32ram.system.reverbTime, mt32ram.system.reverbLevel);
 	report(ReportType_newReverbMode,  &mt32ram.system.reverbMode);
 	report(ReportType_newReverbTime,  &mt32ram.system.reverbTime);
 	report(ReportType_newReverbLevel, &mt32ram.system.reverbLevel);
@@ -1025,19 +1190,19 @@ bool Synth::refreshSystem() {
 	setReverbParameters(mt32ram.system.reverbMode, mt32ram.system.reverbTime, mt32ram.system.reverbLevel);
 
 	Bit8u *rset = mt32ram.system.reserveSettings;
-	printDebug(" Partial reserve: 1=%02d 2=%02d 3=%02d 4=%02d 5=%02d 6=%02d 7=%02d 8=%02d Rhythm=%02d", rset[0], rset[1], rset[2], rset[3], rset[4], rset[5], rset[6], rset[7], rset[8]);
+	MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_SYSEX, " Partial reserve: 1=%02d 2=%02d 3=%02d 4=%02d 5=%02d 6=%02d 7=%02d 8=%02d Rhythm=%02d", rset[0], rset[1], rset[2], rset[3], rset[4], rset[5], rset[6], rset[7], rset[8]);
 	int pr = partialManager->setReserve(rset);
 	if (pr != 32) {
-		printDebug(" (Partial Reserve Table with less than 32 partials reserved!)");
+		MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_SYSEX, " (Partial Reserve Table with less than 32 partials reserved!)");
 	}
 	rset = mt32ram.system.chanAssign;
-	printDebug(" Part assign:     1=%02d 2=%02d 3=%02d 4=%02d 5=%02d 6=%02d 7=%02d 8=%02d Rhythm=%02d", rset[0], rset[1], rset[2], rset[3], rset[4], rset[5], rset[6], rset[7], rset[8]);
-	printDebug(" Master volume: %d", mt32ram.system.masterVol);
+	MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_SYSEX, " Part assign:     1=%02d 2=%02d 3=%02d 4=%02d 5=%02d 6=%02d 7=%02d 8=%02d Rhythm=%02d", rset[0], rset[1], rset[2], rset[3], rset[4], rset[5], rset[6], rset[7], rset[8]);
+	MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_SYSEX, " Master volume: %d", mt32ram.system.masterVol);
 	return true;
 }
 
 void Synth::reset() {
-	printDebug("RESET");
+	MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_SYSEX, "RESET");
 	report(ReportType_devReset, NULL);
 	partialManager->deactivateAll();
 	mt32ram = mt32default;
@@ -1050,14 +1215,61 @@ void Synth::reset() {
 		}
 	}
 	refreshSystem();
+	// Everything has just been refreshed anyway
+	clearPendingRefreshes();
 	isEnabled = false;
 }
 
+void Synth::clearPendingRefreshes() {
+	refreshesPending = false;
+	pendingSystemRefresh = false;
+	pendingPartRefreshes = 0;
+	memset(pendingTimbreRefreshes, 0, sizeof(pendingTimbreRefreshes));
+}
+
+void Synth::flushPendingRefreshes() {
+	MT32EMU_PROFILE_START(flushStart);
+	// System first, since it may silence parts and changes the channel assignments
+	if (pendingSystemRefresh) {
+		refreshSystem();
+	}
+	for (unsigned int i = 0; i < 9; i++) {
+		if ((pendingPartRefreshes & (1 << i)) && parts[i] != NULL) {
+			parts[i]->refresh();
+		}
+	}
+	for (unsigned int word = 0; word < 8; word++) {
+		Bit32u bits = pendingTimbreRefreshes[word];
+		for (unsigned int bit = 0; bits != 0; bit++, bits >>= 1) {
+			if (bits & 1) {
+				for (unsigned int part = 0; part < 9; part++) {
+					if (parts[part] != NULL) {
+						parts[part]->refreshTimbre(word * 32 + bit);
+					}
+				}
+			}
+		}
+	}
+	clearPendingRefreshes();
+	MT32EMU_PROFILE_ADD(renderStats.sysexTicks, flushStart);
+}
+
 void Synth::render(Bit16s *stream, Bit32u len) {
+	MT32EMU_PROBE1(render_start, len);
+	if (latencyTrace != NULL) {
+		latencyTrace->renderStarted();
+	}
+	if (refreshesPending) {
+		flushPendingRefreshes();
+	}
 	if (!isEnabled) {
 		memset(stream, 0, len * sizeof(Bit16s) * 2);
+		MT32EMU_PROBE1(render_done, len);
 		return;
 	}
+#if MT32EMU_USE_SDT
+	Bit32u totalLen = len;
+#endif
 	while (len > 0) {
 		Bit32u thisLen = len > MAX_SAMPLE_OUTPUT ? MAX_SAMPLE_OUTPUT : len;
 		doRenderStreams(tmpNonReverbLeft, tmpNonReverbRight, tmpReverbDryLeft, tmpReverbDryRight, tmpReverbWetLeft, tmpReverbWetRight, thisLen);
@@ -1073,6 +1285,7 @@ void Synth::render(Bit16s *stream, Bit32u len) {
 		}
 		len -= thisLen;
 	}
+	MT32EMU_PROBE1(render_done, totalLen);
 }
 
 
@@ -1087,6 +1300,13 @@ static void clearIfNonNull(Bit16s *stream, Bit32u len) {
 }
 
 void Synth::renderStreams(Bit16s *nonReverbLeft, Bit16s *nonReverbRight, Bit16s *reverbDryLeft, Bit16s *reverbDryRight, Bit16s *reverbWetLeft, Bit16s *reverbWetRight, Bit32u len) {
+	MT32EMU_PROBE1(render_start, len);
+	if (latencyTrace != NULL) {
+		latencyTrace->renderStarted();
+	}
+	if (refreshesPending) {
+		flushPendingRefreshes();
+	}
 	if (!isEnabled) {
 		clearIfNonNull(nonReverbLeft, len);
 		clearIfNonNull(nonReverbRight, len);
@@ -1094,6 +1314,7 @@ void Synth::renderStreams(Bit16s *nonReverbLeft, Bit16s *nonReverbRight, Bit16s
 		clearIfNonNull(reverbDryRight, len);
 		clearIfNonNull(reverbWetLeft, len);
 		clearIfNonNull(reverbWetRight, len);
+		MT32EMU_PROBE1(render_done, len);
 		return;
 	}
 	Bit32u pos = 0;
@@ -1103,6 +1324,7 @@ void Synth::renderStreams(Bit16s *nonReverbLeft, Bit16s *nonReverbRight, Bit16s
 		len -= thisLen;
 		pos += thisLen;
 	}
+	MT32EMU_PROBE1(render_done, pos);
 }
 
 static void mix(float *target, const float *stream, Bit32u len) {
@@ -1129,12 +1351,25 @@ static void clearFloats(float *leftBuf, float *rightBuf, Bit32u len) {
 	}
 }
 
+// Renders a partial into tmpBufPartialLeft/Right. Returns false if it had nothing to add.
+bool Synth::producePartialOutput(unsigned int partialNum, Bit32u len) {
+	if (!partialManager->produceOutput(partialNum, &tmpBufPartialLeft[0], &tmpBufPartialRight[0], len)) {
+		return false;
+	}
+	if (latencyTrace != NULL && latencyTrace->isPartialPending(partialNum)) {
+		latencyTrace->partialRendered(partialNum, &tmpBufPartialLeft[0], &tmpBufPartialRight[0], len);
+	}
+	return true;
+}
+
 // FIXME: Using more temporary buffers than we need to
 void Synth::doRenderStreams(Bit16s *nonReverbLeft, Bit16s *nonReverbRight, Bit16s *reverbDryLeft, Bit16s *reverbDryRight, Bit16s *reverbWetLeft, Bit16s *reverbWetRight, Bit32u len) {
+	MT32EMU_PROFILE_START(renderStart);
+	updatePolyphonyStats(len);
 	clearFloats(&tmpBufMixLeft[0], &tmpBufMixRight[0], len);
 	if (!reverbEnabled) {
 		for (unsigned int i = 0; i < MT32EMU_MAX_PARTIALS; i++) {
-			if (partialManager->produceOutput(i, &tmpBufPartialLeft[0], &tmpBufPartialRight[0], len)) {
+			if (producePartialOutput(i, len)) {
 				mix(&tmpBufMixLeft[0], &tmpBufPartialLeft[0], len);
 				mix(&tmpBufMixRight[0], &tmpBufPartialRight[0], len);
 			}
@@ -1152,7 +1387,7 @@ void Synth::doRenderStreams(Bit16s *nonReverbLeft, Bit16s *nonReverbRight, Bit16
 	} else {
 		for (unsigned int i = 0; i < MT32EMU_MAX_PARTIALS; i++) {
 			if (!partialManager->shouldReverb(i)) {
-				if (partialManager->produceOutput(i, &tmpBufPartialLeft[0], &tmpBufPartialRight[0], len)) {
+				if (producePartialOutput(i, len)) {
 					mix(&tmpBufMixLeft[0], &tmpBufPartialLeft[0], len);
 					mix(&tmpBufMixRight[0], &tmpBufPartialRight[0], len);
 				}
@@ -1168,7 +1403,7 @@ void Synth::doRenderStreams(Bit16s *nonReverbLeft, Bit16s *nonReverbRight, Bit16
 		clearFloats(&tmpBufMixLeft[0], &tmpBufMixRight[0], len);
 		for (unsigned int i = 0; i < MT32EMU_MAX_PARTIALS; i++) {
 			if (partialManager->shouldReverb(i)) {
-				if (partialManager->produceOutput(i, &tmpBufPartialLeft[0], &tmpBufPartialRight[0], len)) {
+				if (producePartialOutput(i, len)) {
 					mix(&tmpBufMixLeft[0], &tmpBufPartialLeft[0], len);
 					mix(&tmpBufMixRight[0], &tmpBufPartialRight[0], len);
 				}
@@ -1182,11 +1417,13 @@ void Synth::doRenderStreams(Bit16s *nonReverbLeft, Bit16s *nonReverbRight, Bit16
 		}
 
 		// FIXME: Note that on the real devices, reverb input and output are 16 bit (well, kinda, there's some fudging) signed linear PCM, not float
+		MT32EMU_PROFILE_START(reverbStart);
 		if (mt32ram.system.reverbMode == 3) {
 			delayReverbModel->process(&tmpBufMixLeft[0], &tmpBufMixRight[0], &tmpBufReverbOutLeft[0], &tmpBufReverbOutRight[0], len);
 		} else {
 			reverbModel->process(&tmpBufMixLeft[0], &tmpBufMixRight[0], &tmpBufReverbOutLeft[0], &tmpBufReverbOutRight[0], len);
 		}
+		MT32EMU_PROFILE_ADD(renderStats.reverbTicks, reverbStart);
 		if (reverbWetLeft != NULL) {
 			floatToBit16s(reverbWetLeft, &tmpBufReverbOutLeft[0], len);
 		}
@@ -1195,18 +1432,89 @@ void Synth::doRenderStreams(Bit16s *nonReverbLeft, Bit16s *nonReverbRight, Bit16
 		}
 	}
 	partialManager->clearAlreadyOutputed();
+	if (latencyTrace != NULL) {
+		latencyTrace->framesRendered(len);
+	}
+	MT32EMU_PROFILE_ADD(renderStats.renderTicks, renderStart);
+#if MT32EMU_PROFILE_RENDER
+	renderStats.renderedFrames += len;
+#endif
+}
+
+void Synth::updatePolyphonyStats(Bit32u len) {
+	unsigned int partialUsage[9];
+	unsigned int total = partialManager->getPerPartPartialUsage(partialUsage);
+	MT32EMU_PROBE2(block_partials, len, total);
+	polyphonyStats.occupancy[total] += len;
+	polyphonyStats.renderedFrames += len;
+	if (total > polyphonyStats.peakPartials) {
+		polyphonyStats.peakPartials = total;
+	}
+	for (unsigned int i = 0; i < 9; i++) {
+		PolyphonyStats::PartCounters &part = polyphonyStats.parts[i];
+		part.partialFrames += (Bit64u)partialUsage[i] * len;
+		if (partialUsage[i] > part.peakPartials) {
+			part.peakPartials = partialUsage[i];
+		}
+	}
 #if MT32EMU_MONITOR_PARTIALS == 1
-	samplepos += len;
-	if (samplepos > myProp.SampleRate * 5) {
-		samplepos = 0;
-		int partialUsage[9];
-		partialManager->GetPerPartPartialUsage(partialUsage);
-		printDebug("1:%02d 2:%02d 3:%02d 4:%02d 5:%02d 6:%02d 7:%02d 8:%02d", partialUsage[0], partialUsage[1], partialUsage[2], partialUsage[3], partialUsage[4], partialUsage[5], partialUsage[6], partialUsage[7]);
-		printDebug("Rhythm: %02d  TOTAL: %02d", partialUsage[8], MT32EMU_MAX_PARTIALS - partialManager->GetFreePartialCount());
+	partialMonitorSamplePos += len;
+	if (partialMonitorSamplePos > myProp.sampleRate * 5) {
+		partialMonitorSamplePos = 0;
+		MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_PARTIAL, "1:%02d 2:%02d 3:%02d 4:%02d 5:%02d 6:%02d 7:%02d 8:%02d", partialUsage[0], partialUsage[1], partialUsage[2], partialUsage[3], partialUsage[4], partialUsage[5], partialUsage[6], partialUsage[7]);
+		MT32EMU_LOG(this, LogLevel_DEBUG, LogCategory_PARTIAL, "Rhythm: %02d  TOTAL: %02d", partialUsage[8], total);
 	}
 #endif
 }
 
+void Synth::polyAborted(unsigned int partNum, unsigned int key, PolyState state) {
+	if (state < POLY_Inactive) {
+		polyphonyStats.parts[partNum].abortedPolys[state]++;
+	}
+	MT32EMU_PROBE3(poly_abort, partNum, key, (int)state);
+	PolyAbortedInfo info;
+	info.partNum = partNum;
+	info.key = key;
+	info.state = state;
+	report(ReportType_polyAborted, &info);
+}
+
+void Synth::noteDropped(unsigned int partNum, unsigned int midiKey, unsigned int velocity, unsigned int partialsNeeded, bool noPartials) {
+	if (noPartials) {
+		polyphonyStats.parts[partNum].notesDroppedNoPartials++;
+	} else {
+		polyphonyStats.parts[partNum].notesDroppedNoPoly++;
+	}
+	MT32EMU_PROBE3(note_drop, partNum, midiKey, partialsNeeded);
+	NoteDroppedInfo info;
+	info.partNum = partNum;
+	info.midiKey = midiKey;
+	info.velocity = velocity;
+	info.partialsNeeded = partialsNeeded;
+	info.partialsFree = partialManager->getFreePartialCount();
+	info.noPartials = noPartials;
+	report(ReportType_noteDropped, &info);
+}
+
+void Synth::setLatencyTrace(LatencyTrace *trace) {
+	latencyTrace = trace;
+	if (latencyTrace != NULL) {
+		latencyTrace->attach(myProp.sampleRate);
+	}
+}
+
+LatencyTrace *Synth::getLatencyTrace() const {
+	return latencyTrace;
+}
+
+void Synth::getPolyphonyStats(PolyphonyStats &stats) const {
+	stats = polyphonyStats;
+}
+
+void Synth::resetPolyphonyStats() {
+	memset(&polyphonyStats, 0, sizeof(polyphonyStats));
+}
+
 bool Synth::isActive() const {
 	for (int partialNum = 0; partialNum < MT32EMU_MAX_PARTIALS; partialNum++) {
 		if (partialManager->getPartial(partialNum)->isActive()) {
@@ -1216,6 +1524,30 @@ bool Synth::isActive() const {
 	return false;
 }
 
+void Synth::addPartialStats(int partNum, RenderStats::PartialType type, Bit64u ticks, Bit64u envelopeTicks, Bit64u samples) {
+	if (partNum >= 0 && partNum < 9) {
+		RenderStats::PartialCounters &part = renderStats.parts[partNum];
+		part.ticks += ticks;
+		part.envelopeTicks += envelopeTicks;
+		part.samples += samples;
+	}
+	RenderStats::PartialCounters &partialType = renderStats.partialTypes[type];
+	partialType.ticks += ticks;
+	partialType.envelopeTicks += envelopeTicks;
+	partialType.samples += samples;
+}
+
+void Synth::getRenderStats(RenderStats &stats) const {
+	stats = renderStats;
+	// Whatever isn't accounted for by partials or reverb is mixing
+	Bit64u accounted = stats.reverbTicks + stats.partialTypes[RenderStats::PartialType_SYNTH].ticks + stats.partialTypes[RenderStats::PartialType_PCM].ticks;
+	stats.mixTicks = stats.renderTicks > accounted ? stats.renderTicks - accounted : 0;
+}
+
+void Synth::resetRenderStats() {
+	memset(&renderStats, 0, sizeof(renderStats));
+}
+
 const Partial *Synth::getPartial(unsigned int partialNum) const {
 	return partialManager->getPartial(partialNum);
 }
@@ -1232,16 +1564,16 @@ void MemoryRegion::read(unsigned int entry, unsigned int off, Bit8u *dst, unsign
 	// This method should never be called with out-of-bounds parameters,
 	// or on an unsupported region - seeing any of this debug output indicates a bug in the emulator
 	if (off > entrySize * entries - 1) {
-		synth->printDebug("read[%d]: parameters start out of bounds: entry=%d, off=%d, len=%d", type, entry, off, len);
+		MT32EMU_LOG(synth, LogLevel_WARNING, LogCategory_SYSEX, "read[%d]: parameters start out of bounds: entry=%d, off=%d, len=%d", type, entry, off, len);
 		return;
 	}
 	if (off + len > entrySize * entries) {
-		synth->printDebug("read[%d]: parameters end out of bounds: entry=%d, off=%d, len=%d", type, entry, off, len);
+		MT32EMU_LOG(synth, LogLevel_WARNING, LogCategory_SYSEX, "read[%d]: parameters end out of bounds: entry=%d, off=%d, len=%d", type, entry, off, len);
 		len = entrySize * entries - off;
 	}
 	Bit8u *src = getRealMemory();
 	if (src == NULL) {
-		synth->printDebug("read[%d]: unreadable region: entry=%d, off=%d, len=%d", type, entry, off, len);
+		MT32EMU_LOG(synth, LogLevel_WARNING, LogCategory_SYSEX, "read[%d]: unreadable region: entry=%d, off=%d, len=%d", type, entry, off, len);
 	}
 	memcpy(dst, src + off, len);
 }
@@ -1251,33 +1583,63 @@ void MemoryRegion::write(unsigned int entry, unsigned int off, const Bit8u *src,
 	// This method should never be called with out-of-bounds parameters,
 	// or on an unsupported region - seeing any of this debug output indicates a bug in the emulator
 	if (off > entrySize * entries - 1) {
-		synth->printDebug("write[%d]: parameters start out of bounds: entry=%d, off=%d, len=%d", type, entry, off, len);
+		MT32EMU_LOG(synth, LogLevel_WARNING, LogCategory_SYSEX, "write[%d]: parameters start out of bounds: entry=%d, off=%d, len=%d", type, entry, off, len);
 		return;
 	}
 	if (off + len > entrySize * entries) {
-		synth->printDebug("write[%d]: parameters end out of bounds: entry=%d, off=%d, len=%d", type, entry, off, len);
+		MT32EMU_LOG(synth, LogLevel_WARNING, LogCategory_SYSEX, "write[%d]: parameters end out of bounds: entry=%d, off=%d, len=%d", type, entry, off, len);
 		len = entrySize * entries - off;
 	}
 	Bit8u *dest = getRealMemory();
 	if (dest == NULL) {
-		synth->printDebug("write[%d]: unwritable region: entry=%d, off=%d, len=%d", type, entry, off, len);
+		MT32EMU_LOG(synth, LogLevel_WARNING, LogCategory_SYSEX, "write[%d]: unwritable region: entry=%d, off=%d, len=%d", type, entry, off, len);
+		return;
 	}
+	dest += memOff;
 
-	for (unsigned int i = 0; i < len; i++) {
-		Bit8u desiredValue = src[i];
-		Bit8u maxValue = getMaxValue(memOff);
-		// maxValue == 0 means write-protected unless called from initialisation code, in which case it really means the maximum value is 0.
-		if (maxValue != 0 || init) {
-			if (desiredValue > maxValue) {
-				synth->printDebug("write[%d]: Wanted 0x%02x at %d, but max 0x%02x", type, desiredValue, memOff, maxValue);
-				desiredValue = maxValue;
+	if (maxTable == NULL) {
+		memcpy(dest, src, len);
+		return;
+	}
+
+	// Bulk dumps write many bytes at a time, so clamp one entry's worth at a time against the max table
+	// with simple loops the compiler can vectorise, rather than looking up the max value per byte.
+	unsigned int entryOff = memOff % entrySize;
+	while (len > 0) {
+		unsigned int segmentLen = entrySize - entryOff;
+		if (segmentLen > len) {
+			segmentLen = len;
+		}
+		const Bit8u *max = maxTable + entryOff;
+		if (MT32EMU_LOG_LEVEL >= LogLevel_DEBUG && synth->isLogEnabled(LogLevel_DEBUG, LogCategory_SYSEX)) {
+			for (unsigned int i = 0; i < segmentLen; i++) {
+				if (max[i] != 0 || init) {
+					if (src[i] > max[i]) {
+						MT32EMU_LOG(synth, LogLevel_DEBUG, LogCategory_SYSEX, "write[%d]: Wanted 0x%02x at %d, but max 0x%02x", type, src[i], memOff + i, max[i]);
+					}
+				} else if (src[i] != 0) {
+					// Only output debug info if they wanted to write non-zero, since a lot of things cause this to spit out a lot of debug info otherwise.
+					MT32EMU_LOG(synth, LogLevel_DEBUG, LogCategory_SYSEX, "write[%d]: Wanted 0x%02x at %d, but write-protected", type, src[i], memOff + i);
+				}
+			}
+		}
+		if (init) {
+			// A max value of 0 really means the maximum value is 0 here
+			for (unsigned int i = 0; i < segmentLen; i++) {
+				dest[i] = src[i] < max[i] ? src[i] : max[i];
+			}
+		} else {
+			// A max value of 0 means write-protected
+			for (unsigned int i = 0; i < segmentLen; i++) {
+				Bit8u clamped = src[i] < max[i] ? src[i] : max[i];
+				dest[i] = max[i] != 0 ? clamped : dest[i];
 			}
-			dest[memOff] = desiredValue;
-		} else if (desiredValue != 0) {
-			// Only output debug info if they wanted to write non-zero, since a lot of things cause this to spit out a lot of debug info otherwise.
-			synth->printDebug("write[%d]: Wanted 0x%02x at %d, but write-protected", type, desiredValue, memOff);
 		}
-		memOff++;
+		src += segmentLen;
+		dest += segmentLen;
+		memOff += segmentLen;
+		len -= segmentLen;
+		entryOff = 0;
 	}
 }
 
@@ -51,7 +51,11 @@ enum ReportType {
 	ReportType_devReconfig,
 	ReportType_newReverbMode,
 	ReportType_newReverbTime,
-	ReportType_newReverbLevel
+	ReportType_newReverbLevel,
+
+	// Polyphony (see Synth::getPolyphonyStats())
+	ReportType_polyAborted, // A note was cut short to free partials for another, reportData is a PolyAbortedInfo
+	ReportType_noteDropped // A note wasn't played at all, reportData is a NoteDroppedInfo
 };
 
 enum LoadResult {
@@ -61,6 +65,8 @@ enum LoadResult {
 	LoadResult_Invalid
 };
 
+class ROMImage;
+
 struct SynthProperties {
 	// Sample rate to use in mixing
 	unsigned int sampleRate;
@@ -89,6 +95,8 @@ struct SynthProperties {
 	File *(*openFile)(void *userData, const char *filename, File::OpenMode mode);
 	// Callback for closing a File. May be NULL, in which case the File will automatically be close()d/deleted.
 	void (*closeFile)(void *userData, File *file);
+	// ROMs to share with other synths, or NULL to load a private copy. See ROMImage.
+	ROMImage *romImage;
 };
 
 // This is the specification of the Callback routine used when calling the RecalcWaveforms
@@ -146,6 +154,29 @@ struct ControlROMMap {
 	Bit16u timbreMaxTable; // 72 bytes
 };
 
+// Control and PCM ROM contents in the form the synth works with (the PCM ROM alone takes 1 or 2MB decoded, or half
+// that with MT32EMU_COMPACT_PCM_ROM).
+// Synths opened with the same ROMImage in their SynthProperties share a single copy: whichever opens first loads
+// the ROMs from its own baseDir, the others skip loading entirely. Synths sharing an image must be opened one at
+// a time, and the image must outlive all of them.
+class ROMImage {
+friend class Synth;
+private:
+	bool loaded;
+	const ControlROMMap *controlROMMap;
+	Bit8u controlROMData[CONTROL_ROM_SIZE];
+	PCMSample *pcmROMData;
+	int pcmROMSize;
+
+	ROMImage(const ROMImage &);
+	ROMImage &operator=(const ROMImage &);
+
+public:
+	ROMImage();
+	~ROMImage();
+	bool isLoaded() const;
+};
+
 enum MemoryRegionType {
 	MR_PatchTemp, MR_RhythmTemp, MR_TimbreTemp, MR_Patches, MR_Timbres, MR_System, MR_Display, MR_Reset
 };
@@ -290,15 +321,18 @@ private:
 
 	PCMWaveEntry *pcmWaves; // Array
 
+	// Either the image passed in SynthProperties or privateROMImage; the members below point into it
+	ROMImage *romImage;
+	ROMImage *privateROMImage;
 	const ControlROMMap *controlROMMap;
-	Bit8u controlROMData[CONTROL_ROM_SIZE];
-	float *pcmROMData;
+	Bit8u *controlROMData;
+	PCMSample *pcmROMData;
 	int pcmROMSize; // This is in 16-bit samples, therefore half the number of bytes in the ROM
 
 	Bit8s chantable[32];
 
 	#if MT32EMU_MONITOR_PARTIALS == 1
-	static Bit32s samplepos = 0;
+	Bit32u partialMonitorSamplePos;
 	#endif
 
 	Tables tables;
@@ -317,6 +351,23 @@ private:
 	PartialManager *partialManager;
 	Part *parts[9];
 
+	// Sysex writes only record what needs refreshing; flushPendingRefreshes() does the work once
+	// before the next rendering or MIDI message, however many writes came in between.
+	bool refreshesPending;
+	bool pendingSystemRefresh;
+	// Bit n set for parts[n]
+	Bit32u pendingPartRefreshes;
+	// Bit (n % 32) of element n / 32 set for absolute timbre number n
+	Bit32u pendingTimbreRefreshes[8];
+
+	PolyphonyStats polyphonyStats;
+	LatencyTrace *latencyTrace;
+
+	// Only updated if MT32EMU_PROFILE_RENDER is set
+	RenderStats renderStats;
+	// Cost of reading the time-stamp counter twice in a row, taken off the timings of short sections
+	Bit64u timeStampOverhead;
+
 	float tmpBufPartialLeft[MAX_SAMPLE_OUTPUT];
 	float tmpBufPartialRight[MAX_SAMPLE_OUTPUT];
 	float tmpBufMixLeft[MAX_SAMPLE_OUTPUT];
@@ -333,6 +384,11 @@ private:
 
 	SynthProperties myProp;
 
+	LogLevel logLevel;
+	Bit32u logCategories;
+	// Only used in deferred logging mode
+	LogRing *logRing;
+
 	bool loadPreset(File *file);
 	void doRenderStreams(Bit16s *nonReverbLeft, Bit16s *nonReverbRight, Bit16s *reverbDryLeft, Bit16s *reverbDryRight, Bit16s *reverbWetLeft, Bit16s *reverbWetRight, Bit32u len);
 
@@ -352,13 +408,29 @@ private:
 	bool initCompressedTimbre(int drumNum, const Bit8u *mem, unsigned int memLen);
 	bool refreshSystem();
 	void reset();
+	void clearPendingRefreshes();
+	void flushPendingRefreshes();
+
+	bool producePartialOutput(unsigned int partialNum, Bit32u len);
+	void updatePolyphonyStats(Bit32u len);
+	void polyAborted(unsigned int partNum, unsigned int key, PolyState state);
+	void noteDropped(unsigned int partNum, unsigned int midiKey, unsigned int velocity, unsigned int partialsNeeded, bool noPartials);
+
+	void addPartialStats(int partNum, RenderStats::PartialType type, Bit64u ticks, Bit64u envelopeTicks, Bit64u samples);
 
 	unsigned int getSampleRate() const;
 protected:
 	int report(ReportType type, const void *reportData);
 	File *openFile(const char *filename, File::OpenMode mode);
 	void closeFile(File *file);
-	void printDebug(const char *fmt, ...);
+	// Passes a formatted message straight to the printDebug callback
+	void printDebug(const char *fmt, ...) const;
+
+	// Use MT32EMU_LOG() rather than calling these directly
+	bool isLogEnabled(LogLevel level, LogCategory category) const {
+		return level <= logLevel && (logCategories & category) != 0;
+	}
+	void log(LogLevel level, LogCategory category, const char *fmt, ...) const;
 
 public:
 	static Bit8u calcSysexChecksum(const Bit8u *data, Bit32u len, Bit8u checksum);
@@ -409,6 +481,37 @@ public:
 
 	// partNum should be 0..7 for Part 1..8, or 8 for Rhythm
 	const Part *getPart(unsigned int partNum) const;
+
+	// Messages less important than this level are discarded without being formatted (default: LogLevel_INFO).
+	// Messages above MT32EMU_LOG_LEVEL are never logged, whatever is set here.
+	void setLogLevel(LogLevel level);
+	LogLevel getLogLevel() const;
+	// Bitmask of LogCategory values to log (default: LOG_CATEGORIES_ALL)
+	void setLogCategories(Bit32u categories);
+
+	// In deferred mode, messages are queued instead of being passed to the printDebug callback, so that rendering
+	// and playing never wait on the host's output. They're only delivered when drainLog() is called, and dropped if
+	// the queue fills up in the meantime. Don't change this while another thread may be calling drainLog().
+	void setLogDeferred(bool deferred);
+	// Passes queued messages to the printDebug callback. Meant to be called periodically by a thread other than
+	// the one using the synth, but only one thread may call it at a time.
+	void drainLog();
+
+	// Copies the polyphony counters accumulated since open() or the last resetPolyphonyStats() into stats.
+	// Notes being aborted or dropped are also reported as they happen through the report callback.
+	void getPolyphonyStats(PolyphonyStats &stats) const;
+	void resetPolyphonyStats();
+
+	// Starts following every MIDI message and sysex played through the given trace, or stops if it's NULL.
+	// The trace isn't owned by the synth, and may be passed on to a new one.
+	void setLatencyTrace(LatencyTrace *trace);
+	LatencyTrace *getLatencyTrace() const;
+
+	// Copies the profiling counters accumulated since open() or the last resetRenderStats() into stats.
+	// They're only maintained if the library was built with MT32EMU_PROFILE_RENDER set; otherwise they're all zero.
+	// Nothing is synchronised, so call these from the thread that renders and plays sysex.
+	void getRenderStats(RenderStats &stats) const;
+	void resetRenderStats();
 };
 
 }
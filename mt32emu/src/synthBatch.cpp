@@ -0,0 +1,101 @@
+/* Copyright (C) 2003, 2004, 2005, 2006, 2008, 2009 Dean Beeler, Jerome Fisher
+ * Copyright (C) 2011 Dean Beeler, Jerome Fisher, Sergey V. Mikayev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mt32emu.h"
+
+#ifdef _MSC_VER
+#include <windows.h>
+#pragma intrinsic(_InterlockedExchangeAdd)
+// Adds value to *ptr atomically and returns what *ptr was before
+#define MT32EMU_ATOMIC_FETCH_ADD(ptr, value) ((Bit32u)_InterlockedExchangeAdd((volatile long *)(ptr), (long)(value)))
+#define MT32EMU_SPIN_PAUSE() YieldProcessor()
+#define MT32EMU_YIELD() SwitchToThread()
+#else
+#include <sched.h>
+#define MT32EMU_ATOMIC_FETCH_ADD(ptr, value) __sync_fetch_and_add((ptr), (value))
+#if defined(__i386__) || defined(__x86_64__)
+// Tells the CPU we're spinning, which saves power and lets a hyperthreaded sibling get on with its work
+#define MT32EMU_SPIN_PAUSE() __asm__ __volatile__("pause")
+#else
+#define MT32EMU_SPIN_PAUSE() do {} while (false)
+#endif
+#define MT32EMU_YIELD() sched_yield()
+#endif
+
+// How many times finish() checks for the other threads before it starts yielding the CPU to them
+static const unsigned int SPINS_BEFORE_YIELD = 1000;
+
+using namespace MT32Emu;
+
+SynthBatch::SynthBatch() {
+	synths = NULL;
+	streams = NULL;
+	count = 0;
+	len = 0;
+	nextIndex = 0;
+	doneCount = 0;
+}
+
+SynthBatch::~SynthBatch() {
+}
+
+void SynthBatch::begin(Synth **useSynths, Bit16s **useStreams, unsigned int useCount, Bit32u useLen) {
+	synths = useSynths;
+	streams = useStreams;
+	count = useCount;
+	len = useLen;
+	nextIndex = 0;
+	doneCount = 0;
+	// Threads picking up work must see the new batch in full
+	MT32EMU_MEMORY_BARRIER();
+}
+
+unsigned int SynthBatch::work() {
+	unsigned int rendered = 0;
+	for (;;) {
+		Bit32u index = MT32EMU_ATOMIC_FETCH_ADD(&nextIndex, 1);
+		if (index >= count) {
+			return rendered;
+		}
+		renderSynth(index, synths[index], streams[index], len);
+		rendered++;
+		// The atomic add doubles as a barrier, so whoever sees the batch as done also sees what was rendered
+		MT32EMU_ATOMIC_FETCH_ADD(&doneCount, 1);
+	}
+}
+
+bool SynthBatch::isDone() const {
+	bool done = doneCount >= count;
+	MT32EMU_MEMORY_BARRIER();
+	return done;
+}
+
+void SynthBatch::finish() {
+	work();
+	for (unsigned int spins = 0; !isDone(); spins++) {
+		if (spins < SPINS_BEFORE_YIELD) {
+			MT32EMU_SPIN_PAUSE();
+		} else {
+			// Whoever we're waiting for may have been preempted, possibly in favour of us
+			MT32EMU_YIELD();
+		}
+	}
+}
+
+void SynthBatch::renderSynth(unsigned int /*index*/, Synth *synth, Bit16s *stream, Bit32u len) {
+	synth->render(stream, len);
+}
@@ -0,0 +1,71 @@
+/* Copyright (C) 2003, 2004, 2005, 2006, 2008, 2009 Dean Beeler, Jerome Fisher
+ * Copyright (C) 2011 Dean Beeler, Jerome Fisher, Sergey V. Mikayev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MT32EMU_SYNTH_BATCH_H
+#define MT32EMU_SYNTH_BATCH_H
+
+namespace MT32Emu {
+
+class Synth;
+
+// Renders a set of independent synths for the same number of frames, spreading them over whichever threads call
+// work(). The library doesn't start any threads itself: a host running many synths would typically have each thread
+// of its own pool call work() once per batch, so that synths are picked up by whichever thread is free and one busy
+// synth doesn't hold up the rest.
+//
+// A synth is only ever rendered by one thread at a time, but nothing else is synchronised: the host must not use
+// any synth in the batch (to play MIDI, for example) until the batch is done, other than from renderSynth().
+class SynthBatch {
+public:
+	SynthBatch();
+	virtual ~SynthBatch();
+
+	// Sets up a new batch. streams[i] receives len frames of the output of synths[i], as from Synth::render().
+	// Both arrays must remain valid until the batch is done. Must not be called while any thread is still in work().
+	void begin(Synth **synths, Bit16s **streams, unsigned int count, Bit32u len);
+	// Renders synths not yet taken by another thread until there are none left.
+	// Returns the number of synths rendered by this call.
+	unsigned int work();
+	// Returns true once all synths have been rendered, including any still being rendered by other threads when
+	// work() returned.
+	bool isDone() const;
+	// work(), then waits for the other threads to finish. The waiting starts out spinning, since the last render
+	// call is usually about to end, and falls back to yielding the CPU if it goes on for long.
+	void finish();
+
+protected:
+	// Renders one synth of the batch, on whichever thread took it. The default is a single Synth::render() call;
+	// a host with MIDI due at points within the batch can override this to play it between shorter renders.
+	virtual void renderSynth(unsigned int index, Synth *synth, Bit16s *stream, Bit32u len);
+
+private:
+	Synth **synths;
+	Bit16s **streams;
+	unsigned int count;
+	Bit32u len;
+
+	// Index of the next synth to be taken
+	volatile Bit32u nextIndex;
+	volatile Bit32u doneCount;
+
+	SynthBatch(const SynthBatch &);
+	SynthBatch &operator=(const SynthBatch &);
+};
+
+}
+
+#endif
@@ -36,7 +36,7 @@ void Tables::init(Synth *synth) {
 	initialised = true;
 
 	int lf;
-	synth->printDebug("Initialising Constant Tables");
+	MT32EMU_LOG(synth, LogLevel_DEBUG, LogCategory_INIT, "Initialising Constant Tables");
 	for (lf = 0; lf <= 100; lf++) {
 		// CONFIRMED:KG: This matches a ROM table found by Mok
 		float fVal = (2.0f - LOG10F((float)lf + 1.0f)) * 128.0f;
@@ -82,4 +82,12 @@ void Tables::init(Synth *synth) {
 		// Aka (slightly slower): EXP2F(pitchVal / 4096.0f - 16.0f) * 32000.0f
 		pitchToFreq[i] = EXP2F(i / 4096.0f - 1.034215715f);
 	}
+
+	for (int i = 0; i < 2048; i++) {
+		pcmLogFraction[i] = EXP2F(i / -2048.0f);
+	}
+	for (int i = 0; i < 32; i++) {
+		float scale = (float)ldexp(1.0, -(i & 15));
+		pcmLogScale[i] = (i & 16) != 0 ? -scale : scale;
+	}
 }
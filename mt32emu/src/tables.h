@@ -52,10 +52,27 @@ public:
 
 	float pitchToFreq[65536];
 
+	// Linear values for the fractional part of the logarithm in a PCM sample, and the powers of 2 (with the sign)
+	// selected by its top 5 bits. This is closer to what the LA32 does than converting the whole ROM up front.
+	// Only used with MT32EMU_COMPACT_PCM_ROM, but always present so that the layout of Synth doesn't depend on it.
+	float pcmLogFraction[2048];
+	float pcmLogScale[32];
+
 	Tables();
 	void init(Synth *synth);
+	float decodePCMSample(PCMSample sample) const;
 };
 
+#if MT32EMU_COMPACT_PCM_ROM
+inline float Tables::decodePCMSample(PCMSample sample) const {
+	return pcmLogFraction[sample & 0x7FF] * pcmLogScale[sample >> 11];
+}
+#else
+inline float Tables::decodePCMSample(PCMSample sample) const {
+	return sample;
+}
+#endif
+
 }
 
 #endif
@@ -285,7 +285,7 @@ void TVA::nextPhase() {
 	Tables *tables = &partial->getSynth()->tables;
 
 	if (targetPhase >= TVA_PHASE_DEAD || !playing) {
-		partial->getSynth()->printDebug("TVA::nextPhase(): Shouldn't have got here with targetPhase %d, playing=%s", targetPhase, playing ? "true" : "false");
+		MT32EMU_LOG(partial->getSynth(), LogLevel_ERROR, LogCategory_PARTIAL, "TVA::nextPhase(): Shouldn't have got here with targetPhase %d, playing=%s", targetPhase, playing ? "true" : "false");
 		return;
 	}
 	targetPhase++;
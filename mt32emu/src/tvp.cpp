@@ -45,7 +45,7 @@ static Bit16u keyToPitchTable[] = {
 	21845, 22187, 22528, 22869
 };
 
-TVP::TVP(const Partial *usePartial) :
+TVP::TVP(Partial *usePartial) :
 	partial(usePartial), system(&usePartial->getSynth()->mt32ram.system) {
 	unsigned int sampleRate = usePartial->getSynth()->myProp.sampleRate;
 	// We want to do processing 4000 times per second. FIXME: This is pretty arbitrary.
@@ -177,7 +177,7 @@ void TVP::updatePitch() {
 	pitch = (Bit16u)newPitch;
 
 	// FIXME: We're doing this here because that's what the CM-32L does - we should probably move this somewhere more appropriate in future.
-	partial->tva->recalcSustain();
+	partial->tva.recalcSustain();
 }
 
 void TVP::targetPitchOffsetReached() {
@@ -22,7 +22,7 @@ namespace MT32Emu {
 
 class TVP {
 private:
-	const Partial * const partial;
+	Partial * const partial; // Not const: updatePitch() makes the TVA recalculate its sustain level
 	const MemParams::System * const system; // FIXME: Only necessary because masterTune calculation is done in the wrong place atm.
 
 	const Part *part;
@@ -55,7 +55,7 @@ private:
 	void nextPhase();
 	void process();
 public:
-	TVP(const Partial *partial);
+	TVP(Partial *partial);
 	void reset(const Part *part, const TimbreParam::PartialParam *partialParam);
 	Bit32u getBasePitch() const;
 	Bit16u nextPitch();
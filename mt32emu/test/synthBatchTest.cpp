@@ -0,0 +1,146 @@
+/* Copyright (C) 2003, 2004, 2005, 2006, 2008, 2009 Dean Beeler, Jerome Fisher
+ * Copyright (C) 2011 Dean Beeler, Jerome Fisher, Sergey V. Mikayev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Checks that synths rendered in a SynthBatch spread over several threads produce exactly what rendering each of
+// them on its own would, run by ctest. Uses the bench's generated ROMs, so needs no real ones.
+
+#include <cstdio>
+#include <cstring>
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "../src/mt32emu.h"
+#include "../bench/romFixtures.h"
+
+using namespace MT32Emu;
+
+static const unsigned int SYNTH_COUNT = 6;
+static const unsigned int HELPER_THREADS = 2;
+static const unsigned int BLOCK_FRAMES = 256;
+static const unsigned int BLOCKS = 40;
+
+// Plays a note on the first part of synth index, different for each synth and block
+static void playNote(Synth *synth, unsigned int index, unsigned int block) {
+	unsigned int key = 36 + (index * 7 + block * 5) % 48;
+	synth->playMsg(0x91 | (key << 8) | (100 << 16));
+}
+
+// Like a host with MIDI due within the batch: every synth gets a note halfway through the block
+class NoteBatch : public SynthBatch {
+public:
+	unsigned int block;
+
+protected:
+	void renderSynth(unsigned int index, Synth *synth, Bit16s *stream, Bit32u len) {
+		synth->render(stream, len / 2);
+		playNote(synth, index, block);
+		synth->render(stream + (len / 2) * 2, len - len / 2);
+	}
+};
+
+static NoteBatch batch;
+// Posted once per helper to start a batch, and by each helper once it's out of work(), as a host would
+static sem_t start, idle;
+static volatile bool quit = false;
+
+static void *helperThread(void *) {
+	for (;;) {
+		sem_wait(&start);
+		if (quit) {
+			return NULL;
+		}
+		batch.work();
+		sem_post(&idle);
+	}
+}
+
+static bool openSynths(Synth **synths, MT32EmuBench::ROMFixtures &fixtures) {
+	SynthProperties props;
+	memset(&props, 0, sizeof(props));
+	props.sampleRate = 32000;
+	fixtures.install(props);
+	for (unsigned int i = 0; i < SYNTH_COUNT; i++) {
+		synths[i] = new Synth();
+		synths[i]->setLogLevel(LogLevel_ERROR);
+		if (!synths[i]->open(props)) {
+			fprintf(stderr, "Failed to open the synth with the generated ROMs\n");
+			return false;
+		}
+	}
+	return true;
+}
+
+int main() {
+	MT32EmuBench::ROMFixtures fixtures;
+	Synth *batchSynths[SYNTH_COUNT];
+	Synth *soloSynths[SYNTH_COUNT];
+	if (!openSynths(batchSynths, fixtures) || !openSynths(soloSynths, fixtures)) {
+		return 1;
+	}
+	static Bit16s batchStreams[SYNTH_COUNT][BLOCK_FRAMES * 2];
+	static Bit16s soloStream[BLOCK_FRAMES * 2];
+	Bit16s *streams[SYNTH_COUNT];
+	for (unsigned int i = 0; i < SYNTH_COUNT; i++) {
+		streams[i] = batchStreams[i];
+	}
+
+	sem_init(&start, 0, 0);
+	sem_init(&idle, 0, 0);
+	pthread_t threads[HELPER_THREADS];
+	for (unsigned int t = 0; t < HELPER_THREADS; t++) {
+		pthread_create(&threads[t], NULL, helperThread, NULL);
+	}
+
+	bool ok = true;
+	for (unsigned int block = 0; block < BLOCKS && ok; block++) {
+		batch.block = block;
+		batch.begin(batchSynths, streams, SYNTH_COUNT, BLOCK_FRAMES);
+		for (unsigned int t = 0; t < HELPER_THREADS; t++) {
+			sem_post(&start);
+		}
+		batch.finish();
+		// The next begin() mustn't come while a helper that was slow to wake is still in work()
+		for (unsigned int t = 0; t < HELPER_THREADS; t++) {
+			sem_wait(&idle);
+		}
+		for (unsigned int i = 0; i < SYNTH_COUNT && ok; i++) {
+			soloSynths[i]->render(soloStream, BLOCK_FRAMES / 2);
+			playNote(soloSynths[i], i, block);
+			soloSynths[i]->render(soloStream + BLOCK_FRAMES, BLOCK_FRAMES - BLOCK_FRAMES / 2);
+			if (memcmp(soloStream, batchStreams[i], sizeof(soloStream)) != 0) {
+				fprintf(stderr, "Block %u of synth %u differs from rendering it on its own\n", block, i);
+				ok = false;
+			}
+		}
+	}
+	quit = true;
+	for (unsigned int t = 0; t < HELPER_THREADS; t++) {
+		sem_post(&start);
+	}
+	for (unsigned int t = 0; t < HELPER_THREADS; t++) {
+		pthread_join(threads[t], NULL);
+	}
+
+	for (unsigned int i = 0; i < SYNTH_COUNT; i++) {
+		batchSynths[i]->close();
+		soloSynths[i]->close();
+		delete batchSynths[i];
+		delete soloSynths[i];
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,72 @@
+/* Copyright (C) 2003, 2004, 2005, 2006, 2008, 2009 Dean Beeler, Jerome Fisher
+ * Copyright (C) 2011 Dean Beeler, Jerome Fisher, Sergey V. Mikayev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Regression checks for sysex handling, run by ctest. Uses the bench's generated ROMs, so needs no real ones.
+
+#include <cstdio>
+#include <cstring>
+
+#include "../src/mt32emu.h"
+#include "../bench/romFixtures.h"
+
+using namespace MT32Emu;
+
+static const Bit8u SYSTEM_CHAN_ASSIGN = 0x0D;
+static const Bit8u PATCH_TEMP_PANPOT = 0x09;
+
+static void sendDT1(Synth &synth, unsigned char device, Bit8u addrHigh, Bit8u addrMid, Bit8u addrLow, Bit8u value) {
+	Bit8u sysex[5] = {addrHigh, addrMid, addrLow, value, 0};
+	unsigned int sum = 0;
+	for (int i = 0; i < 4; i++) {
+		sum += sysex[i];
+	}
+	sysex[4] = (Bit8u)((128 - (sum & 0x7F)) & 0x7F);
+	synth.playSysexWithoutHeader(device, SYSEX_CMD_DT1, sysex, sizeof(sysex));
+}
+
+// A channel-addressed write must reach the part a channel assignment sent just before it gave the channel,
+// even with no render or short message in between.
+static bool testChannelWriteAfterChanAssign(Synth &synth) {
+	Bit8u oldPanpot0 = synth.getPart(0)->getPatchTemp()->panpot;
+	// Part 3 (index 2) to MIDI channel 11, which no part had before
+	sendDT1(synth, 0x10, 0x10, 0x00, SYSTEM_CHAN_ASSIGN + 2, 10);
+	sendDT1(synth, 10, 0x00, 0x00, PATCH_TEMP_PANPOT, 3);
+	Bit8u panpot2 = synth.getPart(2)->getPatchTemp()->panpot;
+	Bit8u panpot0 = synth.getPart(0)->getPatchTemp()->panpot;
+	if (panpot2 != 3 || panpot0 != oldPanpot0) {
+		fprintf(stderr, "Channel write after chanAssign: part 3 panpot %d (expected 3), part 1 panpot %d (expected %d)\n", panpot2, panpot0, oldPanpot0);
+		return false;
+	}
+	return true;
+}
+
+int main() {
+	MT32EmuBench::ROMFixtures fixtures;
+	SynthProperties props;
+	memset(&props, 0, sizeof(props));
+	props.sampleRate = 32000;
+	fixtures.install(props);
+	Synth synth;
+	synth.setLogLevel(LogLevel_ERROR);
+	if (!synth.open(props)) {
+		fprintf(stderr, "Failed to open the synth with the generated ROMs\n");
+		return 1;
+	}
+	bool ok = testChannelWriteAfterChanAssign(synth);
+	synth.close();
+	return ok ? 0 : 1;
+}
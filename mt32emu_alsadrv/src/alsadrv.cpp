@@ -23,6 +23,7 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <errno.h>
@@ -31,6 +32,7 @@
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <math.h>
+#include <algorithm>
 
 #include <alsa/version.h>
 #include <alsa/asoundlib.h>
@@ -42,6 +44,8 @@ FILE *recsyx_file = NULL;
 char *recwav_filename = NULL;
 FILE *recwav_file = NULL;
 
+char *trace_filename = NULL;
+
 #define PERC_CHANNEL  9 
 char rom_path[] = "/usr/share/mt32-rom-data/";
 
@@ -50,6 +54,9 @@ char rom_path[] = "/usr/share/mt32-rom-data/";
 #include "maps.h"
 #include "drvreport.h"
 #include "alsadrv.h"
+#include "eventring.h"
+#include "realtime.h"
+#include "recorder.h"
 
 // #define DEBUG
 
@@ -59,22 +66,46 @@ int rv_time = 0;
 int rv_level = 0;
 
 
-/* midi event and ui-command pipes */
+/* driver command and ui-command pipes. MIDI events go through the event ring */
 int eventpipe[2];
 int uicmd_pipe[2];
+event_ring_t midi_ring;
 
 
 #define BUFFER_SIZE_INC  20
 #define MINPROCESS_SIZE  16
 #define URUN_MAX         2
 
+/* Real-time setup. The sequencer thread stamps events as they arrive, so it
+ * must be able to preempt rendering */
+int audio_cpu = -1;
+int seq_cpu = -1;
+#define AUDIO_RT_PRIORITY    70
+#define SEQ_RT_PRIORITY      75
+
+/* Output stops once the synth has no active partials and has rendered
+ * IDLE_MSEC of output no louder than IDLE_THRESHOLD (the reverb tail has died) */
+#define IDLE_MSEC        1000
+#define IDLE_THRESHOLD   2
+long silent_frames = 0;
+
+/* seconds between DRV_STATS reports */
+#define STATS_INTERVAL   5
+/* seconds without underruns before the latency may be reduced */
+#define SHRINK_INTERVAL  30
+
 
 MT32Emu::Synth *mt32;
 snd_seq_t *seq_handle = NULL;
 
+/* held by the log thread while draining, and while mt32 is being replaced */
+pthread_mutex_t synth_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define LOG_DRAIN_USEC   100000
+
 
 /* Buffer infomation */
 #define FRAGMENT_SIZE 1024
+#define FRAGMENT_FRAMES (FRAGMENT_SIZE >> 2)
 //#define PERIOD_SIZE   1024
 #define PERIOD_SIZE   512
 int buffermsec = 100;
@@ -84,12 +115,42 @@ int buffer_mode = BUFFER_AUTO;
 int num_underruns = 0;	
 unsigned int playbuffer_size = 0;
 
+/* PCM configuration. pcm_rate is the rate asked for until the PCM is set up, then the one obtained */
+unsigned int pcm_rate = 44100;
+int pcm_access_mmap = 0;
+snd_pcm_format_t pcm_format = SND_PCM_FORMAT_S16_LE;
+snd_pcm_uframes_t buffer_frames = 0;
+
+/* The buffer is set up once for maximum_msec, and the latency is changed at runtime by only keeping
+ * fill_frames of it filled. Events are played exactly fill_frames after they arrive */
+snd_pcm_uframes_t fill_frames = 0;
+#define WAKE_FRAMES      (PERIOD_SIZE >> 2)
+
+/* latency controller state */
+drv_stats_t drv_stats;
+struct timespec stats_start, latency_changed;
+int window_min_headroom_msec = -1;
+
+/* note latency tracing: every event is followed through the synth, and the
+ * latencies of the notes played are summed up with each DRV_STATS report */
+#define LATENCY_TRACE_EVENTS  65536
+MT32Emu::LatencyTrace *latency_trace = NULL;
+MT32Emu::Bit64u latency_buf[LATENCY_TRACE_EVENTS];
+
+/* formats we can output, best first. The synth renders S16 itself so that needs no conversion */
+static const snd_pcm_format_t pcm_formats[] = {
+	SND_PCM_FORMAT_S16_LE, SND_PCM_FORMAT_S32_LE, SND_PCM_FORMAT_FLOAT_LE
+};
+
+/* rendering scratch space, for when the output can't be rendered in place */
+MT32Emu::Bit16s processbuffer[FRAGMENT_FRAMES * 2];
+unsigned char convbuffer[FRAGMENT_FRAMES * 2 * 4];
+
 
 int events_qd = 0;
 
 int tempo = -1, ppq = -1;
 double timepertick = -1;
-double bytespermsec = (double)(44100 * 2 * 2) / 1000000.0;
 
 int channelmap[16];
 int channeluse[16];
@@ -136,13 +197,45 @@ void debug_msg(const char *msg, ...)
 }
 #endif
 
+/* sets how much of the buffer is kept filled, without touching the hardware configuration */
+void set_latency(int msec)
+{
+	snd_pcm_sw_params_t *swparams;
+	
+	if (msec < minimum_msec)
+		msec = minimum_msec;
+	if (msec > maximum_msec)
+		msec = maximum_msec;
+	
+	fill_frames = (snd_pcm_uframes_t)msec * pcm_rate / 1000;
+	if (fill_frames > buffer_frames)
+		fill_frames = buffer_frames;
+	if (fill_frames < 2 * WAKE_FRAMES)
+		fill_frames = 2 * WAKE_FRAMES;
+	buffermsec = fill_frames * 1000 / pcm_rate;
+	
+	/* only wake up once the fill level has dropped by WAKE_FRAMES */
+	snd_pcm_sw_params_alloca(&swparams);
+	if (snd_pcm_sw_params_current(pcm_handle, swparams) == 0)
+	{
+		snd_pcm_sw_params_set_avail_min(pcm_handle, swparams, buffer_frames - fill_frames + WAKE_FRAMES);
+		snd_pcm_sw_params(pcm_handle, swparams);
+	}
+	
+	clock_gettime(CLOCK_MONOTONIC, &latency_changed);
+	window_min_headroom_msec = -1;
+	num_underruns = 0;
+	
+	report(DRV_LATENCY, buffermsec);
+}
+
 int alsa_set_buffer_time(int msec)
 {
 	int dir, err, channels, realmsec;
-	unsigned int v, rate, periods;
+	unsigned int v, rate, periods, i;
 	double sec, tpp;
 	
-	rate = 44100;
+	rate = pcm_rate;
 	channels = 2;
 	sec = (double)msec / 1000.0;
 	
@@ -153,13 +246,27 @@ int alsa_set_buffer_time(int msec)
 		return -1;
 	}
 	
-	if (snd_pcm_hw_params_set_access(pcm_handle, pcm_hwparams, SND_PCM_ACCESS_RW_INTERLEAVED) < 0) {
+	/* mmap access lets us render straight into the sound card's buffer */
+	if (pcm_access_mmap && snd_pcm_hw_params_set_access(pcm_handle, pcm_hwparams, SND_PCM_ACCESS_MMAP_INTERLEAVED) < 0) {
+		fprintf(stderr, "mmap access not supported, using read/write access.\n");
+		pcm_access_mmap = 0;
+	}
+	if (!pcm_access_mmap && snd_pcm_hw_params_set_access(pcm_handle, pcm_hwparams, SND_PCM_ACCESS_RW_INTERLEAVED) < 0) {
 		fprintf(stderr, "Error setting access.\n");
 		return -1;
 	}
 			
-	/* Set sample format */
-	err = snd_pcm_hw_params_set_format(pcm_handle, pcm_hwparams, SND_PCM_FORMAT_S16_LE);
+	/* Set sample format, the first one the device takes */
+	for (i = 0; i < sizeof(pcm_formats) / sizeof(pcm_formats[0]); i++)
+		if (snd_pcm_hw_params_test_format(pcm_handle, pcm_hwparams, pcm_formats[i]) == 0)
+			break;
+	if (i == sizeof(pcm_formats) / sizeof(pcm_formats[0]))
+	{
+		fprintf(stderr, "Error setting format: none of S16_LE, S32_LE or FLOAT_LE supported\n");
+		return -1;
+	}
+	pcm_format = pcm_formats[i];
+	err = snd_pcm_hw_params_set_format(pcm_handle, pcm_hwparams, pcm_format);
 	if (err < 0) 
 	{
 		fprintf(stderr, "Error setting format: %s\n", snd_strerror(err));
@@ -172,8 +279,12 @@ int alsa_set_buffer_time(int msec)
 		return -1;
 	}
 
-	/* Set sample rate. If the exact rate is not supported */
-	/* by the hardware, use nearest possible rate.         */
+	/* Set sample rate. If the exact rate is not supported   */
+	/* by the hardware, use nearest possible rate - the synth */
+	/* renders at any rate, so don't let ALSA resample.       */
+#if SND_LIB_MAJOR >= 1
+	snd_pcm_hw_params_set_rate_resample(pcm_handle, pcm_hwparams, 0);
+#endif
 #if SND_LIB_MAJOR < 1	
 	if (snd_pcm_hw_params_set_rate_near(pcm_handle, pcm_hwparams, rate, 0) < 0) 
 #else
@@ -195,7 +306,7 @@ int alsa_set_buffer_time(int msec)
 	
 	realmsec = (int)((double)periods * tpp * 1000.0);
 	
-	printf("Buffer resize: Requested %d msec got %d msec / %d periods \n", msec, realmsec, periods);
+	printf("Buffer setup: Requested %d msec got %d msec / %d periods \n", msec, realmsec, periods);
 	
 	/* Set number of periods.  */
 #if SND_LIB_MAJOR < 1	
@@ -228,7 +339,12 @@ int alsa_set_buffer_time(int msec)
 		return -1;
 	}	
 	
-	report(DRV_LATENCY, realmsec);
+	pcm_rate = rate;
+#if SND_LIB_MAJOR < 1
+	buffer_frames = snd_pcm_hw_params_get_buffer_size(pcm_hwparams);
+#else
+	snd_pcm_hw_params_get_buffer_size(pcm_hwparams, &buffer_frames);
+#endif
 	
 	return realmsec;
 }
@@ -255,7 +371,10 @@ int alsa_init_pcm(unsigned int rate, int channels)
 		return -1;
 	}	
 		
-	if (alsa_set_buffer_time(buffermsec) < 1)
+	/* the latency can later go up to maximum_msec without setting the buffer up again */
+	if (maximum_msec < minimum_msec)
+		maximum_msec = minimum_msec;
+	if (alsa_set_buffer_time(maximum_msec) < 1)
 		abort();
 			
 	/* setup ALSA software interface */
@@ -266,8 +385,8 @@ int alsa_init_pcm(unsigned int rate, int channels)
 		return -1;
 	}
 	
-	/* allow the transfer when at least FRAGMENT_SIZE samples can be processed */
-	err = snd_pcm_sw_params_set_avail_min(pcm_handle, swparams, PERIOD_SIZE >> 2);
+	/* wake the process loop when at least a quarter period can be processed. set_latency() raises this */
+	err = snd_pcm_sw_params_set_avail_min(pcm_handle, swparams, WAKE_FRAMES);
 	if (err < 0) {
 		printf("Unable to set avail min for playback: %s\n", snd_strerror(err));
 		return -1;
@@ -289,6 +408,8 @@ int alsa_init_pcm(unsigned int rate, int channels)
 
 	snd_pcm_nonblock(pcm_handle, 1);
 	
+	set_latency(buffermsec);
+	
 	return 0;
 }
 
@@ -329,47 +450,49 @@ int alsa_setup_midi()
 	return port_in_mt;
 }
 
-void attempt_realtime()
+/* events are stamped with a clock that doesn't jump when the system time is set */
+static inline void get_event_time(struct timespec *ts)
 {
-	int status;
-	
-	status = nice(-20);	
-	if (status != -1)
-		printf("Set thread priority to -20\n");
+	clock_gettime(CLOCK_MONOTONIC, ts);
 }
 
-extern unsigned char wav_header[];
-void write_wav_header(FILE *f)
+static inline MT32Emu::Bit64u timespec_nsec(const struct timespec *ts)
 {
-	// At position 40 is the 4 bytes describing the length 
-	fwrite(wav_header, 1, 44, f);
+	return (MT32Emu::Bit64u)ts->tv_sec * 1000000000 + ts->tv_nsec;
 }
 
-static inline int time_to_offset(struct timeval ot, struct timeval nt)
+static MT32Emu::Bit64u trace_clock(void *)
 {
-	double ct;
-	int offset;
-	
-	timersub(&nt, &ot, &nt);
-	
-	ct = (double)nt.tv_sec * 1000000.0 + (double)nt.tv_usec;
-	
-	offset = (int)(ct * bytespermsec);
-	return offset;
+	struct timespec now;
+	get_event_time(&now);
+	return timespec_nsec(&now);
 }
 
-static inline struct timeval get_time()
+/* returns the seconds from then to now */
+static inline double seconds_since(const struct timespec *then, const struct timespec *now)
 {
-	struct timeval nt;
-	
-	gettimeofday(&nt, NULL);
-	return nt;
+	return (double)(now->tv_sec - then->tv_sec) + (double)(now->tv_nsec - then->tv_nsec) / 1000000000.0;
 }
 
-static inline void get_null_event(midiev_t *newev)
+/* Returns the frame within the current render cycle at which an event is due.
+ * now is when the cycle was measured, and delay the number of frames which were
+ * queued in the PCM then. Playing each event fill_frames after it arrived keeps
+ * the latency constant: anything that arrived before now falls inside the cycle,
+ * anything that arrived later falls beyond its end. */
+static inline long event_frame_offset(const midiev_t *ev, const struct timespec *now, snd_pcm_sframes_t delay)
 {
-	newev->type = EVENT_NONE;
-	gettimeofday(&newev->stamp, NULL);
+	double age;
+	long offset;
+	
+	/* only MIDI data is timed - driver commands take effect straight away */
+	if (ev->type != EVENT_MIDI && ev->type != EVENT_SYSEX)
+		return 0;
+	
+	age = seconds_since(&ev->stamp, now);
+	offset = (long)fill_frames - (long)delay - (long)(age * pcm_rate);
+	if (offset < 0)
+		offset = 0;
+	return offset;
 }
 
 int remap(int channel)
@@ -426,18 +549,14 @@ void send_rvlevel_sysex(int newlevel)
 }
 
 	
+/* must only be called from the audio thread */
 void flush_mt32_emu()
 {
-	midiev_t newev;
 	unsigned int msg;
 	int i, j;
 	
 	/* flush out events */
-	while(1)
-	{
-		if (read(eventpipe[0], &newev, sizeof(newev)) != sizeof(newev))
-			break;
-	}
+	event_ring_clear(&midi_ring);
 	
 	/* push note flush events */
 	for (i = 0; i < 16; i++)
@@ -606,10 +725,10 @@ static inline void get_msg(snd_seq_event_t *seq_ev, midiev_t *ev)
 	    case SND_SEQ_EVENT_SYSEX:
 		debug_msg("Sending SysEX of size %d\n", seq_ev->data.ext.len);				
 
+		/* the data is copied into the event ring, so it only needs to last until then */
 		ev->type = EVENT_SYSEX;
 		ev->sysex_len = seq_ev->data.ext.len;
-		ev->sysex = malloc(seq_ev->data.ext.len);
-		memcpy(ev->sysex, seq_ev->data.ext.ptr, ev->sysex_len);
+		ev->sysex = seq_ev->data.ext.ptr;
 		
 		return;
 		
@@ -706,6 +825,7 @@ void start_recordsyx()
 		free(recsyx_filename);
 		return;
 	}
+	recorder_start_syx(recsyx_file);
 
 	consumer_types |= CONSUME_SYSEX;
 	report(DRV_SYXOUTPUT, 1);	
@@ -722,7 +842,7 @@ void start_recordwav()
 		free(recwav_filename);
 		return;
 	}	
-	write_wav_header(recwav_file);
+	recorder_start_wav(recwav_file, pcm_rate);
 	
 	consumer_types |= CONSUME_WAVOUT;
 	report(DRV_WAVOUTPUT, 1);	
@@ -732,35 +852,128 @@ static inline void underrun()
 {	
 	report(DRV_UNDERRUN);
 	num_underruns++;
+	drv_stats.underruns++;
 	
-	/* enlarge buffer if it is not at maximum */
+	/* raise the latency if it is not at maximum */
 	if ((buffermsec + BUFFER_SIZE_INC <= maximum_msec) && 
 	    (num_underruns >= URUN_MAX) &&
-	    (buffer_mode == BUFFER_AUTO) && 0)
+	    (buffer_mode == BUFFER_AUTO))
 	{
-		buffermsec += BUFFER_SIZE_INC;
-		
-		// CHECK if prepare is required here
-		snd_pcm_drop(pcm_handle);		
-		
-		snd_pcm_hw_params_free(pcm_hwparams);
-		buffermsec = alsa_set_buffer_time(buffermsec);
-		
-		num_underruns = 0;
+		set_latency(buffermsec + BUFFER_SIZE_INC);
 	}
 }
 
-/* flushes events from an event pipe. tries to recycle proper notes */
-void flush_event_pipe(int epipe[2])
-{	
-	midiev_t newev;
-	int status;
+/* fills in the latency percentiles of the notes which have reached the DAC since the last call */
+static void measure_latency()
+{
+	unsigned int n;
 	
-	while(1)
+	drv_stats.latency_notes = 0;
+	if (latency_trace == NULL)
+		return;
+	n = latency_trace->collectLatencies(latency_buf, LATENCY_TRACE_EVENTS);
+	if (n == 0)
+		return;
+	
+	/* this runs on the audio thread, so rather than sorting, select each percentile in turn:
+	   every selection only has to look at what lies above the previous one, which it may reorder,
+	   so each percentile is read before the next selection */
+	MT32Emu::Bit64u *p50 = latency_buf + n / 2;
+	MT32Emu::Bit64u *p90 = latency_buf + n * 9 / 10;
+	MT32Emu::Bit64u *p99 = latency_buf + n * 99 / 100;
+	drv_stats.latency_notes = n;
+	std::nth_element(latency_buf, p50, latency_buf + n);
+	drv_stats.latency_p50_usec = *p50 / 1000;
+	std::nth_element(p50, p90, latency_buf + n);
+	drv_stats.latency_p90_usec = *p90 / 1000;
+	std::nth_element(p90, p99, latency_buf + n);
+	drv_stats.latency_p99_usec = *p99 / 1000;
+	drv_stats.latency_max_usec = *std::max_element(p99, latency_buf + n) / 1000;
+}
+
+static void write_trace()
+{
+	FILE *file;
+	
+	if (latency_trace == NULL || trace_filename == NULL)
+		return;
+	file = fopen(trace_filename, "w");
+	if (file == NULL)
 	{
-		status = read(eventpipe[0], &newev, sizeof(newev));
-		if (status != sizeof(newev))
-			break;
+		fprintf(stderr, "Could not open trace file %s: %s\n", trace_filename, strerror(errno));
+		return;
+	}
+	if (!latency_trace->writeChromeTrace(file) || fclose(file) != 0)
+		fprintf(stderr, "Error writing trace file %s\n", trace_filename);
+	else
+		printf("Latency trace written to %s\n", trace_filename);
+}
+
+/* asks the audio thread to write the trace and exit, which it does between cycles */
+static void quit_handler(int)
+{
+	midiev_t ev;
+	
+	memset(&ev, 0, sizeof(ev));
+	ev.type = EVENT_QUIT;
+	if (write(eventpipe[1], &ev, sizeof(ev)) != sizeof(ev))
+		_exit(1);
+}
+
+static void reset_stats(const struct timespec *now)
+{
+	stats_start = *now;
+	drv_stats.cycles = 0;
+	drv_stats.max_load = 0;
+	drv_stats.min_headroom_msec = -1;
+	memset(drv_stats.load_histogram, 0, sizeof(drv_stats.load_histogram));
+}
+
+/* Records how long a cycle took to render and how close to an underrun it started, reports the
+ * statistics now and then, and lowers the latency when it has been more than enough for a while */
+static void end_cycle(long frames, snd_pcm_sframes_t delay, const struct timespec *start)
+{
+	struct timespec now;
+	int load, headroom, bucket;
+	
+	get_event_time(&now);
+	if (frames > 0)
+	{
+		load = (int)(seconds_since(start, &now) * pcm_rate * 100 / frames);
+		headroom = delay * 1000 / pcm_rate;
+		
+		bucket = load / DRV_STATS_LOAD_STEP;
+		if (bucket >= DRV_STATS_LOAD_BUCKETS)
+			bucket = DRV_STATS_LOAD_BUCKETS - 1;
+		drv_stats.load_histogram[bucket]++;
+		drv_stats.cycles++;
+		if (load > drv_stats.max_load)
+			drv_stats.max_load = load;
+		if (drv_stats.min_headroom_msec < 0 || headroom < drv_stats.min_headroom_msec)
+			drv_stats.min_headroom_msec = headroom;
+		if (window_min_headroom_msec < 0 || headroom < window_min_headroom_msec)
+			window_min_headroom_msec = headroom;
+	}
+	
+	if (seconds_since(&stats_start, &now) >= STATS_INTERVAL)
+	{
+		drv_stats.latency_msec = buffermsec;
+		measure_latency();
+		report(DRV_STATS, &drv_stats);
+		reset_stats(&now);
+	}
+	
+	/* if the buffer never got within BUFFER_SIZE_INC of running out, it would have been fine with that much less */
+	if (buffer_mode == BUFFER_AUTO && buffermsec - BUFFER_SIZE_INC >= minimum_msec &&
+	    seconds_since(&latency_changed, &now) >= SHRINK_INTERVAL)
+	{
+		if (window_min_headroom_msec > BUFFER_SIZE_INC)
+			set_latency(buffermsec - BUFFER_SIZE_INC);
+		else
+		{
+			latency_changed = now;
+			window_min_headroom_msec = -1;
+		}
 	}
 }
 
@@ -772,7 +985,7 @@ void * event_startup(void *arg_data)
 	int status;
 	
 	events_qd = 0;	
-	attempt_realtime();
+	attempt_realtime("sequencer", SEQ_RT_PRIORITY, seq_cpu);
 		
 	while(1)
 	{		
@@ -786,27 +999,38 @@ void * event_startup(void *arg_data)
 				continue; /* skip event */
 		
 		get_msg(seq_ev, &newev);
-		gettimeofday(&newev.stamp, NULL);		
+		if (newev.type != EVENT_MIDI && newev.type != EVENT_SYSEX)
+			continue;
+		get_event_time(&newev.stamp);
 				
-		status = write(eventpipe[1], &newev, sizeof(newev));
-		if ((unsigned int)status != sizeof(newev))
-		{
-			if (errno == EAGAIN)
-			{
-				flush_event_pipe(eventpipe);
-				report(DRV_NOTEDROP);
-			} else
-				fprintf(stderr, "stderr: could not sub pipe\n");
-		}
+		/* waits for room if the audio thread is behind, so only an impossibly large sysex is dropped */
+		if (event_ring_push(&midi_ring, &newev) < 0)
+			report(DRV_NOTEDROP);
 		events_qd++;
 	}
 
 	return NULL;
 }
 
+/* Prints the synth's queued log messages, so that the audio thread never waits on the terminal */
+void * log_startup(void *arg_data)
+{
+	while(1)
+	{
+		pthread_mutex_lock(&synth_mutex);
+		if (mt32 != NULL)
+			mt32->drainLog();
+		pthread_mutex_unlock(&synth_mutex);
+
+		usleep(LOG_DRAIN_USEC);
+	}
+
+	return NULL;
+}
+
 int init_alsadrv()
 {
-	pthread_t event_thread;
+	pthread_t event_thread, log_thread;
 	int i;
 			
 	/* initialise buffering */
@@ -819,18 +1043,29 @@ int init_alsadrv()
 		channeluse[i] = 0x0FFFFFFF;
 	}
 	
-	if (recwav_file != NULL)
-		write_wav_header(recwav_file);
-	
 	/* create midi port */
 	port_in_mt = alsa_setup_midi();
 	if (port_in_mt < 0)
 		exit(1);
 			
 	/* create pcm thread if needed */
-	alsa_init_pcm(44100, 2);		    
-		
-	/* create communication pipe from alsa reader to processor */
+	alsa_init_pcm(pcm_rate, 2);		    
+	
+	/* create event queue from alsa reader to processor */
+	if (event_ring_init(&midi_ring) < 0)
+	{
+		fprintf(stderr, "Could not create event queue\n");
+		exit(1);
+	}
+	
+	/* recordings are written by a thread of their own */
+	if (recorder_init() < 0)
+	{
+		fprintf(stderr, "Could not start the recording thread\n");
+		exit(1);
+	}
+	
+	/* create communication pipe from the front-end to processor */
 	if (socketpair(PF_LOCAL, SOCK_STREAM, 0, eventpipe))
 	{
 		fprintf(stderr, "Could not open IPC socket pair\n");
@@ -851,9 +1086,16 @@ int init_alsadrv()
 	}
 
 	pthread_create(&event_thread, NULL, event_startup, NULL);	
+	pthread_create(&log_thread, NULL, log_startup, NULL);
 	
-	/* attempt to increase priority, will only work if user is root */
-	attempt_realtime();
+	warn_cpu_governors(audio_cpu);
+	
+	if (trace_filename != NULL)
+	{
+		latency_trace = new MT32Emu::LatencyTrace(LATENCY_TRACE_EVENTS, trace_clock, NULL);
+		signal(SIGINT, quit_handler);
+		signal(SIGTERM, quit_handler);
+	}
 	
 	/* Create UI command pipe */
 	pipe(uicmd_pipe);
@@ -871,6 +1113,8 @@ void reload_mt32_core(int rv)
 	MT32Emu::SynthProperties synthp;
 	memset(&synthp, 0, sizeof(synthp));
 
+	pthread_mutex_lock(&synth_mutex);
+
 	/* delete core if there is already an instance of it */
 	if (mt32 != NULL)
 	{
@@ -880,11 +1124,14 @@ void reload_mt32_core(int rv)
 	} else 
 		printf("Starting MT-32 core\n");
 	
-	/* create MT32Synth object */
+	/* create MT32Synth object, queueing its messages for the log thread */
 	mt32 = new MT32Emu::Synth();
+	mt32->setLogDeferred(true);
+
+	pthread_mutex_unlock(&synth_mutex);
 
 	/* setup synth params */
-	synthp.sampleRate = 44100;
+	synthp.sampleRate = pcm_rate;
 	
 	if (rv)
 		synthp.useReverb = true;
@@ -902,19 +1149,271 @@ void reload_mt32_core(int rv)
 		report(DRV_MT32FAIL);
 		exit(1);
 	}	
+	
+	mt32->setLatencyTrace(latency_trace);
+	
+	/* the synth has done its big allocations by now */
+	lock_memory();
+}
+
+/* converts interleaved stereo frames from the synth to the PCM format, storing them in the given areas */
+static void convert_frames(const MT32Emu::Bit16s *src, const snd_pcm_channel_area_t *areas, snd_pcm_uframes_t offset, long frames)
+{
+	unsigned char *dst;
+	int ch, step;
+	long i;
+	
+	for (ch = 0; ch < 2; ch++)
+	{
+		dst = (unsigned char *)areas[ch].addr + (areas[ch].first + offset * areas[ch].step) / 8;
+		step = areas[ch].step / 8;
+		
+		switch(pcm_format)
+		{
+		    case SND_PCM_FORMAT_S32_LE:
+			for (i = 0; i < frames; i++, dst += step)
+				*(MT32Emu::Bit32s *)dst = (MT32Emu::Bit32s)src[i * 2 + ch] << 16;
+			break;
+		    case SND_PCM_FORMAT_FLOAT_LE:
+			for (i = 0; i < frames; i++, dst += step)
+				*(float *)dst = src[i * 2 + ch] / 32768.0f;
+			break;
+		    default:
+			for (i = 0; i < frames; i++, dst += step)
+				*(MT32Emu::Bit16s *)dst = src[i * 2 + ch];
+			break;
+		}
+	}
+}
+
+/* returns true if the synth can render into the areas as they are */
+static inline int areas_take_synth_output(const snd_pcm_channel_area_t *areas)
+{
+	return pcm_format == SND_PCM_FORMAT_S16_LE &&
+		areas[0].step == 32 && areas[1].step == 32 && (areas[0].first & 7) == 0 &&
+		areas[1].addr == areas[0].addr && areas[1].first == areas[0].first + 16;
+}
+
+/* deals with an error returned by an ALSA output call: xruns count as underruns, anything else is reported.
+   Returns true if the PCM could be recovered */
+static int recover_output(int err, const char *what)
+{
+	if (err == -EPIPE)
+		underrun();
+	else
+		fprintf(stderr, "%s failed: %s\n", what, snd_strerror(err));
+	err = snd_pcm_recover(pcm_handle, err, 1);
+	if (err < 0)
+	{
+		fprintf(stderr, "Can not recover from %s error: %s\n", what, snd_strerror(err));
+		return 0;
+	}
+	return 1;
+}
+
+/* gets the next part of the sound card's buffer to render into. Returns the frames available there */
+static long begin_output(long frames, const snd_pcm_channel_area_t **areas, snd_pcm_uframes_t *offset)
+{
+	snd_pcm_uframes_t size = frames;
+	int err;
+	
+	err = snd_pcm_mmap_begin(pcm_handle, areas, offset, &size);
+	if (err < 0)
+	{
+		/* try once more after recovering, otherwise the period is lost */
+		if (!recover_output(err, "snd_pcm_mmap_begin"))
+			return 0;
+		size = frames;
+		err = snd_pcm_mmap_begin(pcm_handle, areas, offset, &size);
+		if (err < 0)
+		{
+			fprintf(stderr, "snd_pcm_mmap_begin failed again, dropping %ld frames: %s\n", frames, snd_strerror(err));
+			return 0;
+		}
+	}
+	return size;
+}
+
+/* passes frames to the sound card with read/write access */
+static void write_output(const void *buffer, long frames)
+{
+	snd_pcm_sframes_t written = snd_pcm_writei(pcm_handle, buffer, frames);
+	
+	if (written < 0 && recover_output(written, "snd_pcm_writei"))
+		snd_pcm_writei(pcm_handle, buffer, frames);
+}
+
+/* renders frames of audio and passes them on to the sound card and any recording */
+static void render_frames(long frames)
+{
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_channel_area_t convareas[2];
+	snd_pcm_uframes_t offset;
+	MT32Emu::Bit16s *samples;
+	int status, cmdid, size, ch, i;
+	long mapped;
+	
+	while (frames > 0)
+	{
+		/* check for commands from the gui */
+		status = read(uicmd_pipe[0], &cmdid, sizeof(int));
+		if (status == sizeof(int))
+			switch(cmdid)
+			{
+			    case DRVCMD_CLEAR:
+				/* done at the start of the next cycle, when no event is in use */
+				flush_events = 1;
+				break;
+			}			
+
+		size = frames;
+		if (size > FRAGMENT_FRAMES)
+			size = FRAGMENT_FRAMES;
+
+		/* in mmap mode render straight into the sound card's buffer if the format allows */
+		mapped = 0;
+		samples = processbuffer;
+		if (pcm_access_mmap && (consumer_types & CONSUME_PLAYING))
+		{
+			mapped = begin_output(size, &areas, &offset);
+			if (mapped > 0)
+			{
+				size = mapped;
+				if (areas_take_synth_output(areas))
+					samples = (MT32Emu::Bit16s *)((unsigned char *)areas[0].addr + (areas[0].first + offset * areas[0].step) / 8);
+			}
+		}
+
+		mt32->render(samples, size);
+		
+		/* keep track of how long the output has been silent */
+		for (i = 0; i < size * 2; i++)
+			if (samples[i] > IDLE_THRESHOLD || samples[i] < -IDLE_THRESHOLD)
+				break;
+		if (i < size * 2)
+			silent_frames = 0;
+		else
+			silent_frames += size;
+
+		/* output to WAV file */
+		if (consumer_types & CONSUME_WAVOUT)
+			recorder_write_wav(samples, size);
+						
+		/* output data to sound card buffer */
+		if (mapped > 0)
+		{
+			if (samples == processbuffer)
+				convert_frames(processbuffer, areas, offset, size);
+			snd_pcm_sframes_t committed = snd_pcm_mmap_commit(pcm_handle, offset, size);
+			if (committed < 0)
+				recover_output(committed, "snd_pcm_mmap_commit");
+		}
+		else if ((consumer_types & CONSUME_PLAYING) && !pcm_access_mmap)
+		{
+			if (pcm_format == SND_PCM_FORMAT_S16_LE)
+				write_output(processbuffer, size);
+			else
+			{
+				for (ch = 0; ch < 2; ch++)
+				{
+					convareas[ch].addr = convbuffer;
+					convareas[ch].first = ch * snd_pcm_format_physical_width(pcm_format);
+					convareas[ch].step = 2 * snd_pcm_format_physical_width(pcm_format);
+				}
+				convert_frames(processbuffer, convareas, 0, size);
+				write_output(convbuffer, size);
+			}
+		}
+		
+		frames -= size;
+	}
+}
+
+static void play_event(midiev_t *newev, int rv)
+{
+	switch(newev->type)
+	{
+	    case EVENT_MIDI:
+		if (latency_trace != NULL)
+			latency_trace->setArrivalTime(timespec_nsec(&newev->stamp));
+		mt32->playMsg(newev->msg);    
+		break;
+		
+	    case EVENT_SYSEX:
+		if (latency_trace != NULL)
+			latency_trace->setArrivalTime(timespec_nsec(&newev->stamp));
+		/* record it if needed */
+		if (consumer_types & CONSUME_SYSEX)
+			recorder_write_syx((unsigned char *)newev->sysex, newev->sysex_len);
+		mt32->playSysex((MT32Emu::Bit8u *)newev->sysex, newev->sysex_len);			
+		break;
+	
+	    case EVENT_SET_RVMODE:			
+		rvsysex[7]  = 1;
+		rvsysex[8] = newev->msg;	
+		rvsysex[9] = 128-((rvsysex[5]+rvsysex[6]+rvsysex[7]+rvsysex[8])&127);
+		mt32->playSysex((MT32Emu::Bit8u *)rvsysex, 11);			
+		break;
+	    case EVENT_SET_RVTIME:			
+		rvsysex[7]  = 2;
+		rvsysex[8] = newev->msg;	
+		rvsysex[9] = 128-((rvsysex[5]+rvsysex[6]+rvsysex[7]+rvsysex[8])&127);
+		mt32->playSysex((MT32Emu::Bit8u *)rvsysex, 11);
+		break;
+	    case EVENT_SET_RVLEVEL:			
+		rvsysex[7]  = 3;
+		rvsysex[8] = newev->msg;	
+		rvsysex[9] = 128-((rvsysex[5]+rvsysex[6]+rvsysex[7]+rvsysex[8])&127);
+		mt32->playSysex((MT32Emu::Bit8u *)rvsysex, 11);
+		break;
+	
+	    case EVENT_RESET:
+		reload_mt32_core(rv);
+		break;			
+		
+	    case EVENT_WAVREC_ON:
+		start_recordwav();
+		if (recwav_filename != NULL)
+			report(DRV_NEWWAV, recwav_filename);
+		break;
+	    case EVENT_WAVREC_OFF:
+		if (recwav_filename != NULL)
+		{
+			recorder_stop_wav(); free(recwav_filename); 
+			recwav_file = NULL; recwav_filename = NULL;
+			report(DRV_WAVOUTPUT, 0);
+			consumer_types ^= CONSUME_WAVOUT;
+		}
+		break;			
+
+	    case EVENT_SYXREC_ON:
+		start_recordsyx();
+		if (recsyx_filename != NULL)
+			report(DRV_NEWSYX, recsyx_filename);
+		break;
+	    case EVENT_SYXREC_OFF:
+		if (recsyx_filename != NULL)
+		{
+			consumer_types ^= CONSUME_SYSEX;
+			recorder_stop_syx(); free(recsyx_filename);
+			recsyx_file = NULL; recsyx_filename = NULL;
+			report(DRV_SYXOUTPUT, 0);
+		}
+		break;			
+	
+	    case EVENT_QUIT:
+		write_trace();
+		exit(0);
+	}		
 }
 
 int process_loop(int rv) 
 {
-	unsigned char processbuffer[FRAGMENT_SIZE];
-	unsigned int msg;
-	struct timeval ot;
-	int i, n, pos, csize, size, state;
-	signed int total_bytes, bufferused;
-	midiev_t newev;
-	struct pollfd event_poll;
-	int status, cmdid;
-	snd_pcm_uframes_t frames;
+	struct timespec now, start;
+	long offset, rendered;
+	midiev_t cmdev, *newev;
+	int n, nfds, idle, resumed;
+	snd_pcm_sframes_t avail, delay;
 	snd_pcm_state_t pcmstate;
 	
 	mt32 = NULL;
@@ -923,32 +1422,44 @@ int process_loop(int rv)
 	rv_level = 3;
 	consumer_types = 0;
 	
+	/* this is the audio thread from now on. Threads created by the front-end
+	 * before this don't inherit the priority or CPU */
+	attempt_realtime("audio", AUDIO_RT_PRIORITY, audio_cpu);
+	
 	reload_mt32_core(rv);			
 	
-	/* setup poll info */
-	event_poll.fd = eventpipe[0];
-	event_poll.events = POLLIN | POLLPRI;
+	/* setup poll info: the loop runs whenever the PCM has room or a driver command arrives,
+	 * or when idle whenever a MIDI event or driver command arrives */
+	nfds = 2 + snd_pcm_poll_descriptors_count(pcm_handle);
+	fdbank = (struct pollfd *)malloc(nfds * sizeof(struct pollfd));
+	fdbank[0].fd = event_ring_wake_fd(&midi_ring);
+	fdbank[0].events = POLLIN;
+	fdbank[1].fd = eventpipe[0];
+	fdbank[1].events = POLLIN | POLLPRI;
+	snd_pcm_poll_descriptors(pcm_handle, fdbank + 2, nfds - 2);
 	
 	/* init variables */
-	ot = get_time();
-	total_bytes = 0;
-	csize = 0;
+	newev = NULL;
+	idle = 0;
+	resumed = 0;
+	get_event_time(&now);
+	reset_stats(&now);
 
 	report(DRV_READY);
 	
 	/* the pcm output will usually underrun at this point because of the long running
 	 * time for the initialisation of the ClassicOpen call */
-	bufferused = 0;
-	memset(processbuffer, 0, FRAGMENT_SIZE);
 		
 	/* setup consumers */
 	if (recwav_file != NULL) 
 	{
+		recorder_start_wav(recwav_file, pcm_rate);
 		consumer_types |= CONSUME_WAVOUT;
 		report(DRV_WAVOUTPUT, 1);
 	}
 	if (recsyx_file != NULL) 
 	{
+		recorder_start_syx(recsyx_file);
 		consumer_types |= CONSUME_SYSEX;
 		report(DRV_SYXOUTPUT, 1);
 	}
@@ -960,20 +1471,36 @@ int process_loop(int rv)
 
 	while (1) 
 	{		
-		n = poll(&event_poll, 1, 20);
-		if (n < 0)
-			return -1;
-
-		if (n > 0)
-			read(eventpipe[0], &newev, sizeof(newev));
-		else
-			get_null_event(&newev);
-					
+		if (idle)
+		{
+			/* nothing to play, so sleep till there is */
+			n = 0;
+			if (event_ring_prepare_wait(&midi_ring))
+			{
+				n = poll(fdbank, 2, -1);
+				if (n < 0 && errno != EINTR)
+					return -1;
+			}
+			event_ring_end_wait(&midi_ring, n > 0 && (fdbank[0].revents & POLLIN));
+			
+			/* the PCM is prepared and empty, so the cycle below fills it straight away */
+			idle = 0;
+			resumed = 1;
+			silent_frames = 0;
+			report(DRV_IDLE, 0);
+		} else {
+			/* MIDI events don't need to wake us: each is due fill_frames after it
+			 * arrived, so it is always read in time by a cycle started by the PCM */
+			n = poll(fdbank + 1, nfds - 1, 1000);
+			if (n < 0 && errno != EINTR)
+				return -1;
+		}
 		
 		/* flush events till an unsubscribe event is found */
 		if (flush_events)
 		{
 			flush_events = 0;			
+			newev = NULL;
 			flush_mt32_emu();
 			
 			/* restart decode cycle */
@@ -988,119 +1515,81 @@ int process_loop(int rv)
 			snd_pcm_prepare(pcm_handle);
 		}
 		
-		/* get new time */
-		frames = snd_pcm_avail_update(pcm_handle);
-		csize = frames << 2;
-				
-		/* process data till offset */
-		while(csize > 0)
-		{				
-			/* check for commands from the gui */
-			status = read(uicmd_pipe[0], &cmdid, sizeof(int));
-			if (status == sizeof(int))
-				switch(cmdid)
-				{
-				    case DRVCMD_CLEAR:
-					flush_mt32_emu();
-					break;
-				}			
-
-			size = csize;
-			if (size > FRAGMENT_SIZE)
-				size = FRAGMENT_SIZE;
-
-			mt32->render((MT32Emu::Bit16s *)processbuffer, size >> 2);
-
-			/* output to WAV file */
-			if (consumer_types & CONSUME_WAVOUT)
-			{
-				total_bytes += size;
-				fwrite(processbuffer, 1, size, recwav_file); 	
-				
-				pos = ftell(recwav_file);									
-				fseek(recwav_file, 0x28, SEEK_SET);
-				fwrite(&total_bytes, 1, 4, recwav_file);
-				fseek(recwav_file, pos, SEEK_SET);
-			} 
-					      			
-			/* output data to sound card buffer */
-			if (consumer_types & CONSUME_PLAYING)
-				snd_pcm_writei(pcm_handle, processbuffer, size >> 2);
-			
-			csize -= size;			
+		/* measure the cycle: how much can be rendered, how much is still queued, and when */
+		if (snd_pcm_avail_delay(pcm_handle, &avail, &delay) < 0)
+		{
+			avail = snd_pcm_avail_update(pcm_handle);
+			if (avail < 0)
+				avail = 0;
+			delay = buffer_frames - avail;
 		}
+		get_event_time(&now);
 		
-		/* decide what to do */
-		switch(newev.type)
-		{
-		    case EVENT_MIDI:
-			mt32->playMsg(newev.msg);    
-			break;
-			
-		    case EVENT_SYSEX:
-			/* record it if needed */
-			if (consumer_types & CONSUME_SYSEX)
-			{
-				fwrite((unsigned char *)newev.sysex, 1, newev.sysex_len, recsyx_file);
-				fflush(recsyx_file);
-			}			
-			mt32->playSysex((MT32Emu::Bit8u *)newev.sysex, newev.sysex_len);			
-			free(newev.sysex);
-			break;
+		/* the next frame rendered is heard once what is queued has played */
+		if (latency_trace != NULL)
+			latency_trace->setOutputTime(timespec_nsec(&now) + (MT32Emu::Bit64u)delay * 1000000000 / pcm_rate);
 		
-		    case EVENT_SET_RVMODE:			
-			rvsysex[7]  = 1;
-			rvsysex[8] = newev.msg;	
-			rvsysex[9] = 128-((rvsysex[5]+rvsysex[6]+rvsysex[7]+rvsysex[8])&127);
-			mt32->playSysex((MT32Emu::Bit8u *)rvsysex, 11);			
-			break;
-		    case EVENT_SET_RVTIME:			
-			rvsysex[7]  = 2;
-			rvsysex[8] = newev.msg;	
-			rvsysex[9] = 128-((rvsysex[5]+rvsysex[6]+rvsysex[7]+rvsysex[8])&127);
-			mt32->playSysex((MT32Emu::Bit8u *)rvsysex, 11);
-			break;
-		    case EVENT_SET_RVLEVEL:			
-			rvsysex[7]  = 3;
-			rvsysex[8] = newev.msg;	
-			rvsysex[9] = 128-((rvsysex[5]+rvsysex[6]+rvsysex[7]+rvsysex[8])&127);
-			mt32->playSysex((MT32Emu::Bit8u *)rvsysex, 11);
-			break;
+		/* keep only fill_frames queued */
+		if (delay >= (snd_pcm_sframes_t)fill_frames)
+			avail = 0;
+		else if (avail > (snd_pcm_sframes_t)fill_frames - delay)
+			avail = fill_frames - delay;
 		
-		    case EVENT_RESET:
-			reload_mt32_core(rv);
-			break;			
-			
-		    case EVENT_WAVREC_ON:
-			start_recordwav();
-			if (recwav_filename != NULL)
-				report(DRV_NEWWAV, recwav_filename);
-			break;
-		    case EVENT_WAVREC_OFF:
-			if (recwav_filename != NULL)
+		/* driver commands aren't timed */
+		while (read(eventpipe[0], &cmdev, sizeof(cmdev)) == sizeof(cmdev))
+			play_event(&cmdev, rv);
+				
+		/* play all events due in this cycle, each at the frame it's due */
+		start = now;
+		rendered = 0;
+		while (1)
+		{
+			if (newev == NULL)
 			{
-				fclose(recwav_file); free(recwav_filename); 
-				recwav_file = NULL; recwav_filename = NULL;
-				report(DRV_WAVOUTPUT, 0);
-				consumer_types ^= CONSUME_WAVOUT;
+				newev = event_ring_peek(&midi_ring);
+				if (newev == NULL)
+					break;
 			}
-			break;			
-
-		    case EVENT_SYXREC_ON:
-			start_recordsyx();
-			if (recsyx_filename != NULL)
-				report(DRV_NEWSYX, recsyx_filename);
-			break;
-		    case EVENT_SYXREC_OFF:
-			if (recsyx_filename != NULL)
+			
+			offset = event_frame_offset(newev, &now, delay);
+			if (offset >= avail)
+				break;
+			if (offset > rendered)
 			{
-				consumer_types ^= CONSUME_SYSEX;
-				fclose(recsyx_file); free(recsyx_filename);
-				recsyx_file = NULL; recsyx_filename = NULL;
-				report(DRV_SYXOUTPUT, 0);
+				render_frames(offset - rendered);
+				rendered = offset;
 			}
-			break;			
-		}		
+			
+			play_event(newev, rv);
+			event_ring_pop(&midi_ring);
+			newev = NULL;
+		}
+		
+		/* process data till the end of the cycle */
+		if (rendered < avail)
+			render_frames(avail - rendered);
+		
+		/* the buffer was empty on purpose, so that's no sign of trouble */
+		if (!resumed)
+			end_cycle(avail, delay, &start);
+		resumed = 0;
+		
+		/* with mmap access, writing doesn't start the PCM by itself */
+		if (pcm_access_mmap && snd_pcm_state(pcm_handle) == SND_PCM_STATE_PREPARED && avail > 0)
+			snd_pcm_start(pcm_handle);
+		
+		/* stop when there's nothing left to hear, unless a recording needs the silence */
+		if (mt32->isActive())
+			silent_frames = 0;
+		else if (silent_frames >= (long)pcm_rate * IDLE_MSEC / 1000 && newev == NULL &&
+			 !(consumer_types & CONSUME_WAVOUT))
+		{
+			/* what is still queued is silent, so nothing is lost by dropping it */
+			snd_pcm_drop(pcm_handle);
+			snd_pcm_prepare(pcm_handle);
+			idle = 1;
+			report(DRV_IDLE, 1);
+		}
 	}
 	
 	return 0;
@@ -25,7 +25,8 @@ typedef struct {
 	unsigned char type;	
 	
 	unsigned int msg;
-	struct timeval stamp;
+	/* CLOCK_MONOTONIC time of arrival, see get_event_time() */
+	struct timespec stamp;
 
 	void *sysex;
 	unsigned short sysex_len;	
@@ -54,12 +55,21 @@ typedef struct {
 #define EVENT_WAVREC_OFF     9
 #define EVENT_SYXREC_ON      10
 #define EVENT_SYXREC_OFF     11
+#define EVENT_QUIT           12
 
 extern int minimum_msec;
 extern int maximum_msec;
 extern int buffer_mode;
 extern int buffermsec;
 
+/* PCM output info */
+extern unsigned int pcm_rate;
+extern int pcm_access_mmap;
+
+/* CPUs to pin threads to, or -1 */
+extern int audio_cpu;
+extern int seq_cpu;
+
 extern int consumer_types;
 
 /* Reverb info */
@@ -73,6 +83,9 @@ extern FILE *recsyx_file;
 extern char *recwav_filename;
 extern FILE *recwav_file;
 
+/* latency trace, written on SIGINT/SIGTERM if set */
+extern char *trace_filename;
+
 
 void send_rvmode_sysex(int newmode);
 void send_rvtime_sysex(int newtime);
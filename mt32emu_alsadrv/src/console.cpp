@@ -67,6 +67,8 @@ int MT32Emu_Report(void *userData, MT32Emu::ReportType type, const void *reportD
 
 void report(int type, ...)
 {
+	drv_stats_t *stats;
+	int i;
 	va_list ap;
 	
 	va_start(ap, type);
@@ -112,6 +114,30 @@ void report(int type, ...)
 	case DRV_UNDERRUN:
 		printf("Output buffer underrun\n");
 		break;
+
+	case DRV_LATENCY:
+		printf("Latency %d msec\n", va_arg(ap, int));
+		break;
+
+	case DRV_IDLE:
+		if (va_arg(ap, int))
+			printf("Silent, output suspended\n");
+		else
+			printf("Output resumed\n");
+		break;
+
+	case DRV_STATS:
+		stats = va_arg(ap, drv_stats_t *);
+		printf("Latency %d msec, %d underruns, load max %d%%, headroom min %d msec, load histogram:",
+		       stats->latency_msec, stats->underruns, stats->max_load, stats->min_headroom_msec);
+		for (i = 0; i < DRV_STATS_LOAD_BUCKETS; i++)
+			printf(" %d", stats->load_histogram[i]);
+		printf("\n");
+		if (stats->latency_notes > 0)
+			printf("Note latency over %d notes: median %.1f msec, 90%% %.1f, 99%% %.1f, max %.1f\n",
+			       stats->latency_notes, stats->latency_p50_usec / 1000.0, stats->latency_p90_usec / 1000.0,
+			       stats->latency_p99_usec / 1000.0, stats->latency_max_usec / 1000.0);
+		break;
 	}
 	
 	va_end(ap);
@@ -130,6 +156,11 @@ void usage(char *argv[])
 	printf("-a           : Automatic buffering mode (default)\n");
 	printf("-x msec      : Maximum buffer size in milliseconds\n");
 	printf("-i msec      : Minimum (initial) buffer size in milliseconds\n");
+	printf("-s rate      : Sample rate to ask the sound card for (default 44100)\n");
+	printf("-M           : Render directly into the sound card's buffer (mmap access)\n");
+	printf("-A cpu       : Run the audio thread on the given CPU only\n");
+	printf("-S cpu       : Run the MIDI sequencer thread on the given CPU only\n");
+	printf("-T filename  : Trace note latencies, written as a Chrome trace (JSON) on exit\n");
 	
 	printf("\n");
 	
@@ -192,6 +223,19 @@ int main(int argc, char **argv)
 		    case 'i': i++; if (i == argc) usage(argv);
 			minimum_msec = atoi(argv[i]);
 			break;
+		    case 's': i++; if (i == argc) usage(argv);
+			pcm_rate = atoi(argv[i]);
+			break;
+		    case 'M': pcm_access_mmap = 1; break;
+		    case 'A': i++; if (i == argc) usage(argv);
+			audio_cpu = atoi(argv[i]);
+			break;
+		    case 'S': i++; if (i == argc) usage(argv);
+			seq_cpu = atoi(argv[i]);
+			break;
+		    case 'T': i++; if (i == argc) usage(argv);
+			trace_filename = argv[i];
+			break;
 			
 		    default:
 			usage(argv);
@@ -49,6 +49,35 @@ int MT32Emu_Report(void *userData, MT32Emu::ReportType type, const void *reportD
 #define DRV_NEWWAV    DRIVER_REPORT_START + 16
 #define DRV_NEWSYX    DRIVER_REPORT_START + 17
 
+#define DRV_STATS     DRIVER_REPORT_START + 18
+#define DRV_IDLE      DRIVER_REPORT_START + 19
+
+
+/* Rendering statistics, passed by pointer with DRV_STATS every few seconds.
+ * Load is the time taken to render as a percentage of the time rendered, and
+ * headroom the audio left in the buffer when rendering started. */
+#define DRV_STATS_LOAD_STEP     10
+#define DRV_STATS_LOAD_BUCKETS  11
+
+typedef struct {
+	int latency_msec;
+	int underruns;                  /* since start */
+	
+	/* since the previous report */
+	int cycles;
+	int max_load;
+	int min_headroom_msec;
+	int load_histogram[DRV_STATS_LOAD_BUCKETS];   /* by DRV_STATS_LOAD_STEP, the last counts the rest */
+	
+	/* MIDI-in to DAC-out latency of the notes played since the previous report,
+	 * only measured while tracing (-T) */
+	int latency_notes;
+	int latency_p50_usec;
+	int latency_p90_usec;
+	int latency_p99_usec;
+	int latency_max_usec;
+} drv_stats_t;
+
 
 /* Commands from the front-end to the alsadrv */
 extern int uicmd_pipe[2];
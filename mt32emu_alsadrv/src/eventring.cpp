@@ -0,0 +1,228 @@
+/* Copyright (C) 2003 Tristan
+ * Copyright (C) 2004, 2005 Tristan, Jerome Fisher
+ * Copyright (C) 2008, 2011 Tristan, Jerome Fisher, Jörg Walter
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/eventfd.h>
+
+#include "alsadrv.h"
+#include "eventring.h"
+
+/* Records are preceded by their size, and padded so the next one stays
+ * aligned. A size of 0 means the rest of the buffer is unused and the next
+ * record is at the start. */
+#define RECORD_ALIGN       8
+#define RECORD_HEADER      RECORD_ALIGN
+#define RECORD_SIZE(len)   ((RECORD_HEADER + (len) + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1))
+#define RING_OFFSET(ring, ix) ((ix) & ((ring)->size - 1))
+#define RECORD_AT(ring, offset) ((unsigned int *)((ring)->data + (offset)))
+
+/* time the producer sleeps while waiting for room */
+#define PUSH_RETRY_NSEC    1000000
+
+int byte_ring_init(byte_ring_t *ring, unsigned int size)
+{
+	ring->size = size;
+	ring->write_ix = 0;
+	ring->read_ix = 0;
+	ring->reserved = 0;
+	ring->data = (unsigned char *)malloc(size);
+	if (ring->data == NULL)
+		return -1;
+	
+	/* touch every page now rather than in the audio thread */
+	memset(ring->data, 0, size);
+	return 0;
+}
+
+int byte_ring_fits(const byte_ring_t *ring, unsigned int len)
+{
+	/* even when it has to skip the end of the buffer */
+	return RECORD_SIZE(len) <= ring->size / 2;
+}
+
+void *byte_ring_reserve(byte_ring_t *ring, unsigned int len, unsigned int keep_free)
+{
+	unsigned int size, offset, needed;
+	
+	if (!byte_ring_fits(ring, len))
+		return NULL;
+	
+	/* a record that doesn't fit before the end of the buffer starts again at the beginning */
+	size = RECORD_SIZE(len);
+	offset = RING_OFFSET(ring, ring->write_ix);
+	needed = size;
+	if (offset + size > ring->size)
+		needed += ring->size - offset;
+	
+	if (ring->size - (ring->write_ix - ring->read_ix) < needed + keep_free)
+		return NULL;
+	/* don't write data before seeing that the consumer is done with it */
+	MEMORY_BARRIER();
+	
+	if (needed != size)
+	{
+		*RECORD_AT(ring, offset) = 0;
+		offset = 0;
+	}
+	*RECORD_AT(ring, offset) = size;
+	ring->reserved = needed;
+	return ring->data + offset + RECORD_HEADER;
+}
+
+void byte_ring_commit(byte_ring_t *ring)
+{
+	/* the record must be complete before the consumer can see it */
+	MEMORY_BARRIER();
+	ring->write_ix = ring->write_ix + ring->reserved;
+	ring->reserved = 0;
+}
+
+void *byte_ring_peek(byte_ring_t *ring)
+{
+	unsigned int offset;
+	
+	if (ring->read_ix == ring->write_ix)
+		return NULL;
+	MEMORY_BARRIER();
+	
+	offset = RING_OFFSET(ring, ring->read_ix);
+	if (*RECORD_AT(ring, offset) == 0)
+	{
+		/* skip the unused end of the buffer */
+		ring->read_ix = ring->read_ix + (ring->size - offset);
+		offset = 0;
+	}
+	return ring->data + offset + RECORD_HEADER;
+}
+
+void byte_ring_pop(byte_ring_t *ring)
+{
+	unsigned int size;
+	
+	size = *RECORD_AT(ring, RING_OFFSET(ring, ring->read_ix));
+	/* don't let the producer reuse the record before we're done with it */
+	MEMORY_BARRIER();
+	ring->read_ix = ring->read_ix + size;
+}
+
+int byte_ring_empty(byte_ring_t *ring)
+{
+	return ring->read_ix == ring->write_ix;
+}
+
+void byte_ring_clear(byte_ring_t *ring)
+{
+	unsigned int end = ring->write_ix;
+	MEMORY_BARRIER();
+	ring->read_ix = end;
+}
+
+
+int event_ring_init(event_ring_t *ring)
+{
+	ring->consumer_waiting = 0;
+	if (byte_ring_init(&ring->records, EVENT_RING_SIZE) < 0)
+		return -1;
+	
+	ring->wake_fd = eventfd(0, 0);
+	if (ring->wake_fd < 0)
+	{
+		fprintf(stderr, "Could not create event wake-up fd: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+int event_ring_push(event_ring_t *ring, const midiev_t *ev)
+{
+	unsigned int sysex_len;
+	midiev_t *record;
+	struct timespec retry;
+	
+	sysex_len = (ev->type == EVENT_SYSEX) ? ev->sysex_len : 0;
+	if (!byte_ring_fits(&ring->records, sizeof(midiev_t) + sysex_len))
+		return -1;
+	
+	while ((record = (midiev_t *)byte_ring_reserve(&ring->records, sizeof(midiev_t) + sysex_len, 0)) == NULL)
+	{
+		retry.tv_sec = 0;
+		retry.tv_nsec = PUSH_RETRY_NSEC;
+		nanosleep(&retry, NULL);
+	}
+	*record = *ev;
+	if (sysex_len > 0)
+		memcpy(record + 1, ev->sysex, sysex_len);
+	
+	/* publish the record, then check whether the consumer needs waking. The barrier
+	 * pairs with the one in event_ring_prepare_wait() so that either the consumer sees
+	 * the record or we see that it's waiting. */
+	byte_ring_commit(&ring->records);
+	MEMORY_BARRIER();
+	if (ring->consumer_waiting)
+	{
+		unsigned long long one = 1;
+		write(ring->wake_fd, &one, sizeof(one));
+	}
+	return 0;
+}
+
+midiev_t *event_ring_peek(event_ring_t *ring)
+{
+	midiev_t *ev;
+	
+	ev = (midiev_t *)byte_ring_peek(&ring->records);
+	if (ev != NULL && ev->type == EVENT_SYSEX)
+		ev->sysex = ev + 1;
+	return ev;
+}
+
+void event_ring_pop(event_ring_t *ring)
+{
+	byte_ring_pop(&ring->records);
+}
+
+void event_ring_clear(event_ring_t *ring)
+{
+	byte_ring_clear(&ring->records);
+}
+
+int event_ring_wake_fd(event_ring_t *ring)
+{
+	return ring->wake_fd;
+}
+
+int event_ring_prepare_wait(event_ring_t *ring)
+{
+	ring->consumer_waiting = 1;
+	MEMORY_BARRIER();
+	return byte_ring_empty(&ring->records);
+}
+
+void event_ring_end_wait(event_ring_t *ring, int woken)
+{
+	unsigned long long count;
+	
+	ring->consumer_waiting = 0;
+	if (woken)
+		read(ring->wake_fd, &count, sizeof(count));
+}
@@ -0,0 +1,101 @@
+/* Copyright (C) 2003 Tristan
+ * Copyright (C) 2004, 2005 Tristan, Jerome Fisher
+ * Copyright (C) 2008, 2011 Tristan, Jerome Fisher, Jörg Walter
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MT32_ALSA_EVENT_RING_H
+#define MT32_ALSA_EVENT_RING_H
+
+/* Single-producer, single-consumer queue of variable-sized records, in a
+ * buffer allocated up front. Records are written in place between
+ * byte_ring_reserve() and byte_ring_commit(), and read in place between
+ * byte_ring_peek() and byte_ring_pop(). Neither side allocates, takes a lock,
+ * makes a system call or waits: when there is no room the producer is told so,
+ * and decides for itself whether to try again or give up. The MIDI event queue
+ * below and the recorder are both built on it. */
+
+#define MEMORY_BARRIER()   __sync_synchronize()
+
+typedef struct {
+	unsigned char *data;
+	/* a power of two */
+	unsigned int size;
+	/* free-running byte positions, each written by one side only */
+	volatile unsigned int write_ix;
+	volatile unsigned int read_ix;
+	/* producer only: what the record being written takes up */
+	unsigned int reserved;
+} byte_ring_t;
+
+int byte_ring_init(byte_ring_t *ring, unsigned int size);
+/* whether a record of len bytes can ever fit in the ring */
+int byte_ring_fits(const byte_ring_t *ring, unsigned int len);
+
+/* Producer side. Returns where to write a record of len bytes, or NULL unless
+ * there is room for it with keep_free bytes to spare. The record is only
+ * passed on by byte_ring_commit(). */
+void *byte_ring_reserve(byte_ring_t *ring, unsigned int len, unsigned int keep_free);
+void byte_ring_commit(byte_ring_t *ring);
+
+/* Consumer side. Returns the oldest record or NULL if there is none. It
+ * remains valid until byte_ring_pop(). */
+void *byte_ring_peek(byte_ring_t *ring);
+void byte_ring_pop(byte_ring_t *ring);
+int byte_ring_empty(byte_ring_t *ring);
+/* Discards everything queued so far */
+void byte_ring_clear(byte_ring_t *ring);
+
+/* Queue of timed MIDI events from the sequencer thread (the only producer) to
+ * an audio thread (the only consumer). mt32d has one, mt32multid one per synth.
+ *
+ * The storage is allocated once up front and sysex data is stored inline, so
+ * neither side allocates, takes a lock or makes a system call per event. The
+ * consumer polls the queue once per render cycle. Only when it has announced that
+ * it is going to sleep does the producer write to an eventfd to wake it up.
+ * When the queue is full the producer waits for room instead of dropping events. */
+
+#define EVENT_RING_SIZE  (256 * 1024)
+
+typedef struct {
+	/* each an event followed by its sysex data */
+	byte_ring_t records;
+	/* set by the consumer while it is (about to be) asleep */
+	volatile int consumer_waiting;
+	int wake_fd;
+} event_ring_t;
+
+int event_ring_init(event_ring_t *ring);
+
+/* Producer side. sysex_len bytes are copied from ev->sysex for EVENT_SYSEX.
+ * Returns -1 if the event could never fit. */
+int event_ring_push(event_ring_t *ring, const midiev_t *ev);
+
+/* Consumer side. Returns the oldest event or NULL if there is none. Its sysex
+ * data remains valid until event_ring_pop(). */
+midiev_t *event_ring_peek(event_ring_t *ring);
+void event_ring_pop(event_ring_t *ring);
+/* Discards everything queued so far */
+void event_ring_clear(event_ring_t *ring);
+
+/* To sleep until an event arrives, the consumer calls event_ring_prepare_wait()
+ * and then waits for the fd from event_ring_wake_fd() to become readable - unless
+ * it returned 0, meaning events arrived in the meantime. event_ring_end_wait()
+ * must follow either way; woken says whether the fd became readable. */
+int event_ring_wake_fd(event_ring_t *ring);
+int event_ring_prepare_wait(event_ring_t *ring);
+void event_ring_end_wait(event_ring_t *ring, int woken);
+
+#endif
@@ -65,6 +65,8 @@ char lcd_flags[] = {'W', 'P', 'X', 0};
 
 int lcd_flags_w, lcd_flags_h;
 int lcd_msec = 0;
+int lcd_load = 0;
+int lcd_underruns = 0;
 
 XFontStruct *lcd_main;
 XFontStruct *lcd_flagfont;
@@ -144,7 +146,7 @@ void lcd_display_channels()
 
 void lcd_redraw()
 {
-	char str[32];
+	char str[64];
 	int i, w, h;
 	
 	if (dpy == NULL)
@@ -172,7 +174,7 @@ void lcd_redraw()
 	
 	/* latency info */
 	XSetForeground(dpy, mainGC, LCDHardColour.pixel);
-	sprintf(str, "%d msec", lcd_msec);
+	sprintf(str, "%d msec  load %d%%  underruns %d", lcd_msec, lcd_load, lcd_underruns);
 	XDrawString(dpy, mainWindow, mainGC, DISPLAY_X + 6, DISPLAY_Y + 12, str, strlen(str));
 		
 	/* draw flags */
@@ -31,6 +31,8 @@ void general_lcd_message(const char *buf);
 extern XFontStruct *flcd;
 
 extern int lcd_msec;
+extern int lcd_load;
+extern int lcd_underruns;
 extern char lcd_flags[];
 
 #endif
@@ -0,0 +1,594 @@
+/* Copyright (C) 2003 Tristan
+ * Copyright (C) 2004, 2005 Tristan, Jerome Fisher
+ * Copyright (C) 2008, 2011 Tristan, Jerome Fisher, Jörg Walter
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* mt32multid: a headless daemon running several emulated MT-32s side by side.
+ *
+ * Every instance has its own sequencer port, synth and event ring, and picks
+ * its own ROM directory and reverb setting. Instances using the same ROM
+ * directory share a single decoded copy of the ROMs. Instances are grouped by
+ * PCM device: an instance that is alone on its device renders on that device's
+ * output thread, while instances sharing a device are rendered as a batch by
+ * the output thread and up to one helper thread per further CPU, and the
+ * output thread mixes the results. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <alsa/asoundlib.h>
+
+#include <mt32emu/mt32emu.h>
+
+#include "alsadrv.h"
+#include "eventring.h"
+#include "realtime.h"
+
+#define MAX_INSTANCES        16
+
+#define DEFAULT_ROM_PATH     "/usr/share/mt32-rom-data/"
+#define DEFAULT_DEVICE       "default"
+#define DEFAULT_LATENCY_MSEC 60
+
+#define OUTPUT_RT_PRIORITY   70
+#define SEQ_RT_PRIORITY      75
+
+/* largest channel message snd_midi_event_decode() produces */
+#define MAX_MSG_LEN          3
+
+typedef struct output_s output_t;
+
+typedef struct {
+	int index;
+	int port;
+	char *rom_dir;
+	/* NULL for the default device */
+	const char *device;
+	int reverb;
+
+	output_t *output;
+	MT32Emu::Synth *synth;
+	event_ring_t ring;
+
+	/* only used by instances that share their output */
+	MT32Emu::Bit16s *buffer;
+} instance_t;
+
+class InstanceBatch;
+
+struct output_s {
+	const char *device;
+	snd_pcm_t *pcm;
+	snd_pcm_uframes_t buffer_frames;
+
+	instance_t *instances[MAX_INSTANCES];
+	int num_instances;
+	MT32Emu::Bit16s *buffer;
+
+	/* the cycle being rendered, as seen by the helpers */
+	long frames;
+	struct timespec now;
+	snd_pcm_sframes_t delay;
+
+	/* only used by outputs shared by several instances */
+	InstanceBatch *batch;
+	MT32Emu::Synth *synths[MAX_INSTANCES];
+	MT32Emu::Bit16s *streams[MAX_INSTANCES];
+	pthread_t helpers[MAX_INSTANCES];
+	int num_helpers;
+	/* posted once per helper to start a cycle, and by each helper once it is done with it */
+	sem_t start, idle;
+
+	pthread_t thread;
+	int underruns;
+};
+
+typedef struct {
+	char *dir;
+	MT32Emu::ROMImage *image;
+} rom_set_t;
+
+static instance_t instances[MAX_INSTANCES];
+static int num_instances = 0;
+static output_t outputs[MAX_INSTANCES];
+static int num_outputs = 0;
+static rom_set_t rom_sets[MAX_INSTANCES];
+static int num_rom_sets = 0;
+
+static const char *default_device = DEFAULT_DEVICE;
+static unsigned int rate = 44100;
+static int latency_msec = DEFAULT_LATENCY_MSEC;
+
+static snd_seq_t *seq_handle = NULL;
+static instance_t *port_instances[256];
+
+
+static int report_callback(void *userData, MT32Emu::ReportType type, const void *reportData)
+{
+	instance_t *inst = (instance_t *)userData;
+
+	switch (type)
+	{
+	case MT32Emu::ReportType_errorControlROM:
+		fprintf(stderr, "[%d] Unable to open %sMT32_CONTROL.ROM: %d\n", inst->index, inst->rom_dir, *((int *)reportData));
+		break;
+
+	case MT32Emu::ReportType_errorPCMROM:
+		fprintf(stderr, "[%d] Unable to open %sMT32_PCM.ROM: %d\n", inst->index, inst->rom_dir, *((int *)reportData));
+		break;
+
+	case MT32Emu::ReportType_lcdMessage:
+		printf("[%d] LCD: %s\n", inst->index, (char *)reportData);
+		break;
+
+	default:
+		break;
+	}
+	return 0;
+}
+
+/* ROM directories are compared as given, after adding the trailing slash the synth expects */
+static MT32Emu::ROMImage *get_rom_image(char *dir)
+{
+	int i;
+
+	for (i = 0; i < num_rom_sets; i++)
+		if (strcmp(rom_sets[i].dir, dir) == 0)
+			return rom_sets[i].image;
+	rom_sets[num_rom_sets].dir = dir;
+	rom_sets[num_rom_sets].image = new MT32Emu::ROMImage();
+	return rom_sets[num_rom_sets++].image;
+}
+
+static output_t *get_output(const char *device)
+{
+	int i;
+
+	for (i = 0; i < num_outputs; i++)
+		if (strcmp(outputs[i].device, device) == 0)
+			return &outputs[i];
+	memset(&outputs[num_outputs], 0, sizeof(output_t));
+	outputs[num_outputs].device = device;
+	return &outputs[num_outputs++];
+}
+
+
+/* Instance options are of the form key=value[,key=value...]. A NULL spec gives the defaults */
+static int parse_instance(char *spec, instance_t *inst)
+{
+	char *option, *value, *save;
+	const char *rom_dir;
+
+	rom_dir = DEFAULT_ROM_PATH;
+	inst->device = NULL;
+	inst->reverb = 1;
+
+	option = spec != NULL ? strtok_r(spec, ",", &save) : NULL;
+	for (; option != NULL; option = strtok_r(NULL, ",", &save))
+	{
+		value = strchr(option, '=');
+		if (value == NULL)
+			return -1;
+		*value++ = 0;
+
+		if (strcmp(option, "rom") == 0)
+			rom_dir = value;
+		else if (strcmp(option, "device") == 0)
+			inst->device = value;
+		else if (strcmp(option, "reverb") == 0)
+			inst->reverb = strcmp(value, "off") != 0 && strcmp(value, "0") != 0;
+		else
+			return -1;
+	}
+
+	inst->rom_dir = (char *)malloc(strlen(rom_dir) + 2);
+	strcpy(inst->rom_dir, rom_dir);
+	if (inst->rom_dir[0] == 0 || inst->rom_dir[strlen(inst->rom_dir) - 1] != '/')
+		strcat(inst->rom_dir, "/");
+	return 0;
+}
+
+static int open_instance(instance_t *inst)
+{
+	MT32Emu::SynthProperties synthp;
+
+	memset(&synthp, 0, sizeof(synthp));
+	synthp.sampleRate = rate;
+	synthp.baseDir = inst->rom_dir;
+	synthp.userData = inst;
+	synthp.report = &report_callback;
+	synthp.romImage = get_rom_image(inst->rom_dir);
+
+	inst->synth = new MT32Emu::Synth();
+	if (!inst->synth->open(synthp))
+	{
+		fprintf(stderr, "[%d] Error opening the synth with ROMs from %s\n", inst->index, inst->rom_dir);
+		return -1;
+	}
+	inst->synth->setReverbEnabled(inst->reverb != 0);
+
+	if (event_ring_init(&inst->ring) < 0)
+		return -1;
+	return 0;
+}
+
+
+/* Plays the instance's events that are due within the cycle, each at the
+ * frame it is due at, and renders the cycle around them */
+static void render_instance(instance_t *inst, output_t *out, MT32Emu::Bit16s *buffer)
+{
+	midiev_t *ev;
+	long rendered, offset;
+	double age;
+
+	rendered = 0;
+	while ((ev = event_ring_peek(&inst->ring)) != NULL)
+	{
+		/* events are played exactly buffer_frames after they arrive */
+		age = (out->now.tv_sec - ev->stamp.tv_sec) + (out->now.tv_nsec - ev->stamp.tv_nsec) / 1e9;
+		offset = (long)out->buffer_frames - (long)out->delay - (long)(age * rate);
+		if (offset >= out->frames)
+			break;
+		if (offset > rendered)
+		{
+			inst->synth->render(buffer + rendered * 2, offset - rendered);
+			rendered = offset;
+		}
+
+		if (ev->type == EVENT_SYSEX)
+			inst->synth->playSysex((MT32Emu::Bit8u *)ev->sysex, ev->sysex_len);
+		else
+			inst->synth->playMsg(ev->msg);
+		event_ring_pop(&inst->ring);
+	}
+	if (rendered < out->frames)
+		inst->synth->render(buffer + rendered * 2, out->frames - rendered);
+}
+
+/* Hands the instances of a shared output to whichever of its threads is free,
+ * so no thread sits idle while another has more than one instance left */
+class InstanceBatch : public MT32Emu::SynthBatch
+{
+public:
+	InstanceBatch(output_t *useOut) : out(useOut) {}
+
+protected:
+	void renderSynth(unsigned int index, MT32Emu::Synth *, MT32Emu::Bit16s *stream, MT32Emu::Bit32u)
+	{
+		render_instance(out->instances[index], out, stream);
+	}
+
+private:
+	output_t *out;
+};
+
+static void *helper_thread(void *arg)
+{
+	output_t *out = (output_t *)arg;
+
+	attempt_realtime("helper", OUTPUT_RT_PRIORITY, -1);
+	while (1)
+	{
+		sem_wait(&out->start);
+		out->batch->work();
+		sem_post(&out->idle);
+	}
+	return NULL;
+}
+
+static void mix_instances(output_t *out)
+{
+	long i, n;
+	int j, sample;
+
+	n = out->frames * 2;
+	for (i = 0; i < n; i++)
+	{
+		sample = 0;
+		for (j = 0; j < out->num_instances; j++)
+			sample += out->instances[j]->buffer[i];
+		if (sample > 32767)
+			sample = 32767;
+		else if (sample < -32768)
+			sample = -32768;
+		out->buffer[i] = sample;
+	}
+}
+
+static int recover(output_t *out, int err)
+{
+	if (err == -EPIPE)
+	{
+		out->underruns++;
+		fprintf(stderr, "%s: underrun (%d so far)\n", out->device, out->underruns);
+	}
+	err = snd_pcm_recover(out->pcm, err, 1);
+	if (err < 0)
+		fprintf(stderr, "%s: cannot recover: %s\n", out->device, snd_strerror(err));
+	return err;
+}
+
+/* Keeps the whole buffer filled, so the latency is what the device gave us */
+static void *output_thread(void *arg)
+{
+	output_t *out = (output_t *)arg;
+	snd_pcm_sframes_t avail, written;
+	int i, err;
+
+	attempt_realtime("output", OUTPUT_RT_PRIORITY, -1);
+	while (1)
+	{
+		err = snd_pcm_wait(out->pcm, 1000);
+		if (err >= 0)
+			err = snd_pcm_avail_delay(out->pcm, &avail, &out->delay);
+		if (err < 0)
+		{
+			if (recover(out, err) < 0)
+				break;
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &out->now);
+
+		out->frames = (long)out->buffer_frames - out->delay;
+		if (out->frames > avail)
+			out->frames = avail;
+		if (out->frames <= 0)
+			continue;
+
+		if (out->num_instances == 1)
+			render_instance(out->instances[0], out, out->buffer);
+		else
+		{
+			out->batch->begin(out->synths, out->streams, out->num_instances, out->frames);
+			for (i = 0; i < out->num_helpers; i++)
+				sem_post(&out->start);
+			out->batch->finish();
+			/* a helper that woke up late may still be in work(), which must be over before the next begin() */
+			for (i = 0; i < out->num_helpers; i++)
+				sem_wait(&out->idle);
+			mix_instances(out);
+		}
+
+		written = snd_pcm_writei(out->pcm, out->buffer, out->frames);
+		if (written < 0 && recover(out, written) < 0)
+			break;
+	}
+	exit(1);
+	return NULL;
+}
+
+static int open_output(output_t *out)
+{
+	snd_pcm_uframes_t period_frames;
+	long cpus;
+	int i, err;
+
+	err = snd_pcm_open(&out->pcm, out->device, SND_PCM_STREAM_PLAYBACK, 0);
+	if (err >= 0)
+		err = snd_pcm_set_params(out->pcm, SND_PCM_FORMAT_S16_LE, SND_PCM_ACCESS_RW_INTERLEAVED,
+					 2, rate, 1, latency_msec * 1000);
+	if (err >= 0)
+		err = snd_pcm_get_params(out->pcm, &out->buffer_frames, &period_frames);
+	if (err < 0)
+	{
+		fprintf(stderr, "Error setting up PCM device %s: %s\n", out->device, snd_strerror(err));
+		return -1;
+	}
+	printf("%s: %d instance(s), %lu frames buffered (%lu ms)\n", out->device, out->num_instances,
+	       (unsigned long)out->buffer_frames, (unsigned long)out->buffer_frames * 1000 / rate);
+
+	out->buffer = new MT32Emu::Bit16s[out->buffer_frames * 2];
+	if (out->num_instances > 1)
+	{
+		for (i = 0; i < out->num_instances; i++)
+		{
+			out->instances[i]->buffer = new MT32Emu::Bit16s[out->buffer_frames * 2];
+			out->synths[i] = out->instances[i]->synth;
+			out->streams[i] = out->instances[i]->buffer;
+		}
+		out->batch = new InstanceBatch(out);
+
+		/* the output thread renders too, so more helpers than other CPUs would only get in each other's way */
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		out->num_helpers = out->num_instances - 1;
+		if (cpus > 0 && out->num_helpers > cpus - 1)
+			out->num_helpers = cpus - 1;
+		sem_init(&out->start, 0, 0);
+		sem_init(&out->idle, 0, 0);
+		for (i = 0; i < out->num_helpers; i++)
+			pthread_create(&out->helpers[i], NULL, helper_thread, out);
+	}
+	return 0;
+}
+
+
+static int open_sequencer()
+{
+	char name[32];
+	int i;
+
+	if (snd_seq_open(&seq_handle, "default", SND_SEQ_OPEN_DUPLEX, 0) < 0)
+	{
+		fprintf(stderr, "Error opening ALSA sequencer.\n");
+		return -1;
+	}
+	snd_seq_set_client_name(seq_handle, "MT-32 Multi");
+
+	for (i = 0; i < num_instances; i++)
+	{
+		sprintf(name, "MT-32 #%d", i + 1);
+		instances[i].port = snd_seq_create_simple_port(seq_handle, name,
+							       SND_SEQ_PORT_CAP_SUBS_WRITE |
+							       SND_SEQ_PORT_CAP_WRITE,
+							       SND_SEQ_PORT_TYPE_MIDI_MT32 |
+							       SND_SEQ_PORT_TYPE_SYNTH);
+		if (instances[i].port < 0 || instances[i].port > 255)
+		{
+			fprintf(stderr, "Error creating sequencer port.\n");
+			return -1;
+		}
+		port_instances[instances[i].port] = &instances[i];
+		printf("[%d] %s, ROMs from %s, reverb %s: ALSA address %d:%d\n", instances[i].index, instances[i].device,
+		       instances[i].rom_dir, instances[i].reverb ? "on" : "off", snd_seq_client_id(seq_handle), instances[i].port);
+	}
+	return 0;
+}
+
+/* Stamps each event on arrival and queues it for the instance owning the port */
+static void sequencer_loop()
+{
+	snd_seq_event_t *seq_ev;
+	snd_midi_event_t *decoder;
+	unsigned char msg[MAX_MSG_LEN];
+	midiev_t ev;
+	instance_t *inst;
+	long len;
+	int i, err;
+
+	snd_midi_event_new(MAX_MSG_LEN, &decoder);
+	snd_midi_event_no_status(decoder, 1);
+	attempt_realtime("sequencer", SEQ_RT_PRIORITY, -1);
+
+	/* -ENOSPC only means events were lost while we were busy */
+	while ((err = snd_seq_event_input(seq_handle, &seq_ev)) >= 0 || err == -ENOSPC)
+	{
+		if (err < 0 || seq_ev == NULL)
+			continue;
+		inst = port_instances[seq_ev->dest.port];
+		if (inst == NULL)
+			continue;
+
+		clock_gettime(CLOCK_MONOTONIC, &ev.stamp);
+		if (seq_ev->type == SND_SEQ_EVENT_SYSEX)
+		{
+			/* the data is copied into the event ring */
+			ev.type = EVENT_SYSEX;
+			ev.sysex = seq_ev->data.ext.ptr;
+			ev.sysex_len = seq_ev->data.ext.len;
+		} else {
+			/* anything that isn't a channel message decodes to nothing */
+			len = snd_midi_event_decode(decoder, msg, sizeof(msg), seq_ev);
+			if (len <= 0 || msg[0] < 0x80 || msg[0] >= 0xF0)
+				continue;
+			ev.type = EVENT_MIDI;
+			ev.msg = 0;
+			for (i = 0; i < len; i++)
+				ev.msg |= (unsigned int)msg[i] << (8 * i);
+		}
+		if (event_ring_push(&inst->ring, &ev) < 0)
+			fprintf(stderr, "[%d] Dropped a sysex message of %d bytes\n", inst->index, ev.sysex_len);
+	}
+	fprintf(stderr, "Sequencer input failed: %s\n", snd_strerror(err));
+	snd_midi_event_free(decoder);
+}
+
+
+void usage(char *argv[])
+{
+	printf("Usage: %s [options] \n", argv[0]);
+	printf("-n count     : Run count instances with the default settings\n");
+	printf("-i settings  : Add an instance, settings being comma-separated\n");
+	printf("               rom=dir (default %s)\n", DEFAULT_ROM_PATH);
+	printf("               device=pcm (default: the -d device)\n");
+	printf("               reverb=on|off (default on)\n");
+	printf("-d device    : Device to mix instances into unless they set their own\n");
+	printf("               (default %s)\n", DEFAULT_DEVICE);
+	printf("-s rate      : Sample rate (default 44100)\n");
+	printf("-l msec      : Latency (default %d)\n", DEFAULT_LATENCY_MSEC);
+	printf("\n");
+	printf("Instances sharing a device are mixed together, rendering on up to one thread per CPU.\n");
+	printf("Instances sharing a ROM directory share the decoded ROMs.\n");
+	printf("\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int i, j, count;
+	output_t *out;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (argv[i][0] != '-')
+			usage(argv);
+
+		switch(argv[i][1])
+		{
+		    case 'n': i++; if (i == argc) usage(argv);
+			count = atoi(argv[i]);
+			if (count < 1 || num_instances + count > MAX_INSTANCES)
+				usage(argv);
+			for (j = 0; j < count; j++)
+				parse_instance(NULL, &instances[num_instances++]);
+			break;
+		    case 'i': i++; if (i == argc) usage(argv);
+			if (num_instances == MAX_INSTANCES || parse_instance(argv[i], &instances[num_instances]) < 0)
+				usage(argv);
+			num_instances++;
+			break;
+		    case 'd': i++; if (i == argc) usage(argv);
+			default_device = argv[i];
+			break;
+		    case 's': i++; if (i == argc) usage(argv);
+			rate = atoi(argv[i]);
+			break;
+		    case 'l': i++; if (i == argc) usage(argv);
+			latency_msec = atoi(argv[i]);
+			break;
+
+		    default:
+			usage(argv);
+		}
+	}
+	if (num_instances == 0)
+		parse_instance(NULL, &instances[num_instances++]);
+
+	for (i = 0; i < num_instances; i++)
+	{
+		instances[i].index = i + 1;
+		if (instances[i].device == NULL)
+			instances[i].device = default_device;
+
+		if (open_instance(&instances[i]) < 0)
+			return 1;
+		out = get_output(instances[i].device);
+		out->instances[out->num_instances++] = &instances[i];
+		instances[i].output = out;
+	}
+	printf("%d instance(s) using %d set(s) of ROMs\n", num_instances, num_rom_sets);
+
+	warn_cpu_governors(-1);
+	lock_memory();
+
+	if (open_sequencer() < 0)
+		return 1;
+	for (i = 0; i < num_outputs; i++)
+	{
+		if (open_output(&outputs[i]) < 0)
+			return 1;
+	}
+	for (i = 0; i < num_outputs; i++)
+		pthread_create(&outputs[i].thread, NULL, output_thread, &outputs[i]);
+
+	sequencer_loop();
+	return 1;
+}
@@ -0,0 +1,146 @@
+/* Copyright (C) 2003 Tristan
+ * Copyright (C) 2004, 2005 Tristan, Jerome Fisher
+ * Copyright (C) 2008, 2011 Tristan, Jerome Fisher, Jörg Walter
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <malloc.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+
+#include "realtime.h"
+
+#define PREFAULT_STACK_SIZE  (256 * 1024)
+#define PREFAULT_HEAP_SIZE   (4 * 1024 * 1024)
+
+/* pins the calling thread to a CPU if one is given, and gives it the highest
+ * scheduling priority allowed, up to SCHED_FIFO at the given priority */
+void attempt_realtime(const char *thread_name, int priority, int cpu)
+{
+	struct sched_param param;
+	struct rlimit limit;
+	cpu_set_t cpus;
+	int status;
+	
+	if (cpu >= 0)
+	{
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		status = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+		if (status == 0)
+			printf("Pinned %s thread to CPU %d\n", thread_name, cpu);
+		else
+			fprintf(stderr, "Could not pin %s thread to CPU %d: %s\n", thread_name, cpu, strerror(status));
+	}
+	
+	/* anyone but root may only use SCHED_FIFO up to RLIMIT_RTPRIO */
+	if (geteuid() != 0 && getrlimit(RLIMIT_RTPRIO, &limit) == 0 &&
+	    limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < (rlim_t)priority)
+		priority = limit.rlim_cur;
+	
+	if (priority > 0)
+	{
+		param.sched_priority = priority;
+		status = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (status == 0)
+		{
+			printf("Set %s thread to SCHED_FIFO priority %d\n", thread_name, priority);
+			return;
+		}
+		fprintf(stderr, "Could not use SCHED_FIFO for %s thread: %s\n", thread_name, strerror(status));
+	} else
+		fprintf(stderr, "SCHED_FIFO not allowed for %s thread, raise RLIMIT_RTPRIO to use it\n", thread_name);
+	
+	status = nice(-20);	
+	if (status != -1)
+		printf("Set %s thread priority to -20\n", thread_name);
+	else
+		fprintf(stderr, "Could not raise %s thread priority either, expect underruns under load\n", thread_name);
+}
+
+/* Locks the process in memory and faults in some stack and heap, so that the
+ * audio thread doesn't stall on page faults once it is running */
+void lock_memory()
+{
+	static int locked = 0;
+	unsigned char stack[PREFAULT_STACK_SIZE];
+	unsigned char *heap;
+	long page, i;
+	
+	if (locked)
+		return;
+	locked = 1;
+	
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+		printf("Locked memory\n");
+	else
+		fprintf(stderr, "Could not lock memory: %s (RLIMIT_MEMLOCK may be too low)\n", strerror(errno));
+	
+	/* keep freed memory in the heap rather than handing it back to the system */
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+	
+	page = sysconf(_SC_PAGESIZE);
+	heap = (unsigned char *)malloc(PREFAULT_HEAP_SIZE);
+	if (heap != NULL)
+	{
+		for (i = 0; i < PREFAULT_HEAP_SIZE; i += page)
+			((volatile unsigned char *)heap)[i] = 0;
+		free(heap);
+	}
+	for (i = 0; i < PREFAULT_STACK_SIZE; i += page)
+		((volatile unsigned char *)stack)[i] = 0;
+}
+
+/* frequency scaling can leave rendering starved while the clock ramps up */
+void warn_cpu_governors(int only_cpu)
+{
+	char path[128], governor[32];
+	FILE *f;
+	int cpu, count, slow;
+	
+	count = sysconf(_SC_NPROCESSORS_CONF);
+	slow = 0;
+	for (cpu = 0; cpu < count; cpu++)
+	{
+		if (only_cpu >= 0 && cpu != only_cpu)
+			continue;
+		sprintf(path, "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", cpu);
+		f = fopen(path, "r");
+		if (f == NULL)
+			continue;
+		if (fgets(governor, sizeof(governor), f) != NULL)
+		{
+			governor[strcspn(governor, "\n")] = 0;
+			if (strcmp(governor, "performance") != 0)
+			{
+				if (slow == 0)
+					fprintf(stderr, "Warning: CPU %d uses the '%s' frequency scaling governor, "
+						"the 'performance' governor avoids underruns while the clock ramps up\n", cpu, governor);
+				slow++;
+			}
+		}
+		fclose(f);
+	}
+	if (slow > 1)
+		fprintf(stderr, "Warning: %d CPUs in all don't use the 'performance' governor\n", slow);
+}
@@ -0,0 +1,294 @@
+/* Copyright (C) 2003 Tristan
+ * Copyright (C) 2004, 2005 Tristan, Jerome Fisher
+ * Copyright (C) 2008, 2011 Tristan, Jerome Fisher, Jörg Walter
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "alsadrv.h"
+#include "eventring.h"
+#include "recorder.h"
+
+/* Records are a header followed by len bytes of data */
+typedef struct {
+	int type;
+	unsigned int len;
+	unsigned int rate;
+	FILE *file;
+} rec_record_t;
+
+#define REC_WAV_START   0
+#define REC_WAV_DATA    1
+#define REC_WAV_STOP    2
+#define REC_SYX_START   3
+#define REC_SYX_DATA    4
+#define REC_SYX_STOP    5
+
+/* audio is queued in pieces no larger than this, so little space is wasted at the end of the buffer */
+#define MAX_CHUNK          (16 * 1024)
+/* room data may not use, so that starting and stopping always get through */
+#define CONTROL_RESERVE    (4 * 1024)
+
+extern unsigned char wav_header[];
+
+static byte_ring_t ring;
+/* written by the audio thread only */
+static volatile unsigned int dropped_bytes = 0;
+
+static pthread_t writer_thread;
+static volatile int stopping = 0;
+static int running = 0;
+
+/* writer thread state */
+static FILE *wav_file = NULL;
+static unsigned int wav_rate = 0;
+static unsigned int wav_data_bytes = 0;
+static struct timespec header_written;
+static FILE *syx_file = NULL;
+static unsigned int reported_dropped = 0;
+
+
+static int push(int type, FILE *file, unsigned int rate, const void *data, unsigned int len, unsigned int reserve)
+{
+	rec_record_t *record;
+	
+	if (ring.data == NULL)
+		return -1;
+	record = (rec_record_t *)byte_ring_reserve(&ring, sizeof(rec_record_t) + len, reserve);
+	if (record == NULL)
+		return -1;
+	record->type = type;
+	record->len = len;
+	record->rate = rate;
+	record->file = file;
+	if (len > 0)
+		memcpy(record + 1, data, len);
+	byte_ring_commit(&ring);
+	return 0;
+}
+
+static void push_data(int type, const unsigned char *data, unsigned int len)
+{
+	unsigned int chunk;
+	
+	while (len > 0)
+	{
+		chunk = len < MAX_CHUNK ? len : MAX_CHUNK;
+		if (push(type, NULL, 0, data, chunk, CONTROL_RESERVE) < 0)
+		{
+			dropped_bytes = dropped_bytes + len;
+			return;
+		}
+		data += chunk;
+		len -= chunk;
+	}
+}
+
+static void push_control(int type, FILE *file, unsigned int rate)
+{
+	if (push(type, file, rate, NULL, 0, 0) < 0)
+		fprintf(stderr, "Recording queue is full, lost a recording %s\n",
+			(type == REC_WAV_START || type == REC_SYX_START) ? "start" : "stop");
+}
+
+void recorder_start_wav(FILE *f, unsigned int rate)
+{
+	push_control(REC_WAV_START, f, rate);
+}
+
+void recorder_stop_wav()
+{
+	push_control(REC_WAV_STOP, NULL, 0);
+}
+
+void recorder_write_wav(const MT32Emu::Bit16s *frames, unsigned int count)
+{
+	push_data(REC_WAV_DATA, (const unsigned char *)frames, count * 4);
+}
+
+void recorder_start_syx(FILE *f)
+{
+	push_control(REC_SYX_START, f, 0);
+}
+
+void recorder_stop_syx()
+{
+	push_control(REC_SYX_STOP, NULL, 0);
+}
+
+void recorder_write_syx(const unsigned char *data, unsigned int len)
+{
+	push_data(REC_SYX_DATA, data, len);
+}
+
+
+static inline void put_le32(unsigned char *p, unsigned int v)
+{
+	int i;
+	
+	for (i = 0; i < 4; i++)
+		p[i] = (v >> (8 * i)) & 0xFF;
+}
+
+/* rewrites the header at the start of the file and returns to the end */
+static void write_wav_header(FILE *f, unsigned int rate, unsigned int data_bytes)
+{
+	unsigned char header[44];
+	
+	// At position 4 is the length of the RIFF chunk and at 40 that of the data
+	// At positions 24 and 28 are the sample rate and bytes per second
+	memcpy(header, wav_header, 44);
+	put_le32(header + 4, 36 + data_bytes);
+	put_le32(header + 24, rate);
+	put_le32(header + 28, rate * 4);
+	put_le32(header + 40, data_bytes);
+	
+	fseek(f, 0, SEEK_SET);
+	fwrite(header, 1, 44, f);
+	fseek(f, 0, SEEK_END);
+	clock_gettime(CLOCK_MONOTONIC, &header_written);
+}
+
+static void close_wav()
+{
+	if (wav_file == NULL)
+		return;
+	write_wav_header(wav_file, wav_rate, wav_data_bytes);
+	fclose(wav_file);
+	wav_file = NULL;
+}
+
+static void close_syx()
+{
+	if (syx_file == NULL)
+		return;
+	fclose(syx_file);
+	syx_file = NULL;
+}
+
+static void handle_record(rec_record_t *record)
+{
+	switch (record->type)
+	{
+	    case REC_WAV_START:
+		close_wav();
+		wav_file = record->file;
+		wav_rate = record->rate;
+		wav_data_bytes = 0;
+		write_wav_header(wav_file, wav_rate, wav_data_bytes);
+		break;
+	    case REC_WAV_DATA:
+		if (wav_file != NULL)
+		{
+			fwrite(record + 1, 1, record->len, wav_file);
+			wav_data_bytes += record->len;
+		}
+		break;
+	    case REC_WAV_STOP:
+		close_wav();
+		break;
+		
+	    case REC_SYX_START:
+		close_syx();
+		syx_file = record->file;
+		break;
+	    case REC_SYX_DATA:
+		if (syx_file != NULL)
+			fwrite(record + 1, 1, record->len, syx_file);
+		break;
+	    case REC_SYX_STOP:
+		close_syx();
+		break;
+	}
+}
+
+static void drain()
+{
+	rec_record_t *record;
+	
+	while ((record = (rec_record_t *)byte_ring_peek(&ring)) != NULL)
+	{
+		handle_record(record);
+		byte_ring_pop(&ring);
+	}
+}
+
+static void *writer_loop(void *arg)
+{
+	struct timespec now, period;
+	unsigned int dropped;
+	int last;
+	
+	period.tv_sec = 0;
+	period.tv_nsec = RECORDER_PERIOD_MSEC * 1000000L;
+	do
+	{
+		/* after being told to stop, drain once more */
+		last = stopping;
+		MEMORY_BARRIER();
+		drain();
+		
+		if (wav_file != NULL)
+		{
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (now.tv_sec - header_written.tv_sec >= RECORDER_HEADER_SEC)
+				write_wav_header(wav_file, wav_rate, wav_data_bytes);
+			fflush(wav_file);
+		}
+		if (syx_file != NULL)
+			fflush(syx_file);
+		
+		dropped = dropped_bytes;
+		if (dropped != reported_dropped)
+		{
+			fprintf(stderr, "Recording fell behind, %u bytes were lost\n", dropped - reported_dropped);
+			reported_dropped = dropped;
+		}
+		
+		if (!last)
+			nanosleep(&period, NULL);
+	} while (!last);
+	
+	close_wav();
+	close_syx();
+	return NULL;
+}
+
+int recorder_init()
+{
+	if (byte_ring_init(&ring, RECORDER_RING_SIZE) < 0)
+		return -1;
+	
+	if (pthread_create(&writer_thread, NULL, writer_loop, NULL) != 0)
+		return -1;
+	running = 1;
+	atexit(recorder_shutdown);
+	return 0;
+}
+
+void recorder_shutdown()
+{
+	if (!running)
+		return;
+	running = 0;
+	stopping = 1;
+	pthread_join(writer_thread, NULL);
+}
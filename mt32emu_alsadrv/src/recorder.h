@@ -0,0 +1,52 @@
+/* Copyright (C) 2003 Tristan
+ * Copyright (C) 2004, 2005 Tristan, Jerome Fisher
+ * Copyright (C) 2008, 2011 Tristan, Jerome Fisher, Jörg Walter
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MT32_ALSA_RECORDER_H
+#define MT32_ALSA_RECORDER_H
+
+/* Writes the WAV and sysex recordings on a thread of its own, so that a slow
+ * disk can't hold up rendering.
+ *
+ * The audio thread only copies data into a ring buffer allocated up front; the
+ * writer thread wakes up every RECORDER_PERIOD_MSEC to write out whatever has
+ * arrived. If the writer falls so far behind that the ring fills up, data is
+ * dropped (and the loss reported) rather than making the audio thread wait.
+ * The WAV header is brought up to date every RECORDER_HEADER_SEC and when the
+ * file is closed.
+ *
+ * Files are handed over to the recorder when a recording starts, and closed by
+ * it once everything queued before the stop has been written. */
+
+#define RECORDER_RING_SIZE     (2 * 1024 * 1024)
+#define RECORDER_PERIOD_MSEC   50
+#define RECORDER_HEADER_SEC    2
+
+int recorder_init();
+/* writes out everything queued so far and closes the files */
+void recorder_shutdown();
+
+/* Audio thread side */
+void recorder_start_wav(FILE *f, unsigned int rate);
+void recorder_stop_wav();
+void recorder_write_wav(const MT32Emu::Bit16s *frames, unsigned int count);
+
+void recorder_start_syx(FILE *f);
+void recorder_stop_syx();
+void recorder_write_syx(const unsigned char *data, unsigned int len);
+
+#endif
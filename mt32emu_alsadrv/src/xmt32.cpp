@@ -271,6 +271,7 @@ int MT32Emu_Report(void *userData, MT32Emu::ReportType type, const void *reportD
 void report(int type, ...)
 {
 	char tmpstr[128], c;
+	drv_stats_t *stats;
 	va_list ap;
 	
 	va_start(ap, type);
@@ -322,9 +323,18 @@ void report(int type, ...)
 	case DRV_LATENCY:
 		lcd_msec = va_arg(ap, int); lcd_redraw();
 		break;
+		
+	case DRV_STATS:
+		stats = va_arg(ap, drv_stats_t *);
+		lcd_msec = stats->latency_msec;
+		lcd_load = stats->max_load;
+		lcd_underruns = stats->underruns;
+		lcd_redraw();
+		break;
 	
 	case DRV_WAVOUTPUT: lcd_flags[0] = (va_arg(ap, int)) ? 'W'|(1<<7) : 'W'; lcd_redraw(); break;
 	case DRV_PLAYING:   lcd_flags[1] = (va_arg(ap, int)) ? 'P'|(1<<7) : 'P'; lcd_redraw(); break;
+	case DRV_IDLE:      lcd_flags[1] = (va_arg(ap, int)) ? 'P' : 'P'|(1<<7); lcd_redraw(); break;
 	case DRV_SYXOUTPUT: lcd_flags[2] = (va_arg(ap, int)) ? 'X'|(1<<7) : 'X'; lcd_redraw(); break;
 		
 	case DRV_NEWWAV:
@@ -463,6 +473,11 @@ void usage(char *argv[])
 	printf("-a           : Automatic buffering mode (default)\n");
 	printf("-x msec      : Maximum buffer size in milliseconds\n");
 	printf("-i msec      : Minimum (initial) buffer size in milliseconds\n");
+	printf("-s rate      : Sample rate to ask the sound card for (default 44100)\n");
+	printf("-M           : Render directly into the sound card's buffer (mmap access)\n");
+	printf("-A cpu       : Run the audio thread on the given CPU only\n");
+	printf("-S cpu       : Run the MIDI sequencer thread on the given CPU only\n");
+	printf("-T filename  : Trace note latencies, written as a Chrome trace (JSON) on exit\n");
 	
 	printf("\n");
 	exit(1);
@@ -518,6 +533,19 @@ int main(int argc, char *argv[])
 		    case 'i': i++; if (i == argc) usage(argv);
 			minimum_msec = atoi(argv[i]);
 			break;
+		    case 's': i++; if (i == argc) usage(argv);
+			pcm_rate = atoi(argv[i]);
+			break;
+		    case 'M': pcm_access_mmap = 1; break;
+		    case 'A': i++; if (i == argc) usage(argv);
+			audio_cpu = atoi(argv[i]);
+			break;
+		    case 'S': i++; if (i == argc) usage(argv);
+			seq_cpu = atoi(argv[i]);
+			break;
+		    case 'T': i++; if (i == argc) usage(argv);
+			trace_filename = argv[i];
+			break;
 			
 		    default:
 			usage(argv);
@@ -38,6 +38,7 @@
 #include <string.h>
 #include <assert.h>
 #include <math.h>
+#include <sys/mman.h>
 #include <errno.h>
 #include "smf.h"
 #include "smf_private.h"
@@ -92,6 +93,12 @@ smf_delete(smf_t *smf)
 	assert(smf->number_of_tracks == 0);
 	g_ptr_array_free(smf->tracks_array, TRUE);
 	g_ptr_array_free(smf->tempo_array, TRUE);
+	free(smf->next_event_heap);
+
+	/* Events in the arena are gone by now, together with their tracks. */
+	free(smf->event_arena);
+	if (smf->mapped_file != NULL)
+		munmap(smf->mapped_file, smf->mapped_file_length);
 
 	memset(smf, 0, sizeof(smf_t));
 	free(smf);
@@ -156,6 +163,7 @@ smf_add_track(smf_t *smf, smf_track_t *track)
 
 	track->smf = smf;
 	g_ptr_array_add(smf->tracks_array, track);
+	smf->next_event_heap_valid = 0;
 
 	smf->number_of_tracks++;
 	track->track_number = smf->number_of_tracks;
@@ -179,6 +187,7 @@ smf_track_remove_from_smf(smf_track_t *track)
 	assert(track->smf != NULL);
 
 	track->smf->number_of_tracks--;
+	track->smf->next_event_heap_valid = 0;
 
 	assert(track->smf->tracks_array);
 	g_ptr_array_remove(track->smf->tracks_array, track);
@@ -360,11 +369,16 @@ smf_event_delete(smf_event_t *event)
 	if (event->track != NULL)
 		smf_event_remove_from_track(event);
 
-	if (event->midi_buffer != NULL) {
+	if (event->midi_buffer != NULL && !(event->storage_flags & SMF_EVENT_BORROWED_BUFFER)) {
 		memset(event->midi_buffer, 0, event->midi_buffer_length);
 		free(event->midi_buffer);
 	}
 
+	if (event->storage_flags & SMF_EVENT_IN_ARENA) {
+		memset(event, 0, sizeof(smf_event_t));
+		return;
+	}
+
 	memset(event, 0, sizeof(smf_event_t));
 	free(event);
 }
@@ -447,6 +461,7 @@ smf_track_add_event(smf_track_t *track, smf_event_t *event)
 
 	event->track = track;
 	event->track_number = track->track_number;
+	track->smf->next_event_heap_valid = 0;
 
 	if (track->number_of_events == 0) {
 		assert(track->next_event_number == -1);
@@ -584,6 +599,7 @@ smf_event_remove_from_track(smf_event_t *event)
 
 	track = event->track;
 	was_last = smf_event_is_last(event);
+	track->smf->next_event_heap_valid = 0;
 
 	/* Adjust ->delta_time_pulses of the next event. */
 	if (event->event_number < track->number_of_events) {
@@ -676,15 +692,11 @@ smf_set_ppqn(smf_t *smf, int ppqn)
 }
 
 /**
-  * Returns next event from the track given and advances next event counter.
-  * Do not depend on End Of Track event being the last event on the track - it
-  * is possible that the track will not end with EOT if you haven't added it
-  * yet.  EOTs are added automatically during smf_save().
-  *
+  * Advances next event counter of the track, without touching the smf's next event heap.
   * \return Event or NULL, if there are no more events left in this track.
   */
-smf_event_t *
-smf_track_get_next_event(smf_track_t *track)
+static smf_event_t *
+advance_track(smf_track_t *track)
 {
 	smf_event_t *event, *next_event;
 
@@ -713,6 +725,24 @@ smf_track_get_next_event(smf_track_t *track)
 	return (event);
 }
 
+/**
+  * Returns next event from the track given and advances next event counter.
+  * Do not depend on End Of Track event being the last event on the track - it
+  * is possible that the track will not end with EOT if you haven't added it
+  * yet.  EOTs are added automatically during smf_save().
+  *
+  * \return Event or NULL, if there are no more events left in this track.
+  */
+smf_event_t *
+smf_track_get_next_event(smf_track_t *track)
+{
+	/* Moving a single track behind smf's back means the heap has to be rebuilt. */
+	if (track->smf != NULL)
+		track->smf->next_event_heap_valid = 0;
+
+	return (advance_track(track));
+}
+
 /**
   * Returns next event from the track given.  Does not change next event counter,
   * so repeatedly calling this routine will return the same event.
@@ -794,17 +824,58 @@ smf_track_get_last_event(const smf_track_t *track)
 }
 
 /**
- * Searches for track that contains next event, in time order.  In other words,
- * returns the track that contains event that should be played next.
- * \return Track with next event or NULL, if there are no events left.
+ * \return Nonzero if track a should be played before track b.  Tracks with the
+ * same time of next event are played in track order.
  */
-smf_track_t *
-smf_find_track_with_next_event(smf_t *smf)
+static int
+track_precedes(const smf_track_t *a, const smf_track_t *b)
+{
+	if (a->time_of_next_event != b->time_of_next_event)
+		return (a->time_of_next_event < b->time_of_next_event);
+
+	return (a->track_number < b->track_number);
+}
+
+static void
+next_event_heap_sift_down(smf_t *smf, int i)
+{
+	smf_track_t **heap = smf->next_event_heap;
+	int length = smf->next_event_heap_length;
+	smf_track_t *track = heap[i];
+
+	for (;;) {
+		int child = i * 2 + 1;
+
+		if (child >= length)
+			break;
+
+		if (child + 1 < length && track_precedes(heap[child + 1], heap[child]))
+			child++;
+
+		if (!track_precedes(heap[child], track))
+			break;
+
+		heap[i] = heap[child];
+		i = child;
+	}
+
+	heap[i] = track;
+}
+
+/**
+ * Rebuilds the heap from the current position of every track.
+ */
+static void
+next_event_heap_rebuild(smf_t *smf)
 {
-	int i, min_time = 0;
-	smf_track_t *track = NULL, *min_time_track = NULL;
+	int i;
+	smf_track_t *track;
+
+	smf->next_event_heap = realloc(smf->next_event_heap, (smf->number_of_tracks + 1) * sizeof(smf_track_t *));
+	assert(smf->next_event_heap);
+
+	smf->next_event_heap_length = 0;
 
-	/* Find track with event that should be played next. */
 	for (i = 1; i <= smf->number_of_tracks; i++) {
 		track = smf_get_track_by_number(smf, i);
 
@@ -814,13 +885,30 @@ smf_find_track_with_next_event(smf_t *smf)
 		if (track->next_event_number == -1)
 			continue;
 
-		if (track->time_of_next_event < min_time || min_time_track == NULL) {
-			min_time = track->time_of_next_event;
-			min_time_track = track;
-		}
+		smf->next_event_heap[smf->next_event_heap_length++] = track;
 	}
 
-	return (min_time_track);
+	for (i = smf->next_event_heap_length / 2 - 1; i >= 0; i--)
+		next_event_heap_sift_down(smf, i);
+
+	smf->next_event_heap_valid = 1;
+}
+
+/**
+ * Searches for track that contains next event, in time order.  In other words,
+ * returns the track that contains event that should be played next.
+ * \return Track with next event or NULL, if there are no events left.
+ */
+smf_track_t *
+smf_find_track_with_next_event(smf_t *smf)
+{
+	if (!smf->next_event_heap_valid)
+		next_event_heap_rebuild(smf);
+
+	if (smf->next_event_heap_length == 0)
+		return (NULL);
+
+	return (smf->next_event_heap[0]);
 }
 
 /**
@@ -840,10 +928,19 @@ smf_get_next_event(smf_t *smf)
 		return (NULL);
 	}
 
-	event = smf_track_get_next_event(track);
+	event = advance_track(track);
 	
 	assert(event != NULL);
 
+	/* The track is at the top of the heap; move it down to its new position, or drop it if it's finished. */
+	if (track->next_event_number == -1) {
+		smf->next_event_heap_length--;
+		smf->next_event_heap[0] = smf->next_event_heap[smf->next_event_heap_length];
+	}
+
+	if (smf->next_event_heap_length > 0)
+		next_event_heap_sift_down(smf, 0);
+
 	event->track->smf->last_seek_position = -1.0;
 
 	return (event);
@@ -900,6 +997,7 @@ smf_rewind(smf_t *smf)
 	assert(smf);
 
 	smf->last_seek_position = 0.0;
+	smf->next_event_heap_valid = 0;
 
 	for (i = 1; i <= smf->number_of_tracks; i++) {
 		track = smf_get_track_by_number(smf, i);
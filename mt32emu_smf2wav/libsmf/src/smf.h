@@ -247,6 +247,22 @@ struct smf_struct {
 	GPtrArray	*tracks_array;
 	double		last_seek_position;
 
+	/** Private, used by smf.c.  Binary min-heap of the tracks that have events left,
+	    ordered by time_of_next_event (ties broken by track number).  Rebuilt lazily
+	    whenever next_event_heap_valid is cleared. */
+	struct smf_track_struct **next_event_heap;
+	int		next_event_heap_length;
+	int		next_event_heap_valid;
+
+	/** Private, used by smf_load_mapped().  The file stays mapped for as long as the smf lives,
+	    because sysex and metaevent buffers point straight into it.  All events read from the file
+	    are carved out of event_arena, in file order. */
+	void		*mapped_file;
+	size_t		mapped_file_length;
+	struct smf_event_struct *event_arena;
+	int		event_arena_length;
+	int		event_arena_used;
+
 	/** Private, used by smf_tempo.c. */
 	/** Array of pointers to smf_tempo_struct. */
 	GPtrArray	*tempo_array;
@@ -325,6 +341,12 @@ struct smf_event_struct {
 	/** Length of the MIDI message in the buffer, in bytes. */
 	int		midi_buffer_length; 
 
+	/** Private.  Combination of SMF_EVENT_* flags describing who owns the event and its buffer. */
+	int		storage_flags;
+
+	/** Private.  Holds short messages of events loaded by smf_load_mapped(); midi_buffer points here then. */
+	unsigned char	inline_buffer[4];
+
 	/** API consumer is free to use this for whatever purpose.  NULL in freshly allocated event.
 	    Note that events might be deallocated not only explicitly, by calling smf_event_delete(),
 	    but also implicitly, e.g. when calling smf_track_delete() with events still added to
@@ -399,6 +421,7 @@ char *smf_event_extract_text(const smf_event_t *event) WARN_UNUSED_RESULT;
 /* Routines for loading SMF files. */
 smf_t *smf_load(const char *file_name) WARN_UNUSED_RESULT;
 smf_t *smf_load_from_memory(const void *buffer, const int buffer_length) WARN_UNUSED_RESULT;
+smf_t *smf_load_mapped(const char *file_name) WARN_UNUSED_RESULT;
 
 /* Routine for writing SMF files. */
 int smf_save(smf_t *smf, const char *file_name) WARN_UNUSED_RESULT;
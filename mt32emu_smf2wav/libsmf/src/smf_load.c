@@ -40,6 +40,11 @@
 #include <math.h>
 #include <errno.h>
 #include <ctype.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "smf.h"
 #include "smf_private.h"
 
@@ -374,6 +379,57 @@ expected_message_length(unsigned char status, const unsigned char *second_byte,
 	}
 }
 
+/**
+ * Fills event->midi_buffer with "status" (unless it is negative) followed by "data_length" bytes from "data".
+ * Events loaded by smf_load_mapped() keep short messages in their inline buffer and otherwise point straight
+ * into the mapped file, writing the status byte over the byte preceding "data" if needed - that one is the last
+ * byte of the delta time or length VLQ, which has been interpreted already.  Other events get a private copy.
+ * Returns 0 iff everything went OK.
+ */
+static int
+set_midi_buffer(smf_event_t *event, int status, const unsigned char *data, int data_length)
+{
+	int length = status < 0 ? data_length : data_length + 1;
+	unsigned char *dst;
+
+	if (event->storage_flags & SMF_EVENT_IN_ARENA) {
+		if (length <= (int)sizeof(event->inline_buffer)) {
+			dst = event->inline_buffer;
+		} else {
+			unsigned char *view = (unsigned char *)data;
+
+			if (status >= 0) {
+				view--;
+				/* Don't dirty the page needlessly, the status byte is usually there already. */
+				if (*view != status)
+					*view = status;
+			}
+
+			event->midi_buffer = view;
+			event->midi_buffer_length = length;
+			event->storage_flags |= SMF_EVENT_BORROWED_BUFFER;
+
+			return (0);
+		}
+		event->storage_flags |= SMF_EVENT_BORROWED_BUFFER;
+	} else {
+		dst = malloc(length);
+		if (dst == NULL) {
+			g_critical("Cannot allocate memory for MIDI buffer: %s", strerror(errno));
+			return (-4);
+		}
+	}
+
+	event->midi_buffer = dst;
+	event->midi_buffer_length = length;
+
+	if (status >= 0)
+		*dst++ = status;
+	memcpy(dst, data, data_length);
+
+	return (0);
+}
+
 static int
 extract_sysex_event(const unsigned char *buf, const int buffer_length, smf_event_t *event, int *len, int last_status, int *has_unterminated_sysex)
 {
@@ -398,15 +454,8 @@ extract_sysex_event(const unsigned char *buf, const int buffer_length, smf_event
 		return (-5);
 	}
 
-	event->midi_buffer_length = message_length;
-	event->midi_buffer = malloc(event->midi_buffer_length);
-	if (event->midi_buffer == NULL) {
-		g_critical("Cannot allocate memory in extract_sysex_event(): %s", strerror(errno));
+	if (set_midi_buffer(event, status, c, message_length - 1))
 		return (-4);
-	}
-
-	event->midi_buffer[0] = status;
-	memcpy(event->midi_buffer + 1, c, message_length - 1);
 
 	*has_unterminated_sysex = event->midi_buffer[event->midi_buffer_length - 1] != 0xF7;
 
@@ -444,18 +493,11 @@ extract_escaped_event(const unsigned char *buf, const int buffer_length, smf_eve
 
 	/* If *has_unterminated_sysex is non-zero, we want to add the F7 status byte to the start of the message
 	   so that it can be identified as such. */
-	event->midi_buffer_length = *has_unterminated_sysex ? message_length + 1 : message_length;
-	event->midi_buffer = malloc(event->midi_buffer_length);
-	if (event->midi_buffer == NULL) {
-		g_critical("Cannot allocate memory in extract_escaped_event(): %s", strerror(errno));
+	if (set_midi_buffer(event, *has_unterminated_sysex ? 0xF7 : -1, c, message_length))
 		return (-4);
-	}
 	if (*has_unterminated_sysex) {
-		event->midi_buffer[0] = 0xF7;
-		memcpy(event->midi_buffer + 1, c, message_length);
 		*has_unterminated_sysex = c[message_length - 1] != 0xF7;
 	} else {
-		memcpy(event->midi_buffer, c, message_length);
 		if (smf_event_is_system_realtime(event) || smf_event_is_system_common(event)) {
 			g_warning("Escaped event is not System Realtime nor System Common.");
 		}
@@ -517,21 +559,38 @@ extract_midi_event(const unsigned char *buf, const int buffer_length, smf_event_
 		return (-5);
 	}
 
-	event->midi_buffer_length = message_length;
-	event->midi_buffer = malloc(event->midi_buffer_length);
-	if (event->midi_buffer == NULL) {
-		g_critical("Cannot allocate memory in extract_midi_event(): %s", strerror(errno));
+	if (set_midi_buffer(event, status, c, message_length - 1))
 		return (-4);
-	}
-
-	event->midi_buffer[0] = status;
-	memcpy(event->midi_buffer + 1, c, message_length - 1);
 
 	*len = c + message_length - 1 - buf;
 
 	return (0);
 }
 
+/**
+ * Returns a fresh event, taken from the event arena if the smf has one with room left.
+ */
+static smf_event_t *
+new_event(smf_t *smf)
+{
+	smf_event_t *event;
+
+	if (smf->event_arena == NULL || smf->event_arena_used >= smf->event_arena_length)
+		return (smf_event_new());
+
+	event = smf->event_arena + smf->event_arena_used++;
+
+	memset(event, 0, sizeof(smf_event_t));
+
+	event->delta_time_pulses = -1;
+	event->time_pulses = -1;
+	event->time_seconds = -1.0;
+	event->track_number = -1;
+	event->storage_flags = SMF_EVENT_IN_ARENA;
+
+	return (event);
+}
+
 /**
  * Locates, basing on track->next_event_offset, the next event data in track->buffer,
  * interprets it, allocates smf_event_t and fills it properly.  Returns smf_event_t
@@ -544,7 +603,7 @@ parse_next_event(smf_track_t *track)
 	int time = 0, len, buffer_length;
 	unsigned char *c, *start;
 
-	smf_event_t *event = smf_event_new();
+	smf_event_t *event = new_event(track->smf);
 	if (event == NULL)
 		goto error;
 
@@ -763,13 +822,18 @@ smf_event_is_valid(const smf_event_t *event)
  * Parse events and put it on the track.
  */
 static int
-parse_mtrk_chunk(smf_track_t *track)
+parse_mtrk_chunk(smf_track_t *track, int expected_number_of_events)
 {
 	smf_event_t *event;
 
 	if (parse_mtrk_header(track))
 		return (-1);
 
+	if (expected_number_of_events > 0) {
+		g_ptr_array_free(track->events_array, TRUE);
+		track->events_array = g_ptr_array_sized_new(expected_number_of_events);
+	}
+
 	for (;;) {
 		event = parse_next_event(track);
 
@@ -852,32 +916,23 @@ load_file_into_buffer(void **file_buffer, int *file_buffer_length, const char *f
 }
 
 /**
-  * Creates new SMF and fills it with data loaded from the given buffer.
- * \return SMF or NULL, if loading failed.
-  */
-smf_t *
-smf_load_from_memory(const void *buffer, const int buffer_length)
+ * Parses the MTrk chunks following MThd, adding a track to "smf" for each of them.  "event_counts", if not NULL,
+ * holds the number of events expected in each chunk.  Returns 0 iff everything went OK.
+ */
+static int
+parse_tracks(smf_t *smf, const int *event_counts)
 {
 	int i;
 
-	smf_t *smf = smf_new();
-
-	smf->file_buffer = (void *)buffer;
-	smf->file_buffer_length = buffer_length;
-	smf->next_chunk_offset = 0;
-
-	if (parse_mthd_chunk(smf))
-		return (NULL);
-
 	for (i = 1; i <= smf->expected_number_of_tracks; i++) {
 		smf_track_t *track = smf_track_new();
 		if (track == NULL)
-			return (NULL);
+			return (-1);
 
 		smf_add_track(smf, track);
 
 		/* Skip unparseable chunks. */
-		if (parse_mtrk_chunk(track)) {
+		if (parse_mtrk_chunk(track, event_counts != NULL ? event_counts[i - 1] : 0)) {
 			g_warning("SMF warning: Cannot load track.");
 			smf_track_delete(track);
 		}
@@ -898,6 +953,28 @@ smf_load_from_memory(const void *buffer, const int buffer_length)
 	smf->file_buffer_length = 0;
 	smf->next_chunk_offset = -1;
 
+	return (0);
+}
+
+/**
+  * Creates new SMF and fills it with data loaded from the given buffer.
+ * \return SMF or NULL, if loading failed.
+  */
+smf_t *
+smf_load_from_memory(const void *buffer, const int buffer_length)
+{
+	smf_t *smf = smf_new();
+
+	smf->file_buffer = (void *)buffer;
+	smf->file_buffer_length = buffer_length;
+	smf->next_chunk_offset = 0;
+
+	if (parse_mthd_chunk(smf))
+		return (NULL);
+
+	if (parse_tracks(smf, NULL))
+		return (NULL);
+
 	return (smf);
 }
 
@@ -930,3 +1007,184 @@ smf_load(const char *file_name)
 	return (smf);
 }
 
+
+/**
+ * Returns the number of events in the MTrk chunk body at "buf", without interpreting them.  Stops quietly at
+ * anything that doesn't look right; parse_next_event() is the one that complains.
+ */
+static int
+count_mtrk_events(const unsigned char *buf, const int buffer_length)
+{
+	const unsigned char *c = buf, *end = buf + buffer_length;
+	int number_of_events = 0, status = 0, length;
+
+	while (c < end) {
+		/* Delta time. */
+		while (c < end && (*c & 0x80))
+			c++;
+		if (++c >= end)
+			break;
+
+		if (is_status_byte(*c))
+			status = *c++;
+		else if (!is_status_byte(status))
+			break;
+
+		number_of_events++;
+
+		if (status == 0xF0 || status == 0xF7 || status == 0xFF) {
+			/* Skip metaevent type. */
+			if (status == 0xFF && c++ >= end)
+				break;
+
+			length = 0;
+			while (c < end && (*c & 0x80))
+				length = (length << 7) | (*c++ & 0x7F);
+			if (c >= end)
+				break;
+			length = (length << 7) | *c++;
+
+			if (length > end - c)
+				break;
+			c += length;
+		} else if (status < 0xF0) {
+			c += (status & 0xE0) == 0xC0 ? 1 : 2;
+		} else if (status == 0xF1 || status == 0xF3) {
+			c += 1;
+		} else if (status == 0xF2) {
+			c += 2;
+		}
+	}
+
+	return (number_of_events);
+}
+
+/**
+ * Walks the chunks following MThd, storing the number of events in each of them into "event_counts"
+ * and returning the total.
+ */
+static int
+count_events(const smf_t *smf, int *event_counts)
+{
+	const unsigned char *buffer = smf->file_buffer;
+	int i, offset = smf->next_chunk_offset, total = 0;
+
+	for (i = 0; i < smf->expected_number_of_tracks; i++) {
+		const struct chunk_header_struct *chunk;
+		int length;
+
+		event_counts[i] = 0;
+
+		if (offset + (int)sizeof(struct chunk_header_struct) > smf->file_buffer_length)
+			continue;
+
+		chunk = (const struct chunk_header_struct *)(buffer + offset);
+		offset += sizeof(struct chunk_header_struct);
+
+		length = g_ntohl(chunk->length);
+		if (length < 0 || length > smf->file_buffer_length - offset)
+			length = smf->file_buffer_length - offset;
+
+		if (chunk_signature_matches(chunk, "MTrk")) {
+			event_counts[i] = count_mtrk_events(buffer + offset, length);
+			total += event_counts[i];
+		}
+
+		offset += length;
+	}
+
+	return (total);
+}
+
+/**
+ * Loads SMF file without copying it.  The file is mapped into memory and stays mapped until smf_delete().
+ * All the events are stored in a single array, in file order; short messages are kept inside the events
+ * themselves and longer ones (sysexes and metaevents) point into the mapping.  Besides the mapping, the
+ * event array and the per-track event arrays, loading does no allocations, so this is much quicker and
+ * lighter than smf_load() for big files.
+ *
+ * The resulting smf can be used like any other, with one restriction: events belonging to it must not
+ * be used after smf_delete(), even if they were removed from their tracks.
+ *
+ * \param file_name Path to the file.
+ * \return SMF or NULL, if loading failed.
+ */
+smf_t *
+smf_load_mapped(const char *file_name)
+{
+	int fd, *event_counts;
+	struct stat st;
+	void *mapped_file;
+	smf_t *smf;
+
+	fd = open(file_name, O_RDONLY);
+	if (fd < 0) {
+		g_critical("Cannot open input file: %s", strerror(errno));
+		return (NULL);
+	}
+
+	if (fstat(fd, &st)) {
+		g_critical("fstat(2) failed: %s", strerror(errno));
+		close(fd);
+		return (NULL);
+	}
+
+	if (st.st_size < (off_t)sizeof(struct mthd_chunk_struct) || st.st_size > INT_MAX) {
+		g_critical("SMF error: file size %ld is out of range, it cannot be a MIDI file.", (long)st.st_size);
+		close(fd);
+		return (NULL);
+	}
+
+	/* Private and writable, so that sysex status bytes can be put right before their payloads. */
+	mapped_file = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapped_file == MAP_FAILED) {
+		g_critical("mmap(2) failed: %s", strerror(errno));
+		return (NULL);
+	}
+
+	smf = smf_new();
+	if (smf == NULL) {
+		munmap(mapped_file, st.st_size);
+		return (NULL);
+	}
+
+	smf->mapped_file = mapped_file;
+	smf->mapped_file_length = st.st_size;
+
+	smf->file_buffer = mapped_file;
+	smf->file_buffer_length = st.st_size;
+	smf->next_chunk_offset = 0;
+
+	if (parse_mthd_chunk(smf)) {
+		smf_delete(smf);
+		return (NULL);
+	}
+
+	event_counts = malloc(smf->expected_number_of_tracks * sizeof(int));
+	if (event_counts == NULL) {
+		g_critical("Cannot allocate memory in smf_load_mapped(): %s", strerror(errno));
+		smf_delete(smf);
+		return (NULL);
+	}
+
+	smf->event_arena_length = count_events(smf, event_counts);
+	if (smf->event_arena_length > 0) {
+		smf->event_arena = malloc(smf->event_arena_length * sizeof(smf_event_t));
+		/* Not fatal, events are then allocated one by one. */
+		if (smf->event_arena == NULL)
+			smf->event_arena_length = 0;
+	}
+
+	if (parse_tracks(smf, event_counts)) {
+		free(event_counts);
+		smf_delete(smf);
+		return (NULL);
+	}
+
+	free(event_counts);
+
+	smf_rewind(smf);
+
+	return (smf);
+}
@@ -67,6 +67,11 @@ struct mthd_chunk_struct {
 #pragma pack()
 #endif
 
+/** The smf_event_t itself lives in smf->event_arena and must not be freed. */
+#define SMF_EVENT_IN_ARENA		0x1
+/** midi_buffer points into inline_buffer or the mapped file and must not be freed. */
+#define SMF_EVENT_BORROWED_BUFFER	0x2
+
 void smf_track_add_event(smf_track_t *track, smf_event_t *event);
 void smf_init_tempo(smf_t *smf);
 void smf_fini_tempo(smf_t *smf);
@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2011 Jerome Fisher
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "commandStream.h"
+
+const char CommandStream::MAGIC[8] = {'M', 'T', '3', '2', 'C', 'M', 'D', 'S'};
+
+CommandStream::CommandStream() : mappedFile(NULL), mappedFileLength(0) {
+	clear();
+}
+
+CommandStream::~CommandStream() {
+	clear();
+}
+
+void CommandStream::clear() {
+	if (mappedFile != NULL) {
+		munmap(mappedFile, mappedFileLength);
+		mappedFile = NULL;
+		mappedFileLength = 0;
+	}
+	compiledCommands.clear();
+	compiledSysexData.clear();
+	sampleRate = 0;
+	commandCount = 0;
+	commands = NULL;
+	sysexData = NULL;
+	sysexDataLength = 0;
+}
+
+bool CommandStream::isCommandStreamFile(const char *fileName) {
+	FILE *file = fopen(fileName, "rb");
+	if (file == NULL) {
+		return false;
+	}
+	char magic[sizeof(MAGIC)];
+	bool matches = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+	fclose(file);
+	return matches;
+}
+
+bool CommandStream::compile(smf_t *smf, unsigned int newSampleRate, FILE *metadataFile) {
+	clear();
+	sampleRate = newSampleRate;
+
+	std::vector<MT32Emu::Bit8u> unterminatedSysex;
+	bool haveUnterminatedSysex = false;
+	unsigned long lastSampleOffset = 0;
+
+	smf_rewind(smf);
+	for (;;) {
+		smf_event_t *event = smf_get_next_event(smf);
+		if (event == NULL) {
+			break;
+		}
+
+		unsigned long sampleOffset = (unsigned long)(event->time_seconds * sampleRate);
+		if (sampleOffset < lastSampleOffset) {
+			fprintf(stderr, "Event went back in time!\n");
+			sampleOffset = lastSampleOffset;
+		}
+		if (sampleOffset > 0xFFFFFFFFUL) {
+			fprintf(stderr, "Song is too long at this sample rate - truncating\n");
+			break;
+		}
+		lastSampleOffset = sampleOffset;
+
+		Command command;
+		command.sampleOffset = (MT32Emu::Bit32u)sampleOffset;
+
+		if (smf_event_is_metadata(event)) {
+			if (metadataFile != NULL) {
+				char *decoded = smf_event_decode(event);
+				if (decoded) {
+					fprintf(metadataFile, "Metadata: %s\n", decoded);
+					free(decoded);
+				}
+			}
+			// Nothing to play, but rendering still has to reach it (End Of Track in particular sets the length)
+			command.message = 0;
+			command.sysexLength = 0;
+			compiledCommands.push_back(command);
+		} else if (smf_event_is_sysex(event) || smf_event_is_sysex_continuation(event)) {
+			bool unterminated = smf_event_is_unterminated_sysex(event);
+			bool addUnterminated = unterminated;
+			const MT32Emu::Bit8u *buf;
+			int len;
+			if (smf_event_is_sysex_continuation(event)) {
+				if (haveUnterminatedSysex) {
+					addUnterminated = true;
+				} else {
+					fprintf(stderr, "Sysex continuation received without preceding unterminated sysex - hoping for the best\n");
+				}
+				buf = event->midi_buffer + 1;
+				len = event->midi_buffer_length - 1;
+			} else {
+				if (haveUnterminatedSysex) {
+					fprintf(stderr, "New sysex received with an unterminated sysex pending - ignoring unterminated\n");
+					unterminatedSysex.clear();
+					haveUnterminatedSysex = false;
+				}
+				buf = event->midi_buffer;
+				len = event->midi_buffer_length;
+			}
+			if (addUnterminated) {
+				unterminatedSysex.insert(unterminatedSysex.end(), buf, buf + len);
+				haveUnterminatedSysex = true;
+				buf = &unterminatedSysex[0];
+				len = unterminatedSysex.size();
+			}
+			if (!unterminated) {
+				command.message = compiledSysexData.size();
+				command.sysexLength = len;
+				compiledSysexData.insert(compiledSysexData.end(), buf, buf + len);
+				compiledCommands.push_back(command);
+				if (addUnterminated) {
+					unterminatedSysex.clear();
+					haveUnterminatedSysex = false;
+				}
+			}
+		} else {
+			if (event->midi_buffer_length > 3) {
+				fprintf(stderr, "Got message with unusual length: %d\n", event->midi_buffer_length);
+				for (int i = 0; i < event->midi_buffer_length; i++) {
+					fprintf(stderr, " %02x", event->midi_buffer[i]);
+				}
+				fprintf(stderr, "\n");
+			} else {
+				command.message = 0;
+				for (int i = 0; i < event->midi_buffer_length; i++) {
+					command.message |= (event->midi_buffer[i] << (8 * i));
+				}
+				command.sysexLength = 0;
+				compiledCommands.push_back(command);
+			}
+		}
+	}
+
+	commandCount = compiledCommands.size();
+	commands = commandCount > 0 ? &compiledCommands[0] : NULL;
+	sysexDataLength = compiledSysexData.size();
+	sysexData = sysexDataLength > 0 ? &compiledSysexData[0] : NULL;
+	return true;
+}
+
+bool CommandStream::load(const char *fileName) {
+	clear();
+
+	int fd = open(fileName, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Error opening command stream file '%s' for reading.\n", fileName);
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Header)) {
+		fprintf(stderr, "Command stream file '%s' is truncated.\n", fileName);
+		close(fd);
+		return false;
+	}
+	void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		fprintf(stderr, "Error mapping command stream file '%s'.\n", fileName);
+		return false;
+	}
+	mappedFile = mapping;
+	mappedFileLength = st.st_size;
+
+	const Header *header = (const Header *)mappedFile;
+	if (memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0) {
+		fprintf(stderr, "File '%s' is not a command stream.\n", fileName);
+		clear();
+		return false;
+	}
+	if (header->byteOrderMark != BYTE_ORDER_MARK) {
+		fprintf(stderr, "Command stream file '%s' was written on a machine with a different byte order.\n", fileName);
+		clear();
+		return false;
+	}
+	if (header->version != VERSION) {
+		fprintf(stderr, "Command stream file '%s' has unsupported version %u.\n", fileName, (unsigned int)header->version);
+		clear();
+		return false;
+	}
+	unsigned long long expectedLength = sizeof(Header) + (unsigned long long)header->commandCount * sizeof(Command) + header->sysexDataLength;
+	if (expectedLength != (unsigned long long)mappedFileLength) {
+		fprintf(stderr, "Command stream file '%s' is %lu bytes long, expected %llu.\n", fileName, (unsigned long)mappedFileLength, expectedLength);
+		clear();
+		return false;
+	}
+
+	sampleRate = header->sampleRate;
+	commandCount = header->commandCount;
+	commands = (const Command *)(header + 1);
+	sysexDataLength = header->sysexDataLength;
+	sysexData = (const MT32Emu::Bit8u *)(commands + commandCount);
+
+	for (unsigned int i = 0; i < commandCount; i++) {
+		if (commands[i].sysexLength != 0 && (commands[i].message > sysexDataLength || commands[i].sysexLength > sysexDataLength - commands[i].message)) {
+			fprintf(stderr, "Command stream file '%s' is corrupt: sysex of command %u is out of bounds.\n", fileName, i);
+			clear();
+			return false;
+		}
+		if (i > 0 && commands[i].sampleOffset < commands[i - 1].sampleOffset) {
+			fprintf(stderr, "Command stream file '%s' is corrupt: command %u goes back in time.\n", fileName, i);
+			clear();
+			return false;
+		}
+	}
+	return true;
+}
+
+bool CommandStream::save(const char *fileName) const {
+	FILE *file = fopen(fileName, "wb");
+	if (file == NULL) {
+		fprintf(stderr, "Error opening file '%s' for writing.\n", fileName);
+		return false;
+	}
+	Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.byteOrderMark = BYTE_ORDER_MARK;
+	header.version = VERSION;
+	header.sampleRate = sampleRate;
+	header.commandCount = commandCount;
+	header.sysexDataLength = sysexDataLength;
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+		&& fwrite(commands, sizeof(Command), commandCount, file) == commandCount
+		&& fwrite(sysexData, 1, sysexDataLength, file) == sysexDataLength;
+	if (fclose(file) != 0) {
+		ok = false;
+	}
+	if (!ok) {
+		fprintf(stderr, "Error writing command stream to '%s'.\n", fileName);
+	}
+	return ok;
+}
+
+unsigned int CommandStream::getSampleRate() const {
+	return sampleRate;
+}
+
+unsigned int CommandStream::getCommandCount() const {
+	return commandCount;
+}
+
+const CommandStream::Command *CommandStream::getCommands() const {
+	return commands;
+}
+
+const MT32Emu::Bit8u *CommandStream::getSysex(const Command &command) const {
+	return sysexData + command.message;
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2011 Jerome Fisher
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SMF2WAV_COMMAND_STREAM_H
+#define SMF2WAV_COMMAND_STREAM_H
+
+#include <cstdio>
+#include <vector>
+
+#include <mt32emu/mt32emu.h>
+
+#include "smf.h"
+
+/**
+ * A song reduced to what the synth needs to play it at one particular sample rate: a flat list of commands
+ * sorted by the sample at which they're due, plus a blob holding the complete sysex messages they refer to.
+ * Metaevents are kept as no-op commands, so that the silence leading up to End Of Track still gets rendered.
+ *
+ * Streams are either compiled from a loaded SMF (tempo map applied, sysex continuations joined, metaevents
+ * reduced to no-ops) or mapped straight from a file written by save(). The file is just the header below followed by
+ * the commands and the sysex data, all in host byte order, so it can be used without any parsing.
+ */
+class CommandStream {
+public:
+	struct Command {
+		// Sample at which the command is due
+		MT32Emu::Bit32u sampleOffset;
+		// Packed short message as taken by Synth::playMsg(), or offset into the sysex data if sysexLength != 0.
+		// 0 with sysexLength 0 marks where a metaevent was: it only needs rendering up to.
+		MT32Emu::Bit32u message;
+		MT32Emu::Bit32u sysexLength;
+	};
+
+	CommandStream();
+	~CommandStream();
+
+	// Returns true if the file looks like one written by save(), without loading it
+	static bool isCommandStreamFile(const char *fileName);
+
+	// Metadata found in the SMF is printed to metadataFile unless it is NULL
+	bool compile(smf_t *smf, unsigned int sampleRate, FILE *metadataFile);
+	bool load(const char *fileName);
+	bool save(const char *fileName) const;
+
+	unsigned int getSampleRate() const;
+	unsigned int getCommandCount() const;
+	const Command *getCommands() const;
+	const MT32Emu::Bit8u *getSysex(const Command &command) const;
+
+private:
+	struct Header {
+		char magic[8];
+		// BYTE_ORDER_MARK as written by the host that saved the stream
+		MT32Emu::Bit32u byteOrderMark;
+		MT32Emu::Bit32u version;
+		MT32Emu::Bit32u sampleRate;
+		MT32Emu::Bit32u commandCount;
+		MT32Emu::Bit32u sysexDataLength;
+		MT32Emu::Bit32u reserved;
+	};
+
+	static const char MAGIC[8];
+	static const MT32Emu::Bit32u BYTE_ORDER_MARK = 0x01020304;
+	// Version 1 streams didn't keep metaevents, so they stop at the last event played rather than at End Of Track
+	static const MT32Emu::Bit32u VERSION = 2;
+
+	unsigned int sampleRate;
+	unsigned int commandCount;
+	const Command *commands;
+	const MT32Emu::Bit8u *sysexData;
+	unsigned int sysexDataLength;
+
+	// Backing storage for compiled streams
+	std::vector<Command> compiledCommands;
+	std::vector<MT32Emu::Bit8u> compiledSysexData;
+
+	// Backing storage for loaded streams
+	void *mappedFile;
+	size_t mappedFileLength;
+
+	CommandStream(const CommandStream &);
+	CommandStream &operator=(const CommandStream &);
+
+	void clear();
+};
+
+#endif
@@ -0,0 +1,789 @@
+/*
+ * Copyright (C) 2011 Jerome Fisher
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "flacEncoder.h"
+
+static const unsigned int BLOCK_SIZE = 4096;
+// Number of frames queued per worker thread before a batch is handed over for encoding
+static const unsigned int FRAMES_PER_THREAD = 8;
+
+// Limits within the FLAC "streamable subset", so any decoder can handle the output
+static const unsigned int MAX_FIXED_ORDER = 4;
+static const unsigned int MAX_LPC_ORDER = 12;
+static const unsigned int LPC_PRECISION = 14;
+static const int MAX_LPC_SHIFT = 15;
+static const unsigned int MAX_PARTITION_ORDER = 8;
+static const unsigned int MAX_RICE_PARAM = 14;
+
+static const unsigned int SUBFRAME_HEADER_BITS = 8;
+static const unsigned int RESIDUAL_HEADER_BITS = 2 + 4;
+static const unsigned int RICE_PARAM_BITS = 4;
+
+enum SubframeType {
+	SubframeType_CONSTANT,
+	SubframeType_VERBATIM,
+	SubframeType_FIXED,
+	SubframeType_LPC
+};
+
+enum ChannelAssignment {
+	ChannelAssignment_INDEPENDENT = 1,
+	ChannelAssignment_LEFT_SIDE = 8,
+	ChannelAssignment_RIGHT_SIDE = 9,
+	ChannelAssignment_MID_SIDE = 10
+};
+
+struct SubframePlan {
+	SubframeType type;
+	unsigned int order;
+	int qlpCoeffs[MAX_LPC_ORDER];
+	int qlpShift;
+	unsigned int partitionOrder;
+	unsigned int riceParams[1 << MAX_PARTITION_ORDER];
+	unsigned long long bits;
+	int residual[BLOCK_SIZE];
+};
+
+class BitWriter {
+public:
+	BitWriter(std::vector<unsigned char> &useOut) : out(useOut), acc(0), accBits(0) {
+	}
+
+	void writeBits(unsigned int value, unsigned int bits) {
+		if (bits == 0) {
+			return;
+		}
+		if (bits < 32) {
+			value &= (1U << bits) - 1;
+		}
+		acc = (acc << bits) | value;
+		accBits += bits;
+		while (accBits >= 8) {
+			accBits -= 8;
+			out.push_back((unsigned char)(acc >> accBits));
+		}
+		acc &= (1U << accBits) - 1;
+	}
+
+	void writeUnary(unsigned int zeros) {
+		while (zeros >= 31) {
+			writeBits(0, 31);
+			zeros -= 31;
+		}
+		writeBits(1, zeros + 1);
+	}
+
+	void writeRice(int value, unsigned int param) {
+		unsigned int folded = ((unsigned int)value << 1) ^ (unsigned int)(value >> 31);
+		writeUnary(folded >> param);
+		writeBits(folded, param);
+	}
+
+	void writeUTF8(unsigned int value) {
+		if (value < 0x80) {
+			writeBits(value, 8);
+			return;
+		}
+		unsigned int extraBytes;
+		if (value < 0x800) {
+			extraBytes = 1;
+		} else if (value < 0x10000) {
+			extraBytes = 2;
+		} else if (value < 0x200000) {
+			extraBytes = 3;
+		} else if (value < 0x4000000) {
+			extraBytes = 4;
+		} else {
+			extraBytes = 5;
+		}
+		unsigned int lead = (0xFF00 >> (extraBytes + 1)) & 0xFF;
+		writeBits(lead | (value >> (6 * extraBytes)), 8);
+		for (int i = extraBytes - 1; i >= 0; i--) {
+			writeBits(0x80 | ((value >> (6 * i)) & 0x3F), 8);
+		}
+	}
+
+	void alignToByte() {
+		if (accBits > 0) {
+			writeBits(0, 8 - accBits);
+		}
+	}
+
+private:
+	std::vector<unsigned char> &out;
+	unsigned long long acc;
+	unsigned int accBits;
+};
+
+static unsigned char crc8Table[256];
+static unsigned short crc16Table[256];
+
+static void initCRCTables() {
+	static bool initialised = false;
+	if (initialised) {
+		return;
+	}
+	for (unsigned int i = 0; i < 256; i++) {
+		unsigned int crc8 = i;
+		unsigned int crc16 = i << 8;
+		for (int bit = 0; bit < 8; bit++) {
+			crc8 = (crc8 & 0x80) ? ((crc8 << 1) ^ 0x07) : (crc8 << 1);
+			crc16 = (crc16 & 0x8000) ? ((crc16 << 1) ^ 0x8005) : (crc16 << 1);
+		}
+		crc8Table[i] = crc8 & 0xFF;
+		crc16Table[i] = crc16 & 0xFFFF;
+	}
+	initialised = true;
+}
+
+static unsigned char crc8(const unsigned char *data, size_t len) {
+	unsigned char crc = 0;
+	for (size_t i = 0; i < len; i++) {
+		crc = crc8Table[crc ^ data[i]];
+	}
+	return crc;
+}
+
+static unsigned short crc16(const unsigned char *data, size_t len) {
+	unsigned short crc = 0;
+	for (size_t i = 0; i < len; i++) {
+		crc = ((crc << 8) ^ crc16Table[(crc >> 8) ^ data[i]]) & 0xFFFF;
+	}
+	return crc;
+}
+
+static unsigned int foldResidual(int residual) {
+	return ((unsigned int)residual << 1) ^ (unsigned int)(residual >> 31);
+}
+
+static unsigned int estimateRiceParam(unsigned long long sum, unsigned int count) {
+	unsigned int param = 0;
+	while (param < MAX_RICE_PARAM && ((unsigned long long)count << (param + 1)) < sum) {
+		param++;
+	}
+	return param;
+}
+
+static unsigned long long estimateRiceBits(unsigned long long sum, unsigned int count, unsigned int param) {
+	return (unsigned long long)count * (param + 1) + (sum >> param);
+}
+
+/**
+ * Picks the partition order and Rice parameters for plan->residual, returning the estimated size of the residual section in bits.
+ * The first "order" entries of the residual are warm-up samples and aren't coded.
+ */
+static unsigned long long planResidual(SubframePlan *plan, unsigned int blockSize) {
+	unsigned int order = plan->order;
+	unsigned int maxPartitionOrder = 0;
+	while (maxPartitionOrder < MAX_PARTITION_ORDER && (blockSize & (1U << maxPartitionOrder)) == 0 && (blockSize >> (maxPartitionOrder + 1)) > order) {
+		maxPartitionOrder++;
+	}
+
+	unsigned long long sums[1 << MAX_PARTITION_ORDER];
+	unsigned int numPartitions = 1U << maxPartitionOrder;
+	unsigned int partitionSize = blockSize >> maxPartitionOrder;
+	for (unsigned int p = 0; p < numPartitions; p++) {
+		unsigned int start = p == 0 ? order : p * partitionSize;
+		unsigned int end = (p + 1) * partitionSize;
+		unsigned long long sum = 0;
+		for (unsigned int i = start; i < end; i++) {
+			sum += foldResidual(plan->residual[i]);
+		}
+		sums[p] = sum;
+	}
+
+	unsigned long long bestBits = 0;
+	for (int partitionOrder = maxPartitionOrder; partitionOrder >= 0; partitionOrder--) {
+		numPartitions = 1U << partitionOrder;
+		partitionSize = blockSize >> partitionOrder;
+		if (partitionOrder != (int)maxPartitionOrder) {
+			// Merge neighbouring partitions of the finer order
+			for (unsigned int p = 0; p < numPartitions; p++) {
+				sums[p] = sums[p * 2] + sums[p * 2 + 1];
+			}
+		}
+		unsigned long long bits = RESIDUAL_HEADER_BITS;
+		unsigned int params[1 << MAX_PARTITION_ORDER];
+		for (unsigned int p = 0; p < numPartitions; p++) {
+			unsigned int count = p == 0 ? partitionSize - order : partitionSize;
+			params[p] = estimateRiceParam(sums[p], count);
+			bits += RICE_PARAM_BITS + estimateRiceBits(sums[p], count, params[p]);
+		}
+		if (partitionOrder == (int)maxPartitionOrder || bits < bestBits) {
+			bestBits = bits;
+			plan->partitionOrder = partitionOrder;
+			memcpy(plan->riceParams, params, numPartitions * sizeof(params[0]));
+		}
+	}
+	return bestBits;
+}
+
+static void computeFixedResidual(const int *samples, unsigned int blockSize, unsigned int order, int *residual) {
+	for (unsigned int i = 0; i < order; i++) {
+		residual[i] = samples[i];
+	}
+	for (unsigned int i = order; i < blockSize; i++) {
+		switch (order) {
+		case 0:
+			residual[i] = samples[i];
+			break;
+		case 1:
+			residual[i] = samples[i] - samples[i - 1];
+			break;
+		case 2:
+			residual[i] = samples[i] - 2 * samples[i - 1] + samples[i - 2];
+			break;
+		case 3:
+			residual[i] = samples[i] - 3 * samples[i - 1] + 3 * samples[i - 2] - samples[i - 3];
+			break;
+		default:
+			residual[i] = samples[i] - 4 * samples[i - 1] + 6 * samples[i - 2] - 4 * samples[i - 3] + samples[i - 4];
+			break;
+		}
+	}
+}
+
+static bool computeLPCResidual(const int *samples, unsigned int blockSize, const SubframePlan *plan, int *residual) {
+	for (unsigned int i = 0; i < plan->order; i++) {
+		residual[i] = samples[i];
+	}
+	for (unsigned int i = plan->order; i < blockSize; i++) {
+		long long sum = 0;
+		for (unsigned int j = 0; j < plan->order; j++) {
+			sum += (long long)plan->qlpCoeffs[j] * samples[i - j - 1];
+		}
+		long long value = samples[i] - (sum >> plan->qlpShift);
+		if (value > (1 << 30) || value < -(1 << 30)) {
+			// Keep well within the 32-bit residual limit - another subframe type will do better anyway
+			return false;
+		}
+		residual[i] = (int)value;
+	}
+	return true;
+}
+
+// Levinson-Durbin recursion; lpcCoeffs[order - 1] receives the predictor coefficients for each order up to maxOrder.
+static unsigned int computeLPCCoefficients(const double *autoc, unsigned int maxOrder, double lpcCoeffs[MAX_LPC_ORDER][MAX_LPC_ORDER]) {
+	double lpc[MAX_LPC_ORDER];
+	double err = autoc[0];
+	for (unsigned int i = 0; i < maxOrder; i++) {
+		if (err <= 0.0) {
+			return i;
+		}
+		double r = -autoc[i + 1];
+		for (unsigned int j = 0; j < i; j++) {
+			r -= lpc[j] * autoc[i - j];
+		}
+		r /= err;
+		lpc[i] = r;
+		unsigned int j;
+		for (j = 0; j < (i >> 1); j++) {
+			double tmp = lpc[j];
+			lpc[j] += r * lpc[i - 1 - j];
+			lpc[i - 1 - j] += r * tmp;
+		}
+		if (i & 1) {
+			lpc[j] += lpc[j] * r;
+		}
+		err *= 1.0 - r * r;
+		for (j = 0; j <= i; j++) {
+			lpcCoeffs[i][j] = -lpc[j];
+		}
+	}
+	return maxOrder;
+}
+
+static bool quantizeLPCCoefficients(const double *lpcCoeffs, unsigned int order, SubframePlan *plan) {
+	double cmax = 0.0;
+	for (unsigned int i = 0; i < order; i++) {
+		double d = fabs(lpcCoeffs[i]);
+		if (d > cmax) {
+			cmax = d;
+		}
+	}
+	if (cmax <= 0.0) {
+		return false;
+	}
+	const int qmax = (1 << (LPC_PRECISION - 1)) - 1;
+	const int qmin = -(1 << (LPC_PRECISION - 1));
+	int log2cmax;
+	frexp(cmax, &log2cmax);
+	int shift = (int)LPC_PRECISION - log2cmax - 1;
+	if (shift > MAX_LPC_SHIFT) {
+		shift = MAX_LPC_SHIFT;
+	} else if (shift < 0) {
+		// Negative shifts aren't supported by decoders
+		return false;
+	}
+	double error = 0.0;
+	for (unsigned int i = 0; i < order; i++) {
+		// Carry the rounding error over to the next coefficient
+		error += lpcCoeffs[i] * (1 << shift);
+		long q = lround(error);
+		if (q > qmax) {
+			q = qmax;
+		} else if (q < qmin) {
+			q = qmin;
+		}
+		error -= q;
+		plan->qlpCoeffs[i] = (int)q;
+	}
+	plan->qlpShift = shift;
+	return true;
+}
+
+/**
+ * Chooses the cheapest subframe type for one channel of a block, leaving the winning plan in best.
+ * candidate is used as scratch space.
+ */
+static void planSubframe(const int *samples, unsigned int blockSize, unsigned int bitsPerSample, SubframePlan *&best, SubframePlan *&candidate) {
+	bool constant = true;
+	for (unsigned int i = 1; i < blockSize; i++) {
+		if (samples[i] != samples[0]) {
+			constant = false;
+			break;
+		}
+	}
+	if (constant) {
+		best->type = SubframeType_CONSTANT;
+		best->bits = SUBFRAME_HEADER_BITS + bitsPerSample;
+		return;
+	}
+
+	best->type = SubframeType_VERBATIM;
+	best->bits = SUBFRAME_HEADER_BITS + (unsigned long long)blockSize * bitsPerSample;
+
+	for (unsigned int order = 0; order <= MAX_FIXED_ORDER && order < blockSize; order++) {
+		candidate->type = SubframeType_FIXED;
+		candidate->order = order;
+		computeFixedResidual(samples, blockSize, order, candidate->residual);
+		candidate->bits = SUBFRAME_HEADER_BITS + order * bitsPerSample + planResidual(candidate, blockSize);
+		if (candidate->bits < best->bits) {
+			SubframePlan *tmp = best;
+			best = candidate;
+			candidate = tmp;
+		}
+	}
+
+	if (blockSize <= MAX_LPC_ORDER * 2) {
+		return;
+	}
+
+	// Tukey(0.5) window before autocorrelation
+	static const double TUKEY_P = 0.5;
+	double windowed[BLOCK_SIZE];
+	unsigned int taper = (unsigned int)(TUKEY_P / 2.0 * blockSize);
+	for (unsigned int i = 0; i < blockSize; i++) {
+		double w = 1.0;
+		if (i < taper) {
+			w = 0.5 - 0.5 * cos(M_PI * i / taper);
+		} else if (i >= blockSize - taper) {
+			w = 0.5 - 0.5 * cos(M_PI * (blockSize - 1 - i) / taper);
+		}
+		windowed[i] = samples[i] * w;
+	}
+	double autoc[MAX_LPC_ORDER + 1];
+	for (unsigned int lag = 0; lag <= MAX_LPC_ORDER; lag++) {
+		double sum = 0.0;
+		for (unsigned int i = lag; i < blockSize; i++) {
+			sum += windowed[i] * windowed[i - lag];
+		}
+		autoc[lag] = sum;
+	}
+	if (autoc[0] == 0.0) {
+		return;
+	}
+
+	double lpcCoeffs[MAX_LPC_ORDER][MAX_LPC_ORDER];
+	unsigned int maxOrder = computeLPCCoefficients(autoc, MAX_LPC_ORDER, lpcCoeffs);
+	for (unsigned int order = 2; order <= maxOrder; order += 2) {
+		candidate->type = SubframeType_LPC;
+		candidate->order = order;
+		if (!quantizeLPCCoefficients(lpcCoeffs[order - 1], order, candidate)) {
+			continue;
+		}
+		if (!computeLPCResidual(samples, blockSize, candidate, candidate->residual)) {
+			continue;
+		}
+		candidate->bits = SUBFRAME_HEADER_BITS + order * bitsPerSample + 4 + 5 + order * LPC_PRECISION + planResidual(candidate, blockSize);
+		if (candidate->bits < best->bits) {
+			SubframePlan *tmp = best;
+			best = candidate;
+			candidate = tmp;
+		}
+	}
+}
+
+static void writeSubframe(BitWriter &writer, const int *samples, unsigned int blockSize, unsigned int bitsPerSample, const SubframePlan *plan) {
+	switch (plan->type) {
+	case SubframeType_CONSTANT:
+		writer.writeBits(0x00, SUBFRAME_HEADER_BITS);
+		writer.writeBits(samples[0], bitsPerSample);
+		return;
+	case SubframeType_VERBATIM:
+		writer.writeBits(0x01 << 1, SUBFRAME_HEADER_BITS);
+		for (unsigned int i = 0; i < blockSize; i++) {
+			writer.writeBits(samples[i], bitsPerSample);
+		}
+		return;
+	case SubframeType_FIXED:
+		writer.writeBits((0x08 | plan->order) << 1, SUBFRAME_HEADER_BITS);
+		for (unsigned int i = 0; i < plan->order; i++) {
+			writer.writeBits(samples[i], bitsPerSample);
+		}
+		break;
+	case SubframeType_LPC:
+		writer.writeBits((0x20 | (plan->order - 1)) << 1, SUBFRAME_HEADER_BITS);
+		for (unsigned int i = 0; i < plan->order; i++) {
+			writer.writeBits(samples[i], bitsPerSample);
+		}
+		writer.writeBits(LPC_PRECISION - 1, 4);
+		writer.writeBits(plan->qlpShift, 5);
+		for (unsigned int i = 0; i < plan->order; i++) {
+			writer.writeBits(plan->qlpCoeffs[i], LPC_PRECISION);
+		}
+		break;
+	}
+
+	// Partitioned Rice residual, 4-bit parameters
+	writer.writeBits(0, 2);
+	writer.writeBits(plan->partitionOrder, 4);
+	unsigned int numPartitions = 1U << plan->partitionOrder;
+	unsigned int partitionSize = blockSize >> plan->partitionOrder;
+	for (unsigned int p = 0; p < numPartitions; p++) {
+		unsigned int param = plan->riceParams[p];
+		writer.writeBits(param, RICE_PARAM_BITS);
+		unsigned int start = p == 0 ? plan->order : p * partitionSize;
+		unsigned int end = (p + 1) * partitionSize;
+		for (unsigned int i = start; i < end; i++) {
+			writer.writeRice(plan->residual[i], param);
+		}
+	}
+}
+
+static unsigned int getSampleRateCode(unsigned int sampleRate) {
+	switch (sampleRate) {
+	case 8000:
+		return 4;
+	case 16000:
+		return 5;
+	case 22050:
+		return 6;
+	case 24000:
+		return 7;
+	case 32000:
+		return 8;
+	case 44100:
+		return 9;
+	case 48000:
+		return 10;
+	case 96000:
+		return 11;
+	}
+	if (sampleRate % 1000 == 0 && sampleRate / 1000 <= 255) {
+		return 12;
+	}
+	if (sampleRate <= 65535) {
+		return 13;
+	}
+	if (sampleRate % 10 == 0 && sampleRate / 10 <= 65535) {
+		return 14;
+	}
+	// Taken from STREAMINFO
+	return 0;
+}
+
+static void encodeFrame(FLACEncoder::Frame *frame, unsigned int sampleRate) {
+	unsigned int blockSize = frame->numSamples;
+	int *side = new int[BLOCK_SIZE * 2];
+	int *midSamples = side + BLOCK_SIZE;
+	for (unsigned int i = 0; i < blockSize; i++) {
+		side[i] = frame->left[i] - frame->right[i];
+		midSamples[i] = (frame->left[i] + frame->right[i]) >> 1;
+	}
+
+	// Plan each of the four possible channels, then pick the cheapest pairing
+	SubframePlan *plans = new SubframePlan[5];
+	SubframePlan *best[4] = {&plans[0], &plans[1], &plans[2], &plans[3]};
+	SubframePlan *scratch = &plans[4];
+	const int *channelSamples[4] = {frame->left, frame->right, side, midSamples};
+	const unsigned int channelBits[4] = {16, 16, 17, 16};
+	for (int c = 0; c < 4; c++) {
+		planSubframe(channelSamples[c], blockSize, channelBits[c], best[c], scratch);
+	}
+	enum {LEFT, RIGHT, SIDE, MID};
+	ChannelAssignment assignment = ChannelAssignment_INDEPENDENT;
+	unsigned long long bestBits = best[LEFT]->bits + best[RIGHT]->bits;
+	int first = LEFT, second = RIGHT;
+	if (best[LEFT]->bits + best[SIDE]->bits < bestBits) {
+		bestBits = best[LEFT]->bits + best[SIDE]->bits;
+		assignment = ChannelAssignment_LEFT_SIDE;
+		first = LEFT;
+		second = SIDE;
+	}
+	if (best[SIDE]->bits + best[RIGHT]->bits < bestBits) {
+		bestBits = best[SIDE]->bits + best[RIGHT]->bits;
+		assignment = ChannelAssignment_RIGHT_SIDE;
+		first = SIDE;
+		second = RIGHT;
+	}
+	if (best[MID]->bits + best[SIDE]->bits < bestBits) {
+		assignment = ChannelAssignment_MID_SIDE;
+		first = MID;
+		second = SIDE;
+	}
+
+	frame->data.clear();
+	frame->data.reserve(blockSize * 4 + 32);
+	BitWriter writer(frame->data);
+
+	// Frame header: sync code with fixed block size strategy
+	writer.writeBits(0xFFF8, 16);
+	unsigned int blockSizeCode = blockSize == BLOCK_SIZE ? 12 : 7;
+	unsigned int sampleRateCode = getSampleRateCode(sampleRate);
+	writer.writeBits(blockSizeCode, 4);
+	writer.writeBits(sampleRateCode, 4);
+	writer.writeBits(assignment, 4);
+	writer.writeBits(4, 3); // 16 bits per sample
+	writer.writeBits(0, 1);
+	writer.writeUTF8(frame->frameNumber);
+	if (blockSizeCode == 7) {
+		writer.writeBits(blockSize - 1, 16);
+	}
+	if (sampleRateCode == 12) {
+		writer.writeBits(sampleRate / 1000, 8);
+	} else if (sampleRateCode == 13) {
+		writer.writeBits(sampleRate, 16);
+	} else if (sampleRateCode == 14) {
+		writer.writeBits(sampleRate / 10, 16);
+	}
+	writer.writeBits(crc8(&frame->data[0], frame->data.size()), 8);
+
+	writeSubframe(writer, channelSamples[first], blockSize, channelBits[first], best[first]);
+	writeSubframe(writer, channelSamples[second], blockSize, channelBits[second], best[second]);
+	writer.alignToByte();
+	unsigned short crc = crc16(&frame->data[0], frame->data.size());
+	writer.writeBits(crc, 16);
+
+	delete[] plans;
+	delete[] side;
+}
+
+struct WorkerArgs {
+	std::vector<FLACEncoder::Frame *> *frames;
+	unsigned int usedFrames;
+	unsigned int firstFrame;
+	unsigned int stride;
+	unsigned int sampleRate;
+};
+
+static void *encodeWorker(void *arg) {
+	WorkerArgs *args = (WorkerArgs *)arg;
+	for (unsigned int i = args->firstFrame; i < args->usedFrames; i += args->stride) {
+		encodeFrame((*args->frames)[i], args->sampleRate);
+	}
+	delete args;
+	return NULL;
+}
+
+FLACEncoder::FLACEncoder(FILE *useDstFile, unsigned int useSampleRate, unsigned int useNumThreads) {
+	initCRCTables();
+	dstFile = useDstFile;
+	sampleRate = useSampleRate;
+	numThreads = useNumThreads < 1 ? 1 : useNumThreads;
+	seekable = false;
+	ok = true;
+	totalSamples = 0;
+	nextFrameNumber = 0;
+	minFrameSize = 0;
+	maxFrameSize = 0;
+	for (int b = 0; b < 2; b++) {
+		for (unsigned int i = 0; i < numThreads * FRAMES_PER_THREAD; i++) {
+			batches[b].frames.push_back(new Frame);
+		}
+		batches[b].usedFrames = 0;
+		batches[b].inFlight = false;
+	}
+	currentBatch = &batches[0];
+	currentFrame = currentBatch->frames[0];
+	currentFrame->numSamples = 0;
+}
+
+FLACEncoder::~FLACEncoder() {
+	for (int b = 0; b < 2; b++) {
+		if (batches[b].inFlight) {
+			completeBatch(&batches[b]);
+		}
+		for (unsigned int i = 0; i < batches[b].frames.size(); i++) {
+			delete batches[b].frames[i];
+		}
+	}
+}
+
+bool FLACEncoder::writeHeader() {
+	seekable = fseek(dstFile, 0, SEEK_CUR) == 0 && ftell(dstFile) == 0;
+	if (fwrite("fLaC", 1, 4, dstFile) != 4) {
+		return false;
+	}
+	return writeStreamInfo();
+}
+
+bool FLACEncoder::writeStreamInfo() {
+	std::vector<unsigned char> block;
+	BitWriter writer(block);
+	// Metadata block header: last block, type 0 (STREAMINFO), 34 bytes
+	writer.writeBits(0x80, 8);
+	writer.writeBits(34, 24);
+	writer.writeBits(BLOCK_SIZE, 16);
+	writer.writeBits(BLOCK_SIZE, 16);
+	// Zero means "unknown" for the frame sizes and total sample count
+	writer.writeBits(minFrameSize, 24);
+	writer.writeBits(maxFrameSize, 24);
+	writer.writeBits(sampleRate, 20);
+	writer.writeBits(2 - 1, 3);
+	writer.writeBits(16 - 1, 5);
+	writer.writeBits((unsigned int)(totalSamples >> 32) & 0xF, 4);
+	writer.writeBits((unsigned int)(totalSamples & 0xFFFFFFFF), 32);
+	// No MD5 signature (all zeroes is explicitly allowed)
+	for (int i = 0; i < 16; i++) {
+		writer.writeBits(0, 8);
+	}
+	return fwrite(&block[0], 1, block.size(), dstFile) == block.size();
+}
+
+bool FLACEncoder::encode(const short *samples, unsigned int numSamples) {
+	while (numSamples > 0) {
+		unsigned int space = BLOCK_SIZE - currentFrame->numSamples;
+		unsigned int count = numSamples < space ? numSamples : space;
+		int *left = currentFrame->left + currentFrame->numSamples;
+		int *right = currentFrame->right + currentFrame->numSamples;
+		for (unsigned int i = 0; i < count; i++) {
+			left[i] = samples[i * 2];
+			right[i] = samples[i * 2 + 1];
+		}
+		currentFrame->numSamples += count;
+		totalSamples += count;
+		samples += count * 2;
+		numSamples -= count;
+		if (currentFrame->numSamples == BLOCK_SIZE) {
+			nextFrame();
+		}
+	}
+	return ok;
+}
+
+void FLACEncoder::nextFrame() {
+	currentFrame->frameNumber = nextFrameNumber++;
+	currentBatch->usedFrames++;
+	if (currentBatch->usedFrames == currentBatch->frames.size()) {
+		// Hand the full batch over to the workers, and carry on filling the other one
+		Batch *otherBatch = currentBatch == &batches[0] ? &batches[1] : &batches[0];
+		if (otherBatch->inFlight && !completeBatch(otherBatch)) {
+			ok = false;
+		}
+		startBatch(currentBatch);
+		currentBatch = otherBatch;
+		currentBatch->usedFrames = 0;
+	}
+	currentFrame = currentBatch->frames[currentBatch->usedFrames];
+	currentFrame->numSamples = 0;
+}
+
+bool FLACEncoder::startBatch(Batch *batch) {
+	batch->inFlight = true;
+	batch->threads.clear();
+	unsigned int threadCount = numThreads < batch->usedFrames ? numThreads : batch->usedFrames;
+	if (threadCount <= 1) {
+		for (unsigned int i = 0; i < batch->usedFrames; i++) {
+			encodeFrame(batch->frames[i], sampleRate);
+		}
+		return true;
+	}
+	for (unsigned int t = 0; t < threadCount; t++) {
+		WorkerArgs *args = new WorkerArgs;
+		args->frames = &batch->frames;
+		args->usedFrames = batch->usedFrames;
+		args->firstFrame = t;
+		args->stride = threadCount;
+		args->sampleRate = sampleRate;
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, encodeWorker, args) == 0) {
+			batch->threads.push_back(thread);
+		} else {
+			// Couldn't start a thread - just do its share here
+			encodeWorker(args);
+		}
+	}
+	return true;
+}
+
+bool FLACEncoder::completeBatch(Batch *batch) {
+	for (unsigned int t = 0; t < batch->threads.size(); t++) {
+		pthread_join(batch->threads[t], NULL);
+	}
+	batch->threads.clear();
+	batch->inFlight = false;
+	for (unsigned int i = 0; i < batch->usedFrames; i++) {
+		const std::vector<unsigned char> &data = batch->frames[i]->data;
+		if (fwrite(&data[0], 1, data.size(), dstFile) != data.size()) {
+			return false;
+		}
+		unsigned int size = data.size();
+		if (minFrameSize == 0 || size < minFrameSize) {
+			minFrameSize = size;
+		}
+		if (size > maxFrameSize) {
+			maxFrameSize = size;
+		}
+	}
+	return true;
+}
+
+bool FLACEncoder::finish() {
+	if (currentFrame->numSamples > 0) {
+		currentFrame->frameNumber = nextFrameNumber++;
+		currentBatch->usedFrames++;
+	}
+	Batch *otherBatch = currentBatch == &batches[0] ? &batches[1] : &batches[0];
+	if (otherBatch->inFlight && !completeBatch(otherBatch)) {
+		ok = false;
+	}
+	if (currentBatch->usedFrames > 0) {
+		startBatch(currentBatch);
+		if (!completeBatch(currentBatch)) {
+			ok = false;
+		}
+		currentBatch->usedFrames = 0;
+	}
+	currentFrame = currentBatch->frames[0];
+	currentFrame->numSamples = 0;
+	if (ok && seekable) {
+		// Now that everything's known, fill in the real STREAMINFO
+		long endPos = ftell(dstFile);
+		if (endPos == -1 || fseek(dstFile, 4, SEEK_SET) != 0 || !writeStreamInfo() || fseek(dstFile, endPos, SEEK_SET) != 0) {
+			ok = false;
+		}
+	}
+	if (fflush(dstFile) != 0) {
+		ok = false;
+	}
+	return ok;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2011 Jerome Fisher
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SMF2WAV_FLAC_ENCODER_H
+#define SMF2WAV_FLAC_ENCODER_H
+
+#include <cstdio>
+#include <vector>
+
+#include <pthread.h>
+
+/**
+ * Encodes 16-bit stereo audio to a FLAC stream.
+ *
+ * Each block is coded independently with the cheapest of the constant, verbatim, fixed and LPC subframe types,
+ * picking the best of independent, left/side, right/side and mid/side stereo decorrelation. Residuals are
+ * Rice-coded with a searched partition order.
+ *
+ * Blocks are collected into batches which are encoded by a set of worker threads while the caller carries on
+ * producing samples. Frames are always written in order.
+ *
+ * If the output can be seeked, the STREAMINFO block is rewritten with the total sample count and frame sizes
+ * once encoding is finished; otherwise those are left as "unknown", which is valid for streamed FLAC.
+ */
+class FLACEncoder {
+public:
+	struct Frame {
+		unsigned int frameNumber;
+		unsigned int numSamples;
+		// Samples of both channels, deinterleaved
+		int left[4096];
+		int right[4096];
+		std::vector<unsigned char> data;
+	};
+
+	FLACEncoder(FILE *dstFile, unsigned int sampleRate, unsigned int numThreads);
+	~FLACEncoder();
+
+	// Writes the stream marker and STREAMINFO block. Must be called before encode().
+	bool writeHeader();
+	// Queues interleaved stereo samples for encoding.
+	bool encode(const short *samples, unsigned int numSamples);
+	// Encodes any remaining samples, waits for all frames to be written and finalises STREAMINFO where possible.
+	bool finish();
+
+private:
+	struct Batch {
+		std::vector<Frame *> frames;
+		unsigned int usedFrames;
+		bool inFlight;
+		std::vector<pthread_t> threads;
+	};
+
+	FILE *dstFile;
+	unsigned int sampleRate;
+	unsigned int numThreads;
+	bool seekable;
+	bool ok;
+
+	unsigned long long totalSamples;
+	unsigned int nextFrameNumber;
+	unsigned int minFrameSize;
+	unsigned int maxFrameSize;
+
+	Batch batches[2];
+	Batch *currentBatch;
+	Frame *currentFrame;
+
+	bool writeStreamInfo();
+	bool startBatch(Batch *batch);
+	bool completeBatch(Batch *batch);
+	void nextFrame();
+};
+
+#endif
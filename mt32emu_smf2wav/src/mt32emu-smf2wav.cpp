@@ -18,31 +18,60 @@
 
 #include <cassert>
 #include <climits>
+#include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
+#include <sys/stat.h>
 #include <unistd.h>
 #include <mt32emu/mt32emu.h>
 
 #include "config.h"
+#include "commandStream.h"
+#include "flacEncoder.h"
 #include "smf.h"
 
 static bool quiet = false;
+// Informational output goes to stderr instead when the rendered audio is being written to stdout
+static FILE *infoFile = stdout;
+
+enum OutputFormat {
+	OutputFormat_WAV,
+	OutputFormat_RAW,
+	OutputFormat_FLAC
+};
+
+struct Output {
+	FILE *file;
+	// Only used for OutputFormat_FLAC
+	FLACEncoder *flacEncoder;
+};
 
 static const int DEFAULT_BUFFER_SIZE = 512 * 1024;
 static const int DEFAULT_SAMPLE_RATE = 32000;
+// More encoder threads than this wouldn't have enough blocks in flight to keep them busy
+static const int MAX_ENCODER_THREADS = 64;
 
 static const int HEADEROFFS_RIFFLEN = 4;
 static const int HEADEROFFS_SAMPLERATE = 24;
 static const int HEADEROFFS_BYTERATE = 28;
 static const int HEADEROFFS_DATALEN = 40;
 
-static long secondsToSamples(double seconds, int sampleRate) {
-	return seconds * sampleRate;
+// Chunk length used when the output can't be seeked back to fill in the real sizes (pipes, FIFOs, stdout).
+// Most WAVE readers treat this as "read until end of stream".
+static const unsigned int STREAMING_CHUNK_LEN = 0xFFFFFFFF;
+
+static const char STDOUT_FILE_NAME[] = "-";
+
+static void setLittleEndian32(unsigned char *dst, unsigned int value) {
+	dst[0] = value & 0xFF;
+	dst[1] = (value >> 8) & 0xFF;
+	dst[2] = (value >> 16) & 0xFF;
+	dst[3] = (value >> 24) & 0xFF;
 }
 
-static bool writeWAVEHeader(FILE *dstFile, int sampleRate) {
+static bool writeWAVEHeader(FILE *dstFile, int sampleRate, bool streaming) {
 	int byteRate = sampleRate * 4;
 	// All values are little-endian
 	unsigned char waveHeader[] = {
@@ -64,14 +93,13 @@ static bool writeWAVEHeader(FILE *dstFile, int sampleRate) {
 		'd','a','t','a',
 		0x00, 0x00, 0x00, 0x00 // Chunk length, to be filled in later
 	};
-	waveHeader[HEADEROFFS_SAMPLERATE] = sampleRate & 0xFF;
-	waveHeader[HEADEROFFS_SAMPLERATE + 1] = (sampleRate >> 8) & 0xFF;
-	waveHeader[HEADEROFFS_SAMPLERATE + 2] = (sampleRate >> 16) & 0xFF;
-	waveHeader[HEADEROFFS_SAMPLERATE + 3] = (sampleRate >> 24) & 0xFF;
-	waveHeader[HEADEROFFS_BYTERATE] = byteRate & 0xFF;
-	waveHeader[HEADEROFFS_BYTERATE + 1] = (byteRate >> 8) & 0xFF;
-	waveHeader[HEADEROFFS_BYTERATE + 2] = (byteRate >> 16) & 0xFF;
-	waveHeader[HEADEROFFS_BYTERATE + 3] = (byteRate >> 24) & 0xFF;
+	setLittleEndian32(&waveHeader[HEADEROFFS_SAMPLERATE], sampleRate);
+	setLittleEndian32(&waveHeader[HEADEROFFS_BYTERATE], byteRate);
+	if (streaming) {
+		// The sizes can't be filled in later, so mark them as unknown up front
+		setLittleEndian32(&waveHeader[HEADEROFFS_RIFFLEN], STREAMING_CHUNK_LEN);
+		setLittleEndian32(&waveHeader[HEADEROFFS_DATALEN], STREAMING_CHUNK_LEN);
+	}
 	return fwrite(waveHeader, 1, sizeof(waveHeader), dstFile) == sizeof(waveHeader);
 }
 
@@ -102,6 +130,19 @@ static bool fillWAVESizes(FILE *dstFile, int numSamples) {
 	return true;
 }
 
+static void printDebug(void * /*userData*/, const char *fmt, va_list list) {
+	// The library would otherwise print to stdout, which may be carrying the rendered audio
+	if (!quiet) {
+		vfprintf(infoFile, fmt, list);
+		fprintf(infoFile, "\n");
+	}
+}
+
+static bool isSeekable(FILE *file) {
+	// Pipes, FIFOs and terminals fail to seek, even to the current position
+	return fseek(file, 0, SEEK_CUR) == 0 && ftell(file) != -1;
+}
+
 static long getFileLength(FILE *file) {
 	long oldPos = ftell(file);
 	if (oldPos == -1)
@@ -160,160 +201,136 @@ static bool playSysexFile(MT32Emu::Synth *synth, char *syxFileName) {
 	return ok;
 }
 
+static bool writeSamples(Output &output, const MT32Emu::Bit16s *samples, unsigned int numSamples) {
+	if (output.flacEncoder != NULL) {
+		return output.flacEncoder->encode(samples, numSamples);
+	}
+	// Samples are written as 16-bit little-endian regardless of host byte order
+	unsigned char byteBuffer[4096];
+	const unsigned int samplesPerChunk = sizeof(byteBuffer) / 4;
+	while (numSamples > 0) {
+		unsigned int chunkSamples = numSamples > samplesPerChunk ? samplesPerChunk : numSamples;
+		unsigned char *dst = byteBuffer;
+		for (unsigned int i = 0; i < chunkSamples * 2; i++) {
+			*dst++ = samples[i] & 0xFF;
+			*dst++ = (samples[i] >> 8) & 0xFF;
+		}
+		if (fwrite(byteBuffer, 4, chunkSamples, output.file) != chunkSamples) {
+			return false;
+		}
+		samples += chunkSamples * 2;
+		numSamples -= chunkSamples;
+	}
+	return true;
+}
+
 /**
  * Render numSamples samples to the buffer.
  * bufferSampleSize determines the maximum number of samples to be rendered by the emulator in one pass.
  * This can have a big impact on performance (more at a time=better).
  */
-static unsigned int render(MT32Emu::Synth *synth, MT32Emu::Bit16s sampleBuffer[], unsigned int bufferSampleSize, FILE *dstFile, unsigned int numSamples, bool &waitingForNoise) {
+static unsigned int render(MT32Emu::Synth *synth, MT32Emu::Bit16s sampleBuffer[], unsigned int bufferSampleSize, Output &output, unsigned int numSamples, bool &waitingForNoise) {
 	unsigned int skippedSamples = 0;
 	unsigned int renderedSamples = numSamples;
 	while (numSamples > 0) {
 		unsigned int renderedSamplesThisPass = numSamples > bufferSampleSize ? bufferSampleSize : numSamples;
 		synth->render(sampleBuffer, renderedSamplesThisPass);
-		for (unsigned int i = 0; i < renderedSamplesThisPass; i++) {
-			if (waitingForNoise) {
-				if (sampleBuffer[i] == 0 && sampleBuffer[i + 1] == 0) {
-					skippedSamples++;
-					continue;
-				}
-				waitingForNoise = false;
+		unsigned int firstSample = 0;
+		if (waitingForNoise) {
+			while (firstSample < renderedSamplesThisPass && sampleBuffer[firstSample * 2] == 0 && sampleBuffer[firstSample * 2 + 1] == 0) {
+				firstSample++;
 			}
-			fputc(sampleBuffer[i * 2] & 0xFF, dstFile);
-			fputc((sampleBuffer[i * 2] >> 8) & 0xFF, dstFile);
-			fputc(sampleBuffer[i * 2 + 1] & 0xFF, dstFile);
-			fputc((sampleBuffer[i * 2 + 1] >> 8) & 0xFF, dstFile);
+			skippedSamples += firstSample;
+			waitingForNoise = firstSample == renderedSamplesThisPass;
+		}
+		if (!writeSamples(output, sampleBuffer + firstSample * 2, renderedSamplesThisPass - firstSample)) {
+			// Most likely the reader at the other end of a pipe went away - there's no point carrying on
+			fprintf(stderr, "Error writing samples to output\n");
+			exit(1);
 		}
 		numSamples -= renderedSamplesThisPass;
 	}
 	return renderedSamples - skippedSamples;
 }
 
-static void processSMF(char *syxFileName, smf_t *smf, char *dstFileName, MT32Emu::SynthProperties &synthProperties, unsigned int bufferSize, unsigned int endAfter, bool renderUntilInactive, bool recordInitialSilence) {
+static void processCommandStream(char *syxFileName, const CommandStream &commandStream, char *dstFileName, OutputFormat outputFormat, unsigned int encoderThreads, MT32Emu::SynthProperties &synthProperties, unsigned int bufferSize, unsigned int endAfter, bool renderUntilInactive, bool recordInitialSilence) {
 	MT32Emu::Synth *synth = new MT32Emu::Synth();
 	MT32Emu::Bit16s *sampleBuffer = NULL;
 	FILE *dstFile;
+	bool toStdout = strcmp(dstFileName, STDOUT_FILE_NAME) == 0;
 	bool waitingForNoise = !recordInitialSilence;
 	if (synth->open(synthProperties)) {
 		if (syxFileName != NULL) {
 			playSysexFile(synth, syxFileName);
 		}
 
-		dstFile = fopen(dstFileName, "wb");
+		dstFile = toStdout ? stdout : fopen(dstFileName, "wb");
 		if (dstFile != NULL) {
-			if (writeWAVEHeader(dstFile, synthProperties.sampleRate)) {
-				int unterminatedSysexLen = 0;
-				unsigned char *unterminatedSysex = NULL;
+			bool seekable = isSeekable(dstFile);
+			Output output = {dstFile, NULL};
+			bool headerOK;
+			if (outputFormat == OutputFormat_FLAC) {
+				output.flacEncoder = new FLACEncoder(dstFile, synthProperties.sampleRate, encoderThreads);
+				headerOK = output.flacEncoder->writeHeader();
+			} else if (outputFormat == OutputFormat_RAW) {
+				headerOK = true;
+			} else {
+				headerOK = writeWAVEHeader(dstFile, synthProperties.sampleRate, !seekable);
+			}
+			if (headerOK) {
 				unsigned long renderedSamples = 0;
 				unsigned long writtenSamples = 0;
-				for (;;) {
-					smf_event_t *event = smf_get_next_event(smf);
-					unsigned long eventSampleIx;
-
-					if (event == NULL) {
-						break;
+				const CommandStream::Command *commands = commandStream.getCommands();
+				unsigned int commandCount = commandStream.getCommandCount();
+				if (commandCount > 0) {
+					sampleBuffer = new MT32Emu::Bit16s[bufferSize / 2];
+				}
+				for (unsigned int i = 0; i < commandCount; i++) {
+					const CommandStream::Command &command = commands[i];
+					unsigned long eventSampleIx = command.sampleOffset;
+					if (eventSampleIx > endAfter) {
+						eventSampleIx = endAfter;
 					}
-
-					assert(event->track->track_number >= 0);
-
-					eventSampleIx = secondsToSamples(event->time_seconds, synthProperties.sampleRate);
 					if (eventSampleIx < renderedSamples) {
 						fprintf(stderr, "Event went back in time!\n");
 					} else {
-						if (sampleBuffer == NULL) {
-							sampleBuffer = new MT32Emu::Bit16s[bufferSize / 2];
-						}
-						if (eventSampleIx > endAfter) {
-							eventSampleIx = endAfter;
-						}
 						unsigned int renderLength = eventSampleIx - renderedSamples;
-						writtenSamples += render(synth, sampleBuffer, bufferSize / 4, dstFile, renderLength, waitingForNoise);
+						writtenSamples += render(synth, sampleBuffer, bufferSize / 4, output, renderLength, waitingForNoise);
 						renderedSamples += renderLength;
-						if (eventSampleIx == endAfter) {
-							break;
-						}
+					}
+					if (eventSampleIx == endAfter) {
+						break;
 					}
 
-					if (smf_event_is_metadata(event)) {
-						char *decoded = smf_event_decode(event);
-						if (decoded && !quiet)
-							fprintf(stdout, "Metadata: %s\n", decoded);
-					} else if (smf_event_is_sysex(event) || smf_event_is_sysex_continuation(event))  {
-						bool unterminated = smf_event_is_unterminated_sysex(event);
-						bool addUnterminated = unterminated;
-						bool continuation = smf_event_is_sysex_continuation(event);
-						unsigned char *buf;
-						int len;
-						if (continuation) {
-							if (unterminatedSysex != NULL) {
-								addUnterminated = true;
-							} else {
-								fprintf(stderr, "Sysex continuation received without preceding unterminated sysex - hoping for the best\n");
-							}
-							buf = event->midi_buffer + 1;
-							len = event->midi_buffer_length - 1;
-						} else {
-							if (unterminatedSysex != NULL) {
-								fprintf(stderr, "New sysex received with an unterminated sysex pending - ignoring unterminated\n");
-								delete[] unterminatedSysex;
-								unterminatedSysex = NULL;
-								unterminatedSysexLen = 0;
-							}
-							buf = event->midi_buffer;
-							len = event->midi_buffer_length;
-						}
-						if (addUnterminated) {
-							unsigned char *newUnterminatedSysex = new unsigned char[unterminatedSysexLen + len];
-							if(unterminatedSysex != NULL) {
-								memcpy(newUnterminatedSysex, unterminatedSysex, unterminatedSysexLen);
-								delete[] unterminatedSysex;
-							}
-							memcpy(newUnterminatedSysex + unterminatedSysexLen, buf, len);
-							unterminatedSysex = newUnterminatedSysex;
-							unterminatedSysexLen += len;
-							buf = unterminatedSysex;
-							len = unterminatedSysexLen;
-						}
-						if (!unterminated) {
-							synth->playSysex(buf, len);
-							if (addUnterminated) {
-								delete[] unterminatedSysex;
-								unterminatedSysex = NULL;
-								unterminatedSysexLen = 0;
-							}
-						}
-					} else {
-						if (event->midi_buffer_length > 3) {
-							fprintf(stderr, "Got message with unusual length: %d\n", event->midi_buffer_length);
-							for (int i = 0; i < event->midi_buffer_length; i++) {
-								fprintf(stderr, " %02x", event->midi_buffer[i]);
-							}
-							fprintf(stderr, "\n");
-						} else {
-							MT32Emu::Bit32u msg = 0;
-							for (int i = 0; i < event->midi_buffer_length; i++) {
-								msg |= (event->midi_buffer[i] << (8 * i));
-							}
-							synth->playMsg(msg);
-						}
+					if (command.sysexLength != 0) {
+						synth->playSysex(commandStream.getSysex(command), command.sysexLength);
+					} else if (command.message != 0) {
+						synth->playMsg(command.message);
 					}
 				}
 				if (renderUntilInactive) {
 					while (renderedSamples < endAfter && synth->isActive()) {
 						// FIXME: Very inefficient, perhaps we should add a renderWhileActive() to Synth.
 						MT32Emu::Bit16s tmpBuffer[2];
-						writtenSamples += render(synth, tmpBuffer, 1, dstFile, 1, waitingForNoise);
+						writtenSamples += render(synth, tmpBuffer, 1, output, 1, waitingForNoise);
 						renderedSamples++;
 					}
 				}
-				delete[] unterminatedSysex;
-				if (!fillWAVESizes(dstFile, writtenSamples)) {
+				if (outputFormat == OutputFormat_WAV && seekable && !fillWAVESizes(dstFile, writtenSamples)) {
 					fprintf(stderr, "Error writing final sizes to WAVE header\n");
 				}
+				if (output.flacEncoder != NULL && !output.flacEncoder->finish()) {
+					fprintf(stderr, "Error finishing FLAC stream\n");
+				}
 			} else {
-				fprintf(stderr, "Error writing WAVE header to '%s'\n", dstFileName);
+				fprintf(stderr, "Error writing header to '%s'\n", dstFileName);
+			}
+			delete output.flacEncoder;
+			if (toStdout) {
+				fflush(dstFile);
+			} else {
+				fclose(dstFile);
 			}
-			fclose(dstFile);
 		} else {
 			fprintf(stderr, "Error opening file '%s' for writing.\n", dstFileName);
 		}
@@ -330,34 +347,47 @@ static void printVersion(void) {
 
 static void printUsage(char *cmd) {
 	printVersion();
-	fprintf(stdout, "\nusage: %s [arguments] <SMF MIDI file>\n\n", cmd);
+	fprintf(stdout, "\nusage: %s [arguments] <SMF MIDI file or command stream>\n\n", cmd);
 	fprintf(stdout, "Arguments:\n");
 	fprintf(stdout, " -a              Record silent samples at the start of the render\n");
 	fprintf(stdout, " -b              Buffer size (in bytes) (minimum: 4, default: %d)\n", DEFAULT_BUFFER_SIZE);
+	fprintf(stdout, " -c <filename>   Compile the SMF file into a command stream for the sample rate and write it to this file, instead of rendering\n");
 	fprintf(stdout, " -e              End after rendering at most this many samples. 0=unlimited (default: 0)\n");
 	fprintf(stdout, " -f              Force overwrite of output file if already present\n");
+	fprintf(stdout, " -F              Write FLAC (also selected by an output file name ending in \".flac\")\n");
 	fprintf(stdout, " -h              Show this help and exit\n");
-	fprintf(stdout, " -o <filename>   Output file (default: source file name with \".wav\" appended)\n");
+	fprintf(stdout, " -j <threads>    Number of FLAC encoder threads (default: number of online CPUs)\n");
+	fprintf(stdout, " -o <filename>   Output file, or \"-\" for stdout (default: source file name with \".wav\", \".raw\" or \".flac\" appended)\n");
+	fprintf(stdout, " -p              Write raw 16-bit little-endian stereo PCM with no header\n");
 	fprintf(stdout, " -q              Be quiet\n");
 	fprintf(stdout, " -r <samplerate> Set the sample rate (in Hz) (default: %d)\n", DEFAULT_SAMPLE_RATE);
 	fprintf(stdout, " -s <filename>   Sysex file to play before the SMF file\n");
-	fprintf(stdout, " -t              Don't render until the synth becomes inactive - stop once the SMF has ended");
+	fprintf(stdout, " -t              Don't render until the synth becomes inactive - stop once the SMF has ended\n");
+	fprintf(stdout, "\nWhen the output can't be seeked (stdout, pipes, FIFOs), WAVE headers are written with unknown (0xFFFFFFFF) sizes.\n");
+	fprintf(stdout, "A command stream written with -c can be rendered repeatedly without parsing the SMF file again, but only at the sample rate it was compiled for.\n");
 }
 
 int main(int argc, char *argv[]) {
 	bool force = false;
 	int ch;
 	int rc = 0;
-	char *syxFileName = NULL, *dstFileNameArg = NULL;
+	char *syxFileName = NULL, *dstFileNameArg = NULL, *compileFileName = NULL;
 	smf_t *smf = NULL;
+	CommandStream commandStream;
+	bool loaded;
 	char *cmd = argv[0];
 	unsigned int bufferSize = DEFAULT_BUFFER_SIZE;
 	unsigned int sampleRate = DEFAULT_SAMPLE_RATE;
+	bool sampleRateGiven = false;
 	unsigned int endAfter = UINT_MAX;
 	bool renderUntilInactive = true;
 	bool recordInitialSilence = false;
+	OutputFormat outputFormat = OutputFormat_WAV;
+	bool outputFormatGiven = false;
+	long onlineCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int encoderThreads = onlineCPUs < 1 ? 1 : onlineCPUs > MAX_ENCODER_THREADS ? MAX_ENCODER_THREADS : onlineCPUs;
 
-	while ((ch = getopt(argc, argv, "ab:e:fho:qr:s:t")) != -1) {
+	while ((ch = getopt(argc, argv, "ab:c:e:fFhj:o:pqr:s:t")) != -1) {
 		switch (ch) {
 		case 'a':
 			recordInitialSilence = true;
@@ -369,6 +399,9 @@ int main(int argc, char *argv[]) {
 				return 0;
 			}
 			break;
+		case 'c':
+			compileFileName = optarg;
+			break;
 		case 'e':
 			endAfter = atoi(optarg);
 			if (endAfter == 0) {
@@ -378,14 +411,34 @@ int main(int argc, char *argv[]) {
 		case 'f':
 			force = true;
 			break;
+		case 'F':
+			outputFormat = OutputFormat_FLAC;
+			outputFormatGiven = true;
+			break;
+		case 'j': {
+			char *end;
+			long threads = strtol(optarg, &end, 10);
+			if (*optarg == '\0' || *end != '\0' || threads < 1 || threads > MAX_ENCODER_THREADS) {
+				fprintf(stderr, "Number of encoder threads must be between 1 and %d\n", MAX_ENCODER_THREADS);
+				printUsage(cmd);
+				return 0;
+			}
+			encoderThreads = (unsigned int)threads;
+			break;
+		}
 		case 'o':
 			dstFileNameArg = optarg;
 			break;
+		case 'p':
+			outputFormat = OutputFormat_RAW;
+			outputFormatGiven = true;
+			break;
 		case 'q':
 			quiet = true;
 			break;
 		case 'r':
 			sampleRate = atoi(optarg);
+			sampleRateGiven = true;
 			break;
 		case 's':
 			syxFileName = optarg;
@@ -417,48 +470,89 @@ int main(int argc, char *argv[]) {
 	}
 
 	char *dstFileName;
-	if (dstFileNameArg != NULL) {
+	if (compileFileName != NULL) {
+		dstFileName = compileFileName;
+		if (strcmp(dstFileName, STDOUT_FILE_NAME) == 0) {
+			fprintf(stderr, "Command streams can't be written to stdout.\n");
+			return -1;
+		}
+	} else if (dstFileNameArg != NULL) {
 		dstFileName = dstFileNameArg;
+		size_t dstFileNameLen = strlen(dstFileName);
+		if (!outputFormatGiven && dstFileNameLen >= 5 && strcmp(dstFileName + dstFileNameLen - 5, ".flac") == 0) {
+			outputFormat = OutputFormat_FLAC;
+		}
 	} else {
-		dstFileName = (char *)malloc(strlen(srcFileName) + 5);
+		dstFileName = (char *)malloc(strlen(srcFileName) + 6);
 		if(dstFileName == NULL) {
-			fprintf(stderr, "Error allocating %lu bytes for destination filename.\n", (unsigned long)strlen(srcFileName) + 5);
+			fprintf(stderr, "Error allocating %lu bytes for destination filename.\n", (unsigned long)strlen(srcFileName) + 6);
 			return -1;
 		}
-		sprintf(dstFileName, "%s.wav", srcFileName);
+		const char *extension = "wav";
+		if (outputFormat == OutputFormat_RAW) {
+			extension = "raw";
+		} else if (outputFormat == OutputFormat_FLAC) {
+			extension = "flac";
+		}
+		sprintf(dstFileName, "%s.%s", srcFileName, extension);
 	}
 
-	if (!force) {
-		// FIXME: Lame way of checking whether the file exists
-		FILE *testDstFile;
-		if (dstFileName != NULL && (testDstFile = fopen(dstFileName, "rb")) != NULL) {
-			fclose(testDstFile);
+	if (strcmp(dstFileName, STDOUT_FILE_NAME) == 0) {
+		infoFile = stderr;
+	} else if (!force) {
+		// Only regular files count - opening a FIFO to check would block until a writer came along,
+		// and there's nothing to overwrite anyway
+		struct stat dstStat;
+		if (dstFileName != NULL && stat(dstFileName, &dstStat) == 0 && S_ISREG(dstStat.st_mode)) {
 			fprintf(stderr, "Destination file '%s' exists.\n", dstFileName);
 			goto cleanup;
 		}
 	}
 
-	smf = smf_load(srcFileName);
-	if (smf != NULL) {
-		if (!quiet) {
-			char *decoded = smf_decode(smf);
-			fprintf(stdout, "%s.\n", decoded);
-			free(decoded);
+	if (CommandStream::isCommandStreamFile(srcFileName)) {
+		// Already compiled - all that's left to check is that it was compiled for the right sample rate
+		loaded = commandStream.load(srcFileName);
+		if (loaded) {
+			if (sampleRateGiven && sampleRate != commandStream.getSampleRate()) {
+				fprintf(stderr, "Command stream '%s' was compiled for a sample rate of %u Hz, not %u Hz.\n", srcFileName, commandStream.getSampleRate(), sampleRate);
+				loaded = false;
+			}
+			sampleRate = commandStream.getSampleRate();
 		}
-		assert(smf->number_of_tracks >= 1);
+	} else {
+		smf = smf_load_mapped(srcFileName);
+		if (smf != NULL) {
+			if (!quiet) {
+				char *decoded = smf_decode(smf);
+				fprintf(infoFile, "%s.\n", decoded);
+				free(decoded);
+			}
+			assert(smf->number_of_tracks >= 1);
+			loaded = commandStream.compile(smf, sampleRate, quiet ? NULL : infoFile);
+			smf_delete(smf);
+		} else {
+			fprintf(stderr, "Error parsing SMF file '%s'.\n", srcFileName);
+			loaded = false;
+		}
+	}
+
+	if (!loaded) {
+		rc = -1;
+	} else if (compileFileName != NULL) {
+		if (!commandStream.save(compileFileName)) {
+			rc = -1;
+		}
+	} else {
 		MT32Emu::SynthProperties synthProperties = {0};
 		synthProperties.sampleRate = sampleRate;
 		synthProperties.useReverb = true;
 		synthProperties.useDefaultReverb = true;
-		processSMF(syxFileName, smf, dstFileName, synthProperties, bufferSize, endAfter, renderUntilInactive, recordInitialSilence);
-		smf_delete(smf);
-	} else {
-		fprintf(stderr, "Error parsing SMF file '%s'.\n", srcFileName);
-		rc = -1;
+		synthProperties.printDebug = printDebug;
+		processCommandStream(syxFileName, commandStream, dstFileName, outputFormat, encoderThreads, synthProperties, bufferSize, endAfter, renderUntilInactive, recordInitialSilence);
 	}
 
 cleanup:
-	if(dstFileNameArg == NULL && dstFileName != NULL) {
+	if(compileFileName == NULL && dstFileNameArg == NULL && dstFileName != NULL) {
 		free(dstFileName);
 	}
 	return rc;